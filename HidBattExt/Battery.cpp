@@ -3,25 +3,34 @@
 #include <Poclass.h> // for IOCTL_BATTERY_QUERY_INFORMATION
 
 
-static void UpdateBatteryInformation(BATTERY_INFORMATION& bi, BatteryState& state) {
-    auto CycleCountBefore = bi.CycleCount;
-
-    WdfSpinLockAcquire(state.Lock);
-    bi.CycleCount = state.CycleCount;
-    WdfSpinLockRelease(state.Lock);
-
-    DebugPrint(DPFLTR_INFO_LEVEL, "HidBattExt: UpdateBatteryInformation CycleCount before=%u, after=%u\n", CycleCountBefore, bi.CycleCount); CycleCountBefore;
+/** Overwrite BatteryUsages values of a given information level in an IOCTL_BATTERY_QUERY_INFORMATION output buffer.
+    Returns the number of patched values. */
+static unsigned int PatchBatteryInformation(ULONG level, UCHAR* buffer, size_t bufferLen, const BatteryState& state) {
+    BatteryValues values;
+    state.Read(values); // lock-free snapshot
+
+    unsigned int patched = 0;
+    for (const BatteryUsage& usage : BatteryUsages) {
+        if ((usage.Level != level) || (bufferLen < usage.Offset + sizeof(ULONG)))
+            continue;
+
+        auto* value = (ULONG*)(buffer + usage.Offset);
+        auto before = *value;
+        *value = values.*usage.Member;
+
+        DebugPrint(DPFLTR_INFO_LEVEL, "HidBattExt: PatchBatteryInformation %s before=%u, after=%u\n", usage.Name, before, *value); before;
+        patched++;
+    }
+    return patched;
 }
 
-static void UpdateBatteryTemperature(ULONG& temp, BatteryState& state) {
-    auto TempBefore = temp;
-
-    WdfSpinLockAcquire(state.Lock);
-    temp = state.Temperature;
-    WdfSpinLockRelease(state.Lock);
-
-    // error 0xc0000010 (STATUS_INVALID_DEVICE_REQUEST) observed here
-    DebugPrint(DPFLTR_INFO_LEVEL, "HidBattExt: UpdateBatteryTemperature before=%u, after=%u\n", TempBefore, temp); TempBefore;
+/** Returns the usage that replaces failing queries of a given information level, or nullptr. */
+static const BatteryUsage* SubstituteUsage(ULONG level) {
+    for (const BatteryUsage& usage : BatteryUsages) {
+        if ((usage.Level == level) && usage.Substitute)
+            return &usage;
+    }
+    return nullptr;
 }
 
 
@@ -33,8 +42,8 @@ void EvtIoDeviceControlBattFilterCompletion (_In_  WDFREQUEST Request, _In_  WDF
     REQUEST_CONTEXT* reqCtx = WdfObjectGet_REQUEST_CONTEXT(Request);
 
     if (!NT_SUCCESS(WdfRequestGetStatus(Request))) {
-        if ((reqCtx->IoControlCode == IOCTL_BATTERY_QUERY_INFORMATION) && (reqCtx->InformationLevel == BatteryTemperature) && (WdfRequestGetStatus(Request) == STATUS_INVALID_DEVICE_REQUEST)) {
-            // continue despite IOCTL_BATTERY_QUERY_INFORMATION BatteryTemperature failure to filter query
+        if ((reqCtx->IoControlCode == IOCTL_BATTERY_QUERY_INFORMATION) && SubstituteUsage(reqCtx->InformationLevel) && (WdfRequestGetStatus(Request) == STATUS_INVALID_DEVICE_REQUEST)) {
+            // continue despite IOCTL_BATTERY_QUERY_INFORMATION failure for levels not supported by HidBatt to filter query
         } else {
             //DebugPrint(DPFLTR_ERROR_LEVEL, DML_ERR("HidBattExt: BattFilterCompletion IOCTL=0x%x, status=0x%x"), reqCtx->IoControlCode, WdfRequestGetStatus(Request));
             WdfRequestComplete(Request, WdfRequestGetStatus(Request));
@@ -63,17 +72,12 @@ void EvtIoDeviceControlBattFilterCompletion (_In_  WDFREQUEST Request, _In_  WDF
 
     //DebugPrint(DPFLTR_INFO_LEVEL, "HidBattExt: BattFilterCompletion: IOCTL_BATTERY_QUERY_INFORMATION (InformationLevel=%u, OutputBufferLength=%u, Information=%u, Status=0x%x)\n", reqCtx->InformationLevel, OutputBufferLength, WdfRequestGetInformation(Request), WdfRequestGetStatus(Request));
 
-    if ((reqCtx->InformationLevel == BatteryInformation) && (OutputBufferLength >= sizeof(BATTERY_INFORMATION))) {
-        auto* bi = (BATTERY_INFORMATION*)OutputBuffer;
-        UpdateBatteryInformation(*bi, *context->Interface.State);
-    } else if ((reqCtx->InformationLevel == BatteryTemperature) && (OutputBufferLength >= sizeof(ULONG))) {
-        auto* temp = (ULONG*)OutputBuffer;
-        UpdateBatteryTemperature(*temp, *context->Interface.State);
-        if (WdfRequestGetStatus(Request) == STATUS_INVALID_DEVICE_REQUEST) {
-            // fix failing query by making status succeed and increase output size
-            WdfRequestCompleteWithInformation(Request, STATUS_SUCCESS, sizeof(ULONG));
-            return;
-        }
+    unsigned int patched = PatchBatteryInformation(reqCtx->InformationLevel, (UCHAR*)OutputBuffer, OutputBufferLength, *context->Interface.State);
+    if (patched && (WdfRequestGetStatus(Request) == STATUS_INVALID_DEVICE_REQUEST)) {
+        // fix failing query by making status succeed and increase output size
+        const BatteryUsage* usage = SubstituteUsage(reqCtx->InformationLevel);
+        WdfRequestCompleteWithInformation(Request, STATUS_SUCCESS, usage->Offset + sizeof(ULONG));
+        return;
     }
 
     WdfRequestComplete(Request, WdfRequestGetStatus(Request));
@@ -0,0 +1,34 @@
+#pragma once
+/* Portable identification of HID report layouts without dependencies on the WDK, so that it can also be tested on other platforms. */
+
+
+/** 32bit FNV-1a hash. */
+inline unsigned int HashBytes(const unsigned char* data, unsigned int len) {
+    unsigned int hash = 2166136261u;
+    for (unsigned int i = 0; i < len; i++) {
+        hash ^= data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/** Identification of devices with identical HID report layout.
+    The descriptor hash tells apart collections of the same device, which share VendorID, ProductID, VersionNumber & DescriptorSize
+    but use different report IDs, and firmware that changes its reports without bumping VersionNumber. */
+struct HidConfigKey {
+    unsigned short VendorID = 0;
+    unsigned short ProductID = 0;
+    unsigned short VersionNumber = 0;
+    unsigned int   DescriptorSize = 0;
+    unsigned int   DescriptorHash = 0; // of preparsed data
+
+    HidConfigKey() = default;
+    HidConfigKey(unsigned short vendorId, unsigned short productId, unsigned short versionNumber, const unsigned char* descriptor, unsigned int descriptorSize)
+        : VendorID(vendorId), ProductID(productId), VersionNumber(versionNumber), DescriptorSize(descriptorSize), DescriptorHash(HashBytes(descriptor, descriptorSize)) {
+    }
+
+    bool operator ==(const HidConfigKey& other) const {
+        return (VendorID == other.VendorID) && (ProductID == other.ProductID) && (VersionNumber == other.VersionNumber)
+            && (DescriptorSize == other.DescriptorSize) && (DescriptorHash == other.DescriptorHash);
+    }
+};
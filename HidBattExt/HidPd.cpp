@@ -1,99 +1,394 @@
 #include "device.hpp"
 #include "HidPd.hpp"
-#include <hidclass.h> // for HID_COLLECTION_INFORMATION
 #include "CppAllocator.hpp"
+#include "HidConfigKey.hpp"
 
 
-static void UpdateBatteryState(BatteryState& state, HIDP_REPORT_TYPE reportType, CHAR* report, const HidConfig& hid) {
+static void UpdateBatteryState(BatteryState& state, HIDP_REPORT_TYPE reportType, const CHAR* report, HidConfig& hid) {
+    const ReportPlan<BatteryUsageCount>* plan = nullptr;
     USHORT reportLen = 0;
-    if (reportType == HidP_Input)
+    if (reportType == HidP_Input) {
+        plan = &hid.InputPlan;
         reportLen = hid.InputReportByteLength;
-    else if (reportType == HidP_Feature)
+    } else if (reportType == HidP_Feature) {
+        plan = &hid.FeaturePlan;
         reportLen = hid.FeatureReportByteLength;
-    else
+    } else {
         NT_ASSERTMSG("UpdateBatteryState invalid reportType", false);
+        return;
+    }
 
-    CHAR reportId = report[0];
+    UCHAR reportId = report[0];
+    auto fields = plan->Fields(reportId);
+    if (fields.begin() == fields.end())
+        return; // no tracked values in report
+
+    // capture shared state in a single versioned update
+    state.Update([&](BatteryValues& values) {
+        bool changed = false;
+        for (const ReportField& field : fields) {
+            const BatteryUsage& usage = BatteryUsages[field.Target];
+            ULONG value = usage.Scale*(ULONG)ExtractValue((const UCHAR*)report, reportLen, field);
+            changed |= (values.*usage.Member != value);
+            values.*usage.Member = value;
+        }
+        return changed;
+    });
+
+    // log changes since the last logged version. Reports mostly repeat the same values, so the copy is usually skipped
+    if (InterlockedCompareExchange(&hid.Logging, 1, 0))
+        return; // logged by concurrent completion, or caught up by the next report
+
+    BatteryValues after;
+    ULONG version = hid.LoggedVersion;
+    if (state.ReadIfChanged(after, version)) {
+        for (const BatteryUsage& usage : BatteryUsages) {
+            if (after.*usage.Member != hid.Logged.*usage.Member) {
+                DebugPrint(DPFLTR_INFO_LEVEL, "HidBattExt: Updating HID %s before=%u, after=%u\n", usage.Name, hid.Logged.*usage.Member, after.*usage.Member);
+            }
+        }
+        hid.Logged = after;
+        hid.LoggedVersion = version;
+    }
+    InterlockedExchange(&hid.Logging, 0);
+}
 
-    // capture shared state
-    if (hid.CycleCountReportID && (reportId == hid.CycleCountReportID)) {
-        const HidCode code = CycleCount_Code;
 
-        ULONG value = 0;
-        NTSTATUS status = HidP_GetUsageValue(reportType, code.UsagePage, /*default link collection*/0, code.Usage, &value, hid.GetPreparsedData(), report, reportLen);
-        if (!NT_SUCCESS(status)) {
-            DebugPrint(DPFLTR_ERROR_LEVEL, DML_ERR("HidBattExt: HidP_GetUsageValue failed UsagePage=0x%x, Usage=0x%x, (0x%x)"), code.UsagePage, code.Usage, status);
-            return;
-        }
+/** Locate a usage value in reports of a given type, by writing an all-ones value into an empty report and looking for the set bits.
+    Returns STATUS_NOT_FOUND if the usage is not present. */
+static NTSTATUS CompileField(HIDP_REPORT_TYPE reportType, HidCode code, UCHAR target, USHORT reportLen, USHORT valueCapsCount, PHIDP_PREPARSED_DATA preparsed, ReportField& field) {
+    if (!valueCapsCount)
+        return STATUS_NOT_FOUND;
 
-        auto CycleCountBefore = state.CycleCount;
+    // a usage can appear in several reports or collections, so make room for all value caps of the report type
+    RamArray<HIDP_VALUE_CAPS> allCaps(valueCapsCount);
+    if (!allCaps) {
+        DebugPrint(DPFLTR_ERROR_LEVEL, DML_ERR("HidBattExt: HIDP_VALUE_CAPS[%u] allocation failure."), valueCapsCount);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+    USHORT capsLen = valueCapsCount;
+    NTSTATUS status = HidP_GetSpecificValueCaps(reportType, code.UsagePage, /*default link collection*/0, code.Usage, allCaps, &capsLen, preparsed);
+    if ((status == HIDP_STATUS_USAGE_NOT_FOUND) || !capsLen)
+        return STATUS_NOT_FOUND;
+    if (!NT_SUCCESS(status)) {
+        DebugPrint(DPFLTR_ERROR_LEVEL, DML_ERR("HidBattExt: HidP_GetSpecificValueCaps failed UsagePage=0x%x, Usage=0x%x, (0x%x)"), code.UsagePage, code.Usage, status);
+        return status;
+    }
+    const HIDP_VALUE_CAPS& caps = allCaps[0]; // first occurrence, like HidP_GetUsageValue
 
-        WdfSpinLockAcquire(state.Lock);
-        state.CycleCount = value;
-        WdfSpinLockRelease(state.Lock);
+    RamArray<CHAR> report(reportLen); // zero-initialized
+    if (!report) {
+        DebugPrint(DPFLTR_ERROR_LEVEL, DML_ERR("HidBattExt: CHAR[%u] allocation failure."), reportLen);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+    report[0] = caps.ReportID;
 
-        if (state.CycleCount != CycleCountBefore) {
-            DebugPrint(DPFLTR_INFO_LEVEL, "HidBattExt: Updating HID CycleCount before=%u, after=%u\n", CycleCountBefore, state.CycleCount);
-        }
-    } else if (hid.TemperatureReportID && (reportId == hid.TemperatureReportID)) {
-        const HidCode code = Temperature_Code;
+    ULONG ones = (caps.BitSize >= 32) ? 0xFFFFFFFF : (1ul << caps.BitSize) - 1;
+    status = HidP_SetUsageValue(reportType, code.UsagePage, /*default link collection*/0, code.Usage, ones, preparsed, report, reportLen);
+    if (!NT_SUCCESS(status)) {
+        DebugPrint(DPFLTR_ERROR_LEVEL, DML_ERR("HidBattExt: HidP_SetUsageValue failed UsagePage=0x%x, Usage=0x%x, (0x%x)"), code.UsagePage, code.Usage, status);
+        return status;
+    }
 
-        ULONG value = 0;
-        NTSTATUS status = HidP_GetUsageValue(reportType, code.UsagePage, /*default link collection*/0, code.Usage, &value, hid.GetPreparsedData(), report, reportLen);
-        if (!NT_SUCCESS(status)) {
-            DebugPrint(DPFLTR_ERROR_LEVEL, DML_ERR("HidBattExt: HidP_GetUsageValue failed UsagePage=0x%x, Usage=0x%x, (0x%x)"), code.UsagePage, code.Usage, status);
-            return;
-        }
+    report[0] = 0; // exclude report ID from search
+    if (!LocateField((const UCHAR*)(CHAR*)report, reportLen, field))
+        return STATUS_NOT_FOUND;
 
-        auto TempBefore = state.Temperature;
+    field.ReportID = caps.ReportID;
+    field.Signed = caps.LogicalMin < 0;
+    field.Target = target;
 
-        WdfSpinLockAcquire(state.Lock);
-        // convert HID PD unit from (Kelvin) to BATTERY_QUERY_INFORMATION unit (10ths of a degree Kelvin)
-        state.Temperature = 10*value;
-        WdfSpinLockRelease(state.Lock);
+    DebugPrint(DPFLTR_INFO_LEVEL, "HidBattExt: UsagePage=0x%x, Usage=0x%x located in ReportID=0x%x, BitOffset=%u, BitSize=%u\n", code.UsagePage, code.Usage, field.ReportID, field.BitOffset, field.BitSize);
+    return STATUS_SUCCESS;
+}
 
-        if (state.Temperature != TempBefore) {
-            DebugPrint(DPFLTR_INFO_LEVEL, "HidBattExt: Updating HID Temperature before=%u, after=%u\n", TempBefore, state.Temperature);
-        }
+/** Add all BatteryUsages values present in reports of a given type to an extraction plan. */
+static NTSTATUS CompilePlan(ReportPlan<BatteryUsageCount>& plan, HIDP_REPORT_TYPE reportType, USHORT reportLen, USHORT valueCapsCount, PHIDP_PREPARSED_DATA preparsed) {
+    for (UCHAR i = 0; i < BatteryUsageCount; i++) {
+        ReportField field;
+        NTSTATUS status = CompileField(reportType, BatteryUsages[i].Code, i, reportLen, valueCapsCount, preparsed, field);
+        if (status == STATUS_NOT_FOUND)
+            continue; // usage not supported by device
+        if (!NT_SUCCESS(status))
+            return status;
+
+        if (!plan.Add(field))
+            return STATUS_BUFFER_OVERFLOW;
     }
+    return STATUS_SUCCESS;
 }
 
 
-/** Blocking IOCTL_HID_GET_FEATURE request with pre-populated report. */
-NTSTATUS GetFeatureReport(WDFIOTARGET target, UCHAR reportId) {
-    if (!reportId)
-        return STATUS_SUCCESS;
+/** HidConfig values derived from the preparsed data. */
+struct HidConfigCacheEntry {
+    HidConfigKey Key;
+    USHORT InputReportByteLength = 0;
+    USHORT FeatureReportByteLength = 0;
+    ReportPlan<BatteryUsageCount> InputPlan;
+    ReportPlan<BatteryUsageCount> FeaturePlan;
+};
+
+/** Driver-global cache of derived HidConfig values, so that identical devices skip re-parsing on arrival. */
+static constexpr ULONG HID_CONFIG_CACHE_SIZE = 8;
+static HidConfigCacheEntry s_configCache[HID_CONFIG_CACHE_SIZE];
+static ULONG s_configCacheCount = 0; // valid entries
+static ULONG s_configCacheNext = 0;  // next entry to overwrite when full
+static KSPIN_LOCK s_configCacheLock;
+
+void InitializeHidConfigCache() {
+    KeInitializeSpinLock(&s_configCacheLock);
+}
 
-    WDFDEVICE device = WdfIoTargetGetDevice(target);
-    DEVICE_CONTEXT* context = WdfObjectGet_DEVICE_CONTEXT(device);
+/** Populate derived HidConfig values from the cache. Returns false if not found. */
+static bool LookupHidConfig(const HidConfigKey& key, HidConfig& hid) {
+    bool found = false;
+
+    KIRQL oldIrql = 0;
+    KeAcquireSpinLock(&s_configCacheLock, &oldIrql);
+    for (ULONG i = 0; i < s_configCacheCount; i++) {
+        const HidConfigCacheEntry& entry = s_configCache[i];
+        if (!(entry.Key == key))
+            continue;
+
+        hid.InputReportByteLength = entry.InputReportByteLength;
+        hid.FeatureReportByteLength = entry.FeatureReportByteLength;
+        hid.InputPlan = entry.InputPlan;
+        hid.FeaturePlan = entry.FeaturePlan;
+        found = true;
+        break;
+    }
+    KeReleaseSpinLock(&s_configCacheLock, oldIrql);
 
-    // Battery Temperature query
-    RamArray<CHAR> report(context->Hid.FeatureReportByteLength);
-    report[0] = reportId;
+    return found;
+}
+
+/** Store derived HidConfig values in the cache, replacing the oldest entry if full. */
+static void StoreHidConfig(const HidConfigKey& key, const HidConfig& hid) {
+    KIRQL oldIrql = 0;
+    KeAcquireSpinLock(&s_configCacheLock, &oldIrql);
+
+    ULONG idx = 0;
+    if (s_configCacheCount < HID_CONFIG_CACHE_SIZE) {
+        idx = s_configCacheCount++;
+    } else {
+        idx = s_configCacheNext;
+        s_configCacheNext = (s_configCacheNext + 1) % HID_CONFIG_CACHE_SIZE;
+    }
 
-    WDF_MEMORY_DESCRIPTOR outputDesc = {};
-    WDF_MEMORY_DESCRIPTOR_INIT_BUFFER(&outputDesc, report, report.ByteSize());
+    HidConfigCacheEntry& entry = s_configCache[idx];
+    entry.Key = key;
+    entry.InputReportByteLength = hid.InputReportByteLength;
+    entry.FeatureReportByteLength = hid.FeatureReportByteLength;
+    entry.InputPlan = hid.InputPlan;
+    entry.FeaturePlan = hid.FeaturePlan;
 
-    NTSTATUS status = WdfIoTargetSendIoctlSynchronously(target, NULL,
-        IOCTL_HID_GET_FEATURE,
-        NULL, // input
-        &outputDesc, // output
-        NULL, NULL);
+    KeReleaseSpinLock(&s_configCacheLock, oldIrql);
+}
+
+/** Derive HidConfig values from the preparsed data. */
+static NTSTATUS ParseHidConfig(HidConfig& hid) {
+    // get capabilities
+    HIDP_CAPS caps = {};
+    NTSTATUS status = HidP_GetCaps(hid.GetPreparsedData(), &caps);
     if (!NT_SUCCESS(status)) {
-        DebugPrint(DPFLTR_ERROR_LEVEL, DML_ERR("HidBattExt: IOCTL_HID_GET_FEATURE failed 0x%x"), status);
+        DebugPrint(DPFLTR_ERROR_LEVEL, DML_ERR("HidBattExt: HidP_GetCaps failed 0x%x"), status);
         return status;
     }
 
-    UpdateBatteryState(context->LowState, HidP_Feature, report, context->Hid);
+    hid.InputReportByteLength = caps.InputReportByteLength;
+    hid.FeatureReportByteLength = caps.FeatureReportByteLength;
+
+    DebugPrint(DPFLTR_INFO_LEVEL, "HidBattExt: Usage=%x, UsagePage=%x, InputReportByteLength=%u, FeatureReportByteLength=%u\n", caps.Usage, caps.UsagePage, caps.InputReportByteLength, caps.FeatureReportByteLength);
+
+    // compile extraction plans for BatteryUsages values
+    PHIDP_PREPARSED_DATA preparsed = hid.GetPreparsedData();
+    status = CompilePlan(hid.InputPlan, HidP_Input, caps.InputReportByteLength, caps.NumberInputValueCaps, preparsed);
+    if (NT_SUCCESS(status))
+        status = CompilePlan(hid.FeaturePlan, HidP_Feature, caps.FeatureReportByteLength, caps.NumberFeatureValueCaps, preparsed);
     return status;
 }
 
+/** Format and send an asynchronous HID IOCTL on a preallocated request, with output to a region of "output". */
+static NTSTATUS SendHidIoctl(WDFREQUEST request, WDFIOTARGET target, ULONG ioctl, WDFMEMORY output, size_t outputOffset, size_t outputLen, PFN_WDF_REQUEST_COMPLETION_ROUTINE completion, WDFCONTEXT context) {
+    WDF_REQUEST_REUSE_PARAMS reuseParams = {};
+    WDF_REQUEST_REUSE_PARAMS_INIT(&reuseParams, WDF_REQUEST_REUSE_NO_FLAGS, STATUS_SUCCESS);
+    NTSTATUS status = WdfRequestReuse(request, &reuseParams);
+    if (!NT_SUCCESS(status)) {
+        DebugPrint(DPFLTR_ERROR_LEVEL, DML_ERR("HidBattExt: WdfRequestReuse failed 0x%x"), status);
+        return status;
+    }
+
+    WDFMEMORY_OFFSET outputRange = {};
+    outputRange.BufferOffset = outputOffset;
+    outputRange.BufferLength = outputLen;
+    status = WdfIoTargetFormatRequestForIoctl(target, request, ioctl, NULL, NULL, output, &outputRange);
+    if (!NT_SUCCESS(status)) {
+        DebugPrint(DPFLTR_ERROR_LEVEL, DML_ERR("HidBattExt: WdfIoTargetFormatRequestForIoctl IOCTL=0x%x failed 0x%x"), ioctl, status);
+        return status;
+    }
+
+    WdfRequestSetCompletionRoutine(request, completion, context);
+
+    if (!WdfRequestSend(request, target, WDF_NO_SEND_OPTIONS)) {
+        status = WdfRequestGetStatus(request);
+        DebugPrint(DPFLTR_ERROR_LEVEL, DML_ERR("HidBattExt: WdfRequestSend IOCTL=0x%x failed 0x%x"), ioctl, status);
+        return status;
+    }
+    return STATUS_SUCCESS;
+}
+
+/** Account for a completed FEATURE report query, and flag HidConfig as initialized when the last query succeeds. */
+static void FeatureQueryDone(HidConfig& hid, NTSTATUS status) {
+    if (!NT_SUCCESS(status))
+        InterlockedIncrement(&hid.FeatureFailures);
+
+    if (InterlockedDecrement(&hid.PendingFeatures) > 0)
+        return; // other queries still in flight
+
+    if (hid.FeatureFailures) {
+        DebugPrint(DPFLTR_ERROR_LEVEL, DML_ERR("HidBattExt: %u FEATURE report queries failed"), hid.FeatureFailures);
+        return;
+    }
+
+    // flag HidConfig struct as initialized
+    InterlockedIncrement(&hid.Initialized);
+    DebugPrint(DPFLTR_INFO_LEVEL, "HidBattExt: HID initialization completed\n");
+}
+
+/** IOCTL_HID_GET_FEATURE completion routine. */
+void EvtFeatureReportCompletion(_In_ WDFREQUEST Request, _In_ WDFIOTARGET Target, _In_ WDF_REQUEST_COMPLETION_PARAMS* Params, _In_ WDFCONTEXT Context) {
+    UNREFERENCED_PARAMETER(Target);
+    DEVICE_CONTEXT* context = WdfObjectGet_DEVICE_CONTEXT((WDFDEVICE)Context);
+
+    NTSTATUS status = WdfRequestGetStatus(Request);
+    if (NT_SUCCESS(status)) {
+        auto* report = (CHAR*)WdfMemoryGetBuffer(Params->Parameters.Ioctl.Output.Buffer, nullptr) + Params->Parameters.Ioctl.Output.Offset;
+        UpdateBatteryState(context->LowState, HidP_Feature, report, context->Hid);
+    } else {
+        DebugPrint(DPFLTR_ERROR_LEVEL, DML_ERR("HidBattExt: IOCTL_HID_GET_FEATURE failed 0x%x"), status);
+    }
+
+    FeatureQueryDone(context->Hid, status);
+}
+
+/** Query all FEATURE reports with tracked values concurrently, with one preallocated request per report. */
+static NTSTATUS QueryFeatureReports(WDFDEVICE Device) {
+    DEVICE_CONTEXT* context = WdfObjectGet_DEVICE_CONTEXT(Device);
+    HidConfig& hid = context->Hid;
+
+    // collect distinct report IDs (fields are sorted by report ID)
+    UCHAR reportIds[BatteryUsageCount] = {};
+    ULONG reportCount = 0;
+    for (const ReportField& field : hid.FeaturePlan) {
+        if (reportCount && (reportIds[reportCount - 1] == field.ReportID))
+            continue; // report already included
+        reportIds[reportCount++] = field.ReportID;
+    }
+
+    if (!reportCount) {
+        // no FEATURE reports to query
+        InterlockedIncrement(&hid.Initialized);
+        return STATUS_SUCCESS;
+    }
+
+    // single allocation for all report buffers
+    const size_t reportLen = hid.FeatureReportByteLength;
+    WDF_OBJECT_ATTRIBUTES attr{};
+    WDF_OBJECT_ATTRIBUTES_INIT(&attr);
+    attr.ParentObject = Device; // auto-delete when "Device" is deleted
+
+    NTSTATUS status = WdfMemoryCreate(&attr, NonPagedPoolNx, POOL_TAG, reportCount*reportLen, &hid.FeatureReports, nullptr);
+    if (!NT_SUCCESS(status)) {
+        DebugPrint(DPFLTR_ERROR_LEVEL, DML_ERR("HidBattExt: WdfMemoryCreate failed 0x%x"), status);
+        return status;
+    }
+
+    auto* reports = (CHAR*)WdfMemoryGetBuffer(hid.FeatureReports, nullptr);
+    RtlZeroMemory(reports, reportCount*reportLen);
+
+    hid.PendingFeatures = reportCount; // before sending, since completions may run immediately
+    for (ULONG i = 0; i < reportCount; i++) {
+        reports[i*reportLen] = reportIds[i];
+
+        status = SendHidIoctl(hid.FeatureRequests[i], hid.Target, IOCTL_HID_GET_FEATURE, hid.FeatureReports, i*reportLen, reportLen, EvtFeatureReportCompletion, Device);
+        if (!NT_SUCCESS(status))
+            FeatureQueryDone(hid, status); // no completion will follow
+    }
+    return STATUS_SUCCESS;
+}
+
+/** IOCTL_HID_GET_COLLECTION_DESCRIPTOR completion routine. Derives HidConfig values (from cache if possible), and continues with FEATURE report queries. */
+void EvtCollectionDescriptorCompletion(_In_ WDFREQUEST Request, _In_ WDFIOTARGET Target, _In_ WDF_REQUEST_COMPLETION_PARAMS* Params, _In_ WDFCONTEXT Context) {
+    UNREFERENCED_PARAMETER(Target);
+    UNREFERENCED_PARAMETER(Params);
+    auto Device = (WDFDEVICE)Context;
+    DEVICE_CONTEXT* context = WdfObjectGet_DEVICE_CONTEXT(Device);
+    HidConfig& hid = context->Hid;
+
+    NTSTATUS status = WdfRequestGetStatus(Request);
+    if (!NT_SUCCESS(status)) {
+        DebugPrint(DPFLTR_ERROR_LEVEL, DML_ERR("HidBattExt: IOCTL_HID_GET_COLLECTION_DESCRIPTOR failed 0x%x"), status);
+        return;
+    }
+
+    // collections of a shared interface only differ in their report IDs, so the key includes a hash of the preparsed data
+    HidConfigKey key(hid.CollectionInfo.VendorID, hid.CollectionInfo.ProductID, hid.CollectionInfo.VersionNumber,
+        (const UCHAR*)hid.GetPreparsedData(), hid.CollectionInfo.DescriptorSize);
+
+    if (LookupHidConfig(key, hid)) {
+        DebugPrint(DPFLTR_INFO_LEVEL, "HidBattExt: HidConfig cache hit (hash=0x%x)\n", key.DescriptorHash);
+    } else {
+        status = ParseHidConfig(hid);
+        if (!NT_SUCCESS(status))
+            return;
+
+        StoreHidConfig(key, hid);
+    }
+
+    QueryFeatureReports(Device);
+}
+
+/** IOCTL_HID_GET_COLLECTION_INFORMATION completion routine. Continues with retrieving the preparsed data on the same request. */
+void EvtCollectionInformationCompletion(_In_ WDFREQUEST Request, _In_ WDFIOTARGET Target, _In_ WDF_REQUEST_COMPLETION_PARAMS* Params, _In_ WDFCONTEXT Context) {
+    UNREFERENCED_PARAMETER(Params);
+    auto Device = (WDFDEVICE)Context;
+    DEVICE_CONTEXT* context = WdfObjectGet_DEVICE_CONTEXT(Device);
+
+    NTSTATUS status = WdfRequestGetStatus(Request);
+    if (!NT_SUCCESS(status)) {
+        DebugPrint(DPFLTR_ERROR_LEVEL, DML_ERR("HidBattExt: IOCTL_HID_GET_COLLECTION_INFORMATION failed 0x%x"), status);
+        return;
+    }
+
+    const HID_COLLECTION_INFORMATION& collectionInfo = context->Hid.CollectionInfo;
+    DebugPrint(DPFLTR_INFO_LEVEL, "HidBattExt: ProductID=%x, VendorID=%x, VersionNumber=%u, DescriptorSize=%u\n", collectionInfo.ProductID, collectionInfo.VendorID, collectionInfo.VersionNumber, collectionInfo.DescriptorSize);
+
+    WDF_OBJECT_ATTRIBUTES attr{};
+    WDF_OBJECT_ATTRIBUTES_INIT(&attr);
+    attr.ParentObject = Device; // auto-delete when "Device" is deleted
+
+    // allocate "preparsedData"
+    status = WdfMemoryCreate(&attr, NonPagedPoolNx, POOL_TAG, collectionInfo.DescriptorSize, &context->Hid.Preparsed, nullptr);
+    if (!NT_SUCCESS(status)) {
+        DebugPrint(DPFLTR_ERROR_LEVEL, DML_ERR("HidBattExt: WdfMemoryCreate failed 0x%x"), status);
+        return;
+    }
+
+    // populate "preparsedData"
+    SendHidIoctl(Request, Target, IOCTL_HID_GET_COLLECTION_DESCRIPTOR, // same as HidD_GetPreparsedData in user-mode
+        context->Hid.Preparsed, 0, collectionInfo.DescriptorSize, EvtCollectionDescriptorCompletion, Context);
+}
+
 NTSTATUS InitializeHidState(_In_ WDFDEVICE Device) {
     DEVICE_CONTEXT* context = WdfObjectGet_DEVICE_CONTEXT(Device);
-    WDFIOTARGET_Wrap pdoTarget;
+    HidConfig& hid = context->Hid;
     {
+        WDF_OBJECT_ATTRIBUTES attr{};
+        WDF_OBJECT_ATTRIBUTES_INIT(&attr);
+        attr.ParentObject = Device; // auto-delete when "Device" is deleted
+
         // Use PDO for HID commands instead of local IO target to avoid 0xc0000061 (STATUS_PRIVILEGE_NOT_HELD) on IOCTL_HID_SET_FEATURE
-        NTSTATUS status = WdfIoTargetCreate(Device, WDF_NO_OBJECT_ATTRIBUTES, &pdoTarget);
+        NTSTATUS status = WdfIoTargetCreate(Device, &attr, &hid.Target);
         if (!NT_SUCCESS(status)) {
             DebugPrint(DPFLTR_ERROR_LEVEL, DML_ERR("HidBattExt: WdfIoTargetCreate failed 0x%x"), status);
             return status;
@@ -105,114 +400,43 @@ NTSTATUS InitializeHidState(_In_ WDFDEVICE Device) {
         // We will let the framework to respond automatically to the pnp state changes of the target by closing and opening the handle.
         openParams.ShareAccess = FILE_SHARE_WRITE | FILE_SHARE_READ | FILE_SHARE_DELETE;
 
-        status = WdfIoTargetOpen(pdoTarget, &openParams);
+        status = WdfIoTargetOpen(hid.Target, &openParams);
         if (!NT_SUCCESS(status)) {
             DebugPrint(DPFLTR_ERROR_LEVEL, DML_ERR("HidBattExt: WdfIoTargetOpen failed 0x%x"), status);
             return status;
         }
     }
 
-    HID_COLLECTION_INFORMATION collectionInfo = {};
-    {
-        // populate "collectionInformation"
-        WDF_MEMORY_DESCRIPTOR outputDesc = {};
-        WDF_MEMORY_DESCRIPTOR_INIT_BUFFER(&outputDesc, &collectionInfo, sizeof(HID_COLLECTION_INFORMATION));
-
-        NTSTATUS status = WdfIoTargetSendIoctlSynchronously(pdoTarget, NULL,
-            IOCTL_HID_GET_COLLECTION_INFORMATION,
-            NULL, // input
-            &outputDesc, // output
-            NULL, NULL);
-        if (!NT_SUCCESS(status)) {
-            DebugPrint(DPFLTR_ERROR_LEVEL, DML_ERR("HidBattExt: IOCTL_HID_GET_COLLECTION_INFORMATION failed 0x%x"), status);
-            return status;
-        }
-
-        DebugPrint(DPFLTR_INFO_LEVEL, "HidBattExt: ProductID=%x, VendorID=%x, VersionNumber=%u, DescriptorSize=%u\n", collectionInfo.ProductID, collectionInfo.VendorID, collectionInfo.VersionNumber, collectionInfo.DescriptorSize);
-    }
-
     {
+        // preallocate requests for the initialization pipeline, so that no request allocation is needed in completion routines
         WDF_OBJECT_ATTRIBUTES attr{};
         WDF_OBJECT_ATTRIBUTES_INIT(&attr);
-        attr.ParentObject = Device; // auto-delete when "Device" is deleted
-
-        // allocate "preparsedData"
-        NTSTATUS status = WdfMemoryCreate(&attr, NonPagedPoolNx, POOL_TAG, collectionInfo.DescriptorSize, &context->Hid.Preparsed, nullptr);
-        if (!NT_SUCCESS(status)) {
-            DebugPrint(DPFLTR_ERROR_LEVEL, DML_ERR("HidBattExt: WdfMemoryCreate failed 0x%x"), status);
-            return status;
-        }
+        attr.ParentObject = hid.Target; // auto-delete with I/O target
 
-        WDF_MEMORY_DESCRIPTOR outputDesc = {};
-        WDF_MEMORY_DESCRIPTOR_INIT_HANDLE(&outputDesc, context->Hid.Preparsed, NULL);
-
-        // populate "preparsedData"
-        status = WdfIoTargetSendIoctlSynchronously(pdoTarget, NULL,
-            IOCTL_HID_GET_COLLECTION_DESCRIPTOR, // same as HidD_GetPreparsedData in user-mode
-            NULL, // input
-            &outputDesc, // output
-            NULL, NULL);
+        NTSTATUS status = WdfRequestCreate(&attr, hid.Target, &hid.ControlRequest);
+        for (ULONG i = 0; NT_SUCCESS(status) && (i < BatteryUsageCount); i++)
+            status = WdfRequestCreate(&attr, hid.Target, &hid.FeatureRequests[i]);
         if (!NT_SUCCESS(status)) {
-            DebugPrint(DPFLTR_ERROR_LEVEL, DML_ERR("HidBattExt: IOCTL_HID_GET_COLLECTION_DESCRIPTOR failed 0x%x"), status);
+            DebugPrint(DPFLTR_ERROR_LEVEL, DML_ERR("HidBattExt: WdfRequestCreate failed 0x%x"), status);
             return status;
         }
     }
 
     {
-        // get capabilities
-        HIDP_CAPS caps = {};
-        NTSTATUS status = HidP_GetCaps(context->Hid.GetPreparsedData(), &caps);
-        if (!NT_SUCCESS(status)) {
-            return status;
-        }
-
-        context->Hid.InputReportByteLength = caps.InputReportByteLength;
-        context->Hid.FeatureReportByteLength = caps.FeatureReportByteLength;
-
-        DebugPrint(DPFLTR_INFO_LEVEL, "HidBattExt: Usage=%x, UsagePage=%x, InputReportByteLength=%u, FeatureReportByteLength=%u\n", caps.Usage, caps.UsagePage, caps.InputReportByteLength, caps.FeatureReportByteLength);
+        // populate "collectionInformation" asynchronously, so that the PnP notification thread is not blocked
+        WDF_OBJECT_ATTRIBUTES attr{};
+        WDF_OBJECT_ATTRIBUTES_INIT(&attr);
+        attr.ParentObject = hid.ControlRequest; // auto-delete with request
 
-        // get FEATURE report value caps
-        USHORT valueCapsLen = caps.NumberFeatureValueCaps;
-        RamArray<HIDP_VALUE_CAPS> valueCaps(valueCapsLen);
-        if (!valueCaps) {
-            DebugPrint(DPFLTR_ERROR_LEVEL, DML_ERR("HidBattExt: HIDP_VALUE_CAPS[%u] allocation failure."), valueCapsLen);
-            return status;
-        }
-        status = HidP_GetValueCaps(HidP_Feature, valueCaps, &valueCapsLen, context->Hid.GetPreparsedData());
+        WDFMEMORY output = 0;
+        NTSTATUS status = WdfMemoryCreatePreallocated(&attr, &hid.CollectionInfo, sizeof(HID_COLLECTION_INFORMATION), &output);
         if (!NT_SUCCESS(status)) {
-            DebugPrint(DPFLTR_ERROR_LEVEL, DML_ERR("HidBattExt: HidP_GetValueCaps failed 0x%x"), status);
+            DebugPrint(DPFLTR_ERROR_LEVEL, DML_ERR("HidBattExt: WdfMemoryCreatePreallocated failed 0x%x"), status);
             return status;
         }
 
-        // identify ReportID codes for Temperature and CycleCount
-        for (USHORT i = 0; i < valueCapsLen; i++) {
-            if ((valueCaps[i].UsagePage == Temperature_Code.UsagePage) && (valueCaps[i].NotRange.Usage == Temperature_Code.Usage)) {
-                context->Hid.TemperatureReportID = valueCaps[i].ReportID;
-                DebugPrint(DPFLTR_INFO_LEVEL, "HidBattExt: Temperature ReportID is 0x%x\n", valueCaps[i].ReportID);
-
-            }
-            if ((valueCaps[i].UsagePage == CycleCount_Code.UsagePage) && (valueCaps[i].NotRange.Usage == CycleCount_Code.Usage)) {
-                context->Hid.CycleCountReportID = valueCaps[i].ReportID;
-                DebugPrint(DPFLTR_INFO_LEVEL, "HidBattExt: CycleCount ReportID is 0x%x\n", valueCaps[i].ReportID);
-            }
-        }
+        return SendHidIoctl(hid.ControlRequest, hid.Target, IOCTL_HID_GET_COLLECTION_INFORMATION, output, 0, sizeof(HID_COLLECTION_INFORMATION), EvtCollectionInformationCompletion, Device);
     }
-
-    {
-        // query FEATURE reports
-        NTSTATUS status = GetFeatureReport(pdoTarget, context->Hid.TemperatureReportID);
-        if (!NT_SUCCESS(status))
-            return status;
-
-        status = GetFeatureReport(pdoTarget, context->Hid.CycleCountReportID);
-        if (!NT_SUCCESS(status))
-            return status;
-    }
-
-    // flag HidConfig struct as initialized
-    InterlockedIncrement(&context->Hid.Initialized);
-
-    return STATUS_SUCCESS;
 }
 
 
@@ -25,6 +25,11 @@ private:
 };
 
 
+/** Initialize the driver-global cache of derived HidConfig values. Called from DriverEntry. */
+void InitializeHidConfigCache();
+
+/** Open the HID PDO and start the asynchronous HidConfig initialization pipeline. Returns without waiting for the HID requests to complete.
+    HidConfig::Initialized is set when the extraction plans are compiled and all FEATURE reports have been parsed. */
 NTSTATUS InitializeHidState(_In_ WDFDEVICE Device);
 
 EVT_WDF_IO_QUEUE_IO_READ           EvtIoReadHidFilter;
@@ -0,0 +1,240 @@
+#pragma once
+/* Portable HID report parsing without dependencies on the WDK, so that it can also be tested on other platforms.
+   Report buffers follow the Windows convention of always starting with the report ID byte (0 if report IDs are not used). */
+
+
+/** Location of a value in a HID report. */
+struct ReportField {
+    unsigned char  ReportID = 0;
+    unsigned short BitOffset = 0; // from start of report buffer, including the report ID byte
+    unsigned char  BitSize = 0;   // [1, 32]
+    bool           Signed = false;
+    unsigned char  Target = 0;    // application-defined destination of the value
+};
+
+/** Extract a little-endian bitfield value from a report buffer. Returns 0 if the field is outside the buffer. */
+inline long long ExtractValue(const unsigned char* report, unsigned int reportLen, const ReportField& field) {
+    if (!field.BitSize || (field.BitSize > 32) || ((field.BitOffset + field.BitSize + 7u)/8 > reportLen))
+        return 0;
+
+    unsigned int first = field.BitOffset/8;
+    unsigned int shift = field.BitOffset%8;
+
+    // gather the (at most 5) bytes that contain the field
+    unsigned long long raw = 0;
+    for (unsigned int i = 0; 8*i < shift + field.BitSize; i++)
+        raw |= (unsigned long long)report[first + i] << (8*i);
+
+    raw = (raw >> shift) & ((1ull << field.BitSize) - 1);
+    if (field.Signed && (raw >> (field.BitSize - 1)))
+        return (long long)raw - (1ll << field.BitSize); // sign extend
+    return (long long)raw;
+}
+
+/** Locate the bitfield of the set bits in a report buffer, which has been populated with an all-ones value for a single field.
+    Updates BitOffset & BitSize of "field", and returns false if no bits are set. */
+inline bool LocateField(const unsigned char* mask, unsigned int maskLen, ReportField& field) {
+    int first = -1;
+    int last = -1;
+    for (unsigned int i = 0; i < 8*maskLen; i++) {
+        if (mask[i/8] & (1 << (i%8))) {
+            if (first < 0)
+                first = i;
+            last = i;
+        }
+    }
+    if ((first < 0) || (last - first >= 32))
+        return false;
+
+    field.BitOffset = (unsigned short)first;
+    field.BitSize = (unsigned char)(last - first + 1);
+    return true;
+}
+
+/** Fixed-capacity list of report fields to extract, compiled once when the device is initialized.
+    Fields are kept sorted by report ID, with an index to the first field of each report for constant-time dispatch. */
+template <unsigned int N>
+class ReportPlan {
+    static_assert(N < 256, "index limited to 8bit positions");
+public:
+    /** Contiguous fields belonging to the same report. */
+    struct Range {
+        const ReportField* first;
+        const ReportField* last;
+
+        const ReportField* begin() const {
+            return first;
+        }
+        const ReportField* end() const {
+            return last;
+        }
+    };
+
+    /** Returns false if the plan is full. */
+    bool Add(const ReportField& field) {
+        if (m_count >= N)
+            return false;
+
+        // insert sorted by report ID
+        unsigned int pos = m_count;
+        for (; (pos > 0) && (m_fields[pos - 1].ReportID > field.ReportID); pos--)
+            m_fields[pos] = m_fields[pos - 1];
+        m_fields[pos] = field;
+        m_count++;
+
+        // rebuild index of first field per report ID
+        pos = 0;
+        for (unsigned int id = 0; id <= 256; id++) {
+            while ((pos < m_count) && (m_fields[pos].ReportID < id))
+                pos++;
+            m_index[id] = (unsigned char)pos;
+        }
+        return true;
+    }
+
+    /** Fields in reports with a given ID. */
+    Range Fields(unsigned char reportId) const {
+        return Range{m_fields + m_index[reportId], m_fields + m_index[reportId + 1]};
+    }
+
+    unsigned int Count() const {
+        return m_count;
+    }
+
+    const ReportField* begin() const {
+        return m_fields;
+    }
+    const ReportField* end() const {
+        return m_fields + m_count;
+    }
+
+private:
+    ReportField   m_fields[N];
+    unsigned int  m_count = 0;
+    unsigned char m_index[257] = {}; // position of first field with ReportID >= index
+};
+
+// HID short item prefixes (tag & type bits, with size bits masked out) HID1.11 Page 26 6.2.2.2 Short Items
+static constexpr unsigned char HidItem_Input = 0x80;
+static constexpr unsigned char HidItem_Output = 0x90;
+static constexpr unsigned char HidItem_Feature = 0xB0;
+
+/** Call "visit(usage, field)" for each value with a usage in INPUT, OUTPUT or FEATURE reports ("mainItem") of a raw HID report descriptor,
+    in descriptor order. "usage" is the extended usage (page << 16 | usage), and "field.BitSize" is 0 for values wider than 32 bits.
+    Stops and returns true as soon as "visit" returns true.
+    Intended for host-side testing & tools, since the raw descriptor is not available to HID class clients on Windows. Does not support PUSH/POP or delimiters. */
+template <class Visitor>
+bool ForEachField(const unsigned char* desc, unsigned int descLen, unsigned char mainItem, Visitor visit) {
+    unsigned short reportBits[256] = {}; // bits used so far per report ID (excluding report ID byte)
+
+    // global items
+    unsigned long page = 0;
+    long logicalMin = 0;
+    unsigned long reportSize = 0;
+    unsigned long reportCount = 0;
+    unsigned char reportId = 0;
+
+    // local items
+    unsigned long usages[16] = {}; // extended usages (page << 16 | usage)
+    unsigned int usageCount = 0;
+    unsigned long usageMin = 0;
+    unsigned long usageMax = 0;
+
+    for (unsigned int pos = 0; pos < descLen; ) {
+        unsigned char prefix = desc[pos];
+        if (prefix == 0xFE) {
+            // long item
+            if (pos + 1 >= descLen)
+                return false;
+            pos += 3 + desc[pos + 1];
+            continue;
+        }
+
+        unsigned int size = ((prefix & 0x03) == 3) ? 4 : (prefix & 0x03);
+        if (pos + 1 + size > descLen)
+            return false;
+
+        unsigned long data = 0;
+        for (unsigned int i = 0; i < size; i++)
+            data |= (unsigned long)desc[pos + 1 + i] << (8*i);
+        long sdata = (long)data; // sign extended
+        if (size == 4)
+            sdata = (long)(int)data;
+        else if (size && (data >> (8*size - 1)))
+            sdata -= 1l << (8*size);
+
+        unsigned char item = prefix & 0xFC;
+        switch (item) {
+        case 0x04: page = data; break;              // USAGE_PAGE
+        case 0x14: logicalMin = sdata; break;       // LOGICAL_MINIMUM
+        case 0x74: reportSize = data; break;        // REPORT_SIZE
+        case 0x84: reportId = (unsigned char)data; break; // REPORT_ID
+        case 0x94: reportCount = data; break;       // REPORT_COUNT
+        case 0x08:                                  // USAGE
+            if (usageCount < 16)
+                usages[usageCount++] = (size == 4) ? data : (page << 16 | data);
+            break;
+        case 0x18: usageMin = (size == 4) ? data : (page << 16 | data); break; // USAGE_MINIMUM
+        case 0x28: usageMax = (size == 4) ? data : (page << 16 | data); break; // USAGE_MAXIMUM
+        case HidItem_Input:
+        case HidItem_Output:
+        case HidItem_Feature:
+            if (item == mainItem) {
+                for (unsigned long i = 0; i < reportCount; i++) {
+                    // padding fields have no usage
+                    unsigned long u = 0;
+                    if (usageCount)
+                        u = usages[(i < usageCount) ? i : usageCount - 1];
+                    else if (usageMin || usageMax)
+                        u = (usageMin + i <= usageMax) ? usageMin + i : usageMax;
+
+                    if (!u)
+                        continue;
+                    ReportField field;
+                    field.ReportID = reportId;
+                    field.BitOffset = (unsigned short)(8 + reportBits[reportId] + i*reportSize);
+                    field.BitSize = (reportSize <= 32) ? (unsigned char)reportSize : 0;
+                    field.Signed = logicalMin < 0;
+                    if (visit(u, field))
+                        return true;
+                }
+                reportBits[reportId] += (unsigned short)(reportSize*reportCount);
+            }
+            usageCount = 0;
+            usageMin = usageMax = 0;
+            break;
+        case 0xA0: // COLLECTION
+        case 0xC0: // END_COLLECTION
+            usageCount = 0;
+            usageMin = usageMax = 0;
+            break;
+        }
+
+        pos += 1 + size;
+    }
+    return false;
+}
+
+/** Locate the first value with a given usage in INPUT, OUTPUT or FEATURE reports ("mainItem") of a raw HID report descriptor,
+    which is the one that HidP_GetUsageValue resolves to. "field.Target" is left unchanged. */
+inline bool FindField(const unsigned char* desc, unsigned int descLen, unsigned char mainItem, unsigned short usagePage, unsigned short usage, ReportField& field) {
+    const unsigned long target = (unsigned long)usagePage << 16 | usage;
+    ReportField found;
+    if (!ForEachField(desc, descLen, mainItem, [&](unsigned long u, const ReportField& f) { found = f; return u == target; }))
+        return false;
+
+    field.ReportID = found.ReportID;
+    field.BitOffset = found.BitOffset;
+    field.BitSize = found.BitSize;
+    field.Signed = found.Signed;
+    return field.BitSize > 0;
+}
+
+/** Number of values with a given usage in INPUT, OUTPUT or FEATURE reports ("mainItem") of a raw HID report descriptor.
+    HidP_GetSpecificValueCaps returns one value caps entry per such value, so this is the buffer size that a query for the usage needs. */
+inline unsigned int CountFields(const unsigned char* desc, unsigned int descLen, unsigned char mainItem, unsigned short usagePage, unsigned short usage) {
+    const unsigned long target = (unsigned long)usagePage << 16 | usage;
+    unsigned int count = 0;
+    ForEachField(desc, descLen, mainItem, [&](unsigned long u, const ReportField&) { count += (u == target); return false; });
+    return count;
+}
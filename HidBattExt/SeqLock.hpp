@@ -0,0 +1,130 @@
+#pragma once
+/* Portable sequence lock, so that it can also be stress-tested on other platforms.
+   Uses the WDK memory access primitives in kernel-mode (requires <ntddk.h> to be included first), and GCC/Clang atomic builtins otherwise. */
+
+
+/** Sequence lock for sharing a small trivially-copyable value with lock-free readers.
+    Writers are serialized by an odd sequence number, whereas readers retry if the sequence number changed during their copy.
+    The sequence number doubles as version counter, since it only advances when the value changes. */
+template <class T>
+class SeqLock {
+public:
+#ifdef _KERNEL_MODE
+    typedef ULONG Word;
+#else
+    typedef unsigned int Word;
+#endif
+    static_assert(sizeof(T) % sizeof(Word) == 0, "value size must be a multiple of the word size");
+
+    /** Modify the value. "update" is called with a copy of the current value, and returns true if it modified the copy, which is then published.
+        Writers spin while another writer is active, so the caller must prevent readers or writers from preempting it on the same CPU. */
+    template <class F>
+    void Update(F update) {
+        Word seq = BeginWrite();
+
+        T value;
+        Load(value);
+        if (update(value)) {
+            Store(value);
+            StoreRelease(m_seq, seq + 2);
+        } else {
+            StoreRelease(m_seq, seq); // unchanged, so keep the version
+        }
+    }
+
+    /** Copy the value without blocking writers. Returns the version of the copy. */
+    Word Read(T& value) const {
+        for (;;) {
+            Word seq = LoadAcquire(m_seq);
+            if (seq & 1)
+                continue; // write in progress
+
+            Load(value);
+            Fence();
+            if (LoadRelaxed(m_seq) == seq)
+                return seq;
+        }
+    }
+
+    /** Copy the value only if it changed since "version". Returns true & updates "version" if copied. */
+    bool ReadIfChanged(T& value, Word& version) const {
+        if (LoadAcquire(m_seq) == version)
+            return false; // skip the copy
+
+        version = Read(value);
+        return true;
+    }
+
+    /** Current version. Even numbers are published versions, starting at 0. */
+    Word Version() const {
+        return LoadAcquire(m_seq);
+    }
+
+private:
+    /** Wait for other writers, and flag write in progress. Returns the (even) version before the write. */
+    Word BeginWrite() {
+        for (;;) {
+            Word seq = LoadRelaxed(m_seq);
+            if (!(seq & 1) && CompareExchange(m_seq, seq, seq + 1)) {
+                Fence(); // readers that observe the new data must also observe the odd version
+                return seq;
+            }
+        }
+    }
+
+    void Load(T& value) const {
+        for (unsigned int i = 0; i < WordCount; i++)
+            ((Word*)&value)[i] = LoadRelaxed(m_data[i]);
+    }
+
+    void Store(const T& value) {
+        for (unsigned int i = 0; i < WordCount; i++)
+            StoreRelaxed(m_data[i], ((const Word*)&value)[i]);
+    }
+
+#ifdef _KERNEL_MODE
+    static Word LoadRelaxed(const volatile Word& src) {
+        return ReadULongNoFence(&src);
+    }
+    static Word LoadAcquire(const volatile Word& src) {
+        return ReadULongAcquire(&src);
+    }
+    static void StoreRelaxed(volatile Word& dst, Word value) {
+        WriteULongNoFence(&dst, value);
+    }
+    static void StoreRelease(volatile Word& dst, Word value) {
+        WriteULongRelease(&dst, value);
+    }
+    static bool CompareExchange(volatile Word& dst, Word expected, Word value) {
+        return (Word)InterlockedCompareExchange((volatile LONG*)&dst, (LONG)value, (LONG)expected) == expected;
+    }
+    /** Full memory barrier. */
+    static void Fence() {
+        KeMemoryBarrier();
+    }
+#else
+    static Word LoadRelaxed(const volatile Word& src) {
+        return __atomic_load_n(&src, __ATOMIC_RELAXED);
+    }
+    static Word LoadAcquire(const volatile Word& src) {
+        return __atomic_load_n(&src, __ATOMIC_ACQUIRE);
+    }
+    static void StoreRelaxed(volatile Word& dst, Word value) {
+        __atomic_store_n(&dst, value, __ATOMIC_RELAXED);
+    }
+    static void StoreRelease(volatile Word& dst, Word value) {
+        __atomic_store_n(&dst, value, __ATOMIC_RELEASE);
+    }
+    static bool CompareExchange(volatile Word& dst, Word expected, Word value) {
+        return __atomic_compare_exchange_n(&dst, &expected, value, /*weak*/false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+    }
+    static void Fence() {
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    }
+#endif
+
+    static constexpr unsigned int WordCount = sizeof(T)/sizeof(Word);
+
+    volatile Word m_seq = 0;             // odd while a write is in progress
+    volatile Word m_data[WordCount] = {}; // value, accessed word-by-word to avoid torn reads of individual words
+};
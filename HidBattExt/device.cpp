@@ -171,8 +171,6 @@ NTSTATUS EvtDriverDeviceAdd(_In_ WDFDRIVER Driver, _Inout_ PWDFDEVICE_INIT Devic
 
         deviceContext->Mode = FilterMode::Lower;
 
-        deviceContext->LowState.Initialize(Device);
-
         NTSTATUS status = deviceContext->Interface.Register(Device, deviceContext->LowState);
         if (!NT_SUCCESS(status)) {
             DebugPrint(DPFLTR_ERROR_LEVEL, DML_ERR("HidBattExt: WdfDeviceAddQueryInterface error %x"), status);
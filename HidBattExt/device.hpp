@@ -1,6 +1,10 @@
 #pragma once
 #include "driver.hpp"
 #include <hidpddi.h> // for PHIDP_PREPARSED_DATA
+#include <hidclass.h> // for HID_COLLECTION_INFORMATION
+#include <Poclass.h> // for BATTERY_QUERY_INFORMATION_LEVEL
+#include "ReportPlan.hpp"
+#include "SeqLock.hpp"
 
 
 enum class FilterMode {
@@ -18,9 +22,71 @@ struct HidCode {
     }
 };
 
+/** HID Power Device report UsagePage and Usage codes from https://www.usb.org/sites/default/files/pdcv11.pdf */
+static constexpr HidCode Temperature_Code = { 0x84, 0x36 }; // from 4.1 Power Device Page (x84) Table 2.
+static constexpr HidCode CycleCount_Code = { 0x85, 0x6B }; // from 4.2 Battery System Page (x85) Table 3.
+
+
+/** Battery parameters shared between Upper and Lower filter driver instances. */
+struct BatteryValues {
+    ULONG CycleCount = 0;  // BATTERY_INFORMATION::CycleCount value
+    ULONG Temperature = 0; // IOCTL_BATTERY_QUERY_INFORMATION BatteryTemperature value
+};
+
+/** BatteryValues written by the Lower filter, and read lock-free by the Upper filter. */
+class BatteryState {
+public:
+    /** Modify values. "update" is called with a copy of the current values, and returns true if it changed them. */
+    template <class F>
+    void Update(F update) {
+        // run at DISPATCH_LEVEL, so that readers & writers in completion routines cannot spin on the same CPU while the write is in progress
+        KIRQL oldIrql = 0;
+        KeRaiseIrql(DISPATCH_LEVEL, &oldIrql);
+        m_values.Update(update);
+        KeLowerIrql(oldIrql);
+    }
+
+    /** Copy the current values without blocking. Returns their version. */
+    ULONG Read(BatteryValues& values) const {
+        return m_values.Read(values);
+    }
+
+    /** Copy the current values only if they changed since "version". Returns true & updates "version" if copied. */
+    bool ReadIfChanged(BatteryValues& values, ULONG& version) const {
+        return m_values.ReadIfChanged(values, version);
+    }
+
+private:
+    SeqLock<BatteryValues> m_values;
+};
+
+/** HID value that is parsed by the Lower filter and patched into IOCTL_BATTERY_QUERY_INFORMATION responses by the Upper filter. */
+struct BatteryUsage {
+    HidCode Code;
+    ULONG   Scale;                   // multiplier from HID unit to IOCTL_BATTERY_QUERY_INFORMATION unit
+    ULONG BatteryValues::* Member;   // where to store the scaled value
+    BATTERY_QUERY_INFORMATION_LEVEL Level; // information level to patch
+    ULONG   Offset;                  // byte offset of ULONG value in the IOCTL output buffer
+    bool    Substitute;              // complete STATUS_INVALID_DEVICE_REQUEST failures with the HID value (level not supported by HidBatt)
+    const char* Name;                // for debug output
+};
+
+/** Values tracked by HidBattExt. Indexed by ReportField::Target. */
+static const BatteryUsage BatteryUsages[] = {
+    { CycleCount_Code,  1, &BatteryValues::CycleCount,  BatteryInformation, offsetof(BATTERY_INFORMATION, CycleCount), false, "CycleCount" },
+    { Temperature_Code, 10, &BatteryValues::Temperature, BatteryTemperature, 0, true, "Temperature" }, // from Kelvin to 10ths of a degree Kelvin
+};
+static constexpr unsigned int BatteryUsageCount = sizeof(BatteryUsages)/sizeof(BatteryUsages[0]);
+
 /** HID-related configuration for usage by the Lower filter driver instance.
     Members sorted in initialization order. */
 struct HidConfig {
+    WDFIOTARGET Target = 0;         // HID PDO, kept open for asynchronous requests
+    WDFREQUEST  ControlRequest = 0; // preallocated request for collection queries
+    WDFREQUEST  FeatureRequests[BatteryUsageCount] = {}; // preallocated requests for concurrent FEATURE report queries (at most one report per usage)
+
+    HID_COLLECTION_INFORMATION CollectionInfo = {};
+
     WDFMEMORY Preparsed = 0; // preparsed HID report descriptor (~3kB)
 
     PHIDP_PREPARSED_DATA GetPreparsedData() const {
@@ -31,33 +97,19 @@ struct HidConfig {
     USHORT InputReportByteLength = 0;
     USHORT FeatureReportByteLength = 0;
 
-    UCHAR TemperatureReportID = 0;
-    UCHAR CycleCountReportID = 0;
+    // precompiled locations of BatteryUsages values, so that reports can be parsed without walking the preparsed data
+    ReportPlan<BatteryUsageCount> InputPlan;
+    ReportPlan<BatteryUsageCount> FeaturePlan;
 
-    LONG Initialized = 0; // struct initialized (atomic value)
-};
-
-/** HID Power Device report UsagePage and Usage codes from https://www.usb.org/sites/default/files/pdcv11.pdf */
-static constexpr HidCode Temperature_Code = { 0x84, 0x36 }; // from 4.1 Power Device Page (x84) Table 2.
-static constexpr HidCode CycleCount_Code = { 0x85, 0x6B }; // from 4.2 Battery System Page (x85) Table 3.
+    WDFMEMORY FeatureReports = 0; // FEATURE report buffers, one per FeatureRequests entry
+    LONG PendingFeatures = 0;     // FEATURE report queries in flight (atomic value)
+    LONG FeatureFailures = 0;     // failed FEATURE report queries (atomic value)
 
+    LONG Initialized = 0; // struct initialized (atomic value)
 
-/** Battery parameters shared between Upper and Lower filter driver instances. */
-class BatteryState {
-public:
-    WDFSPINLOCK Lock = 0;  // to protext member access
-
-    ULONG CycleCount = 0;  // BATTERY_INFORMATION::CycleCount value
-    ULONG Temperature = 0; // IOCTL_BATTERY_QUERY_INFORMATION BatteryTemperature value
-
-    void Initialize(WDFDEVICE device) {
-        WDF_OBJECT_ATTRIBUTES attr{};
-        WDF_OBJECT_ATTRIBUTES_INIT(&attr);
-        attr.ParentObject = device; // auto-deleted when "device" is deleted
-
-        NTSTATUS status = WdfSpinLockCreate(&attr, &Lock);
-        NT_ASSERTMSG("WdfSpinLockCreate failed.\n", status == STATUS_SUCCESS); status;
-    }
+    BatteryValues Logged;     // values last written to the debug log
+    ULONG LoggedVersion = 0;  // BatteryState version of "Logged"
+    LONG  Logging = 0;        // debug log update in progress (atomic value)
 };
 
 DEFINE_GUID(GUID_HIDBATTEXT_SHARED_STATE, 0x2f52277a, 0x88f8, 0x44f3, 0x87, 0xec, 0x48, 0xb2, 0xe9, 0x51, 0x84, 0x58);
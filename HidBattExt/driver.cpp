@@ -1,10 +1,13 @@
 #include "driver.hpp"
+#include "HidPd.hpp"
 
 /** Driver entry point.
     Initialize the framework and register driver event handlers. */
 NTSTATUS DriverEntry(_In_ PDRIVER_OBJECT  DriverObject, _In_ PUNICODE_STRING RegistryPath ) {
     DebugPrint(DPFLTR_INFO_LEVEL, "HidBattExt: DriverEntry\n");
 
+    InitializeHidConfigCache();
+
     WDF_DRIVER_CONFIG params = {};
     WDF_DRIVER_CONFIG_INIT(/*out*/&params, EvtDriverDeviceAdd);
     params.DriverPoolTag = POOL_TAG;
@@ -1,171 +1,255 @@
 #include <HIDPowerDevice.h>
+#include <BatteryScenario.h>
+#include <BatteryControl.h>
+#include <BatteryBank.h>
 //#define ENABLE_POTENTIOMETER // uncomment to enable potentiometer
+//#define ENABLE_SCENARIO // uncomment to replay a scripted scenario
+//#define SHARED_INTERFACE // uncomment to expose all batteries through a single USB interface & endpoint
 
-// String constants
-byte stringIdxConter = ISERIAL+1; // one past the last hadcoded string index in arduino/USBDesc.h
-const char STRING_DEVICECHEMISTRY[][5] PROGMEM = {"LiP", "NiCd", "NiMH"};
-byte DeviceChemistryIdx[MAX_BATTERIES] = {};
-
-const char STRING_OEMVENDOR[][16] PROGMEM = {"BatteryVendor A", "BatteryVendor B"}; // all strings must have same length
-byte       ManufacturerIdx[MAX_BATTERIES] = {};
+#ifdef SHARED_INTERFACE
+#define NUM_BATTERIES 8 // not limited by the number of free USB endpoints
+#else
+#define NUM_BATTERIES MAX_BATTERIES
+#endif
 
-const char STRING_SERIAL[][6] PROGMEM = {"12345", "34567", "56789"}; // all strings must have same length
-byte       SerialIdx[MAX_BATTERIES] = {};
+// String constants
+const char STRING_DEVICECHEMISTRY[] PROGMEM = "LiP\0NiCd\0NiMH"; // packed strings with variable length
+const char STRING_OEMVENDOR[] PROGMEM = "BatteryVendor A\0BatteryVendor B";
+const char STRING_SERIAL[] PROGMEM = "12345\0" "34567\0" "56789";
+
+// String indices, starting one past the last hadcoded string index in arduino/USBDesc.h. 3 per battery.
+const byte STRING_INDEX[] PROGMEM = {
+  ISERIAL+1,  ISERIAL+2,  ISERIAL+3,  ISERIAL+4,  ISERIAL+5,  ISERIAL+6,  ISERIAL+7,  ISERIAL+8,
+  ISERIAL+9,  ISERIAL+10, ISERIAL+11, ISERIAL+12, ISERIAL+13, ISERIAL+14, ISERIAL+15, ISERIAL+16,
+  ISERIAL+17, ISERIAL+18, ISERIAL+19, ISERIAL+20, ISERIAL+21, ISERIAL+22, ISERIAL+23, ISERIAL+24,
+};
+static_assert(sizeof(STRING_INDEX) >= 3*NUM_BATTERIES, "too few string indices");
+
+// Constant parameters, served directly from flash
+const byte     CapacityMode PROGMEM = 0;  // unit: 0=mAh, 1=mWh, 2=%
+const uint16_t DesignCapacity PROGMEM = AmpSecFromMilliWattHours(58003, 1499); // 58003 mWh at 14.99 V
+const uint16_t ManufacturerDate PROGMEM = (2024 - 1980)*512 + 10*32 + 12; // 2024-10-12, from 4.2.6 Battery Settings in "Universal Serial Bus Usage Tables for HID Power Devices"
+
+BatteryBank<NUM_BATTERIES> Bank; // per-battery state
+
+const size_t RAM_BUDGET = 2048; // RAM [bytes] available for HID stack & battery state (leaves 512 bytes of the ATmega32u4 RAM for the core & stack)
+#ifdef __AVR__ // sizes are only representative on the target
+static_assert(HIDPowerDevice_::RamUsage(NUM_BATTERIES) + sizeof(Bank) <= RAM_BUDGET, "too many batteries for RAM budget");
+#endif
 
-PresentStatus PresentStatus = {};
+#ifdef SHARED_INTERFACE
+HIDPowerDeviceGroup<NUM_BATTERIES> PowerDevice; // first battery owns the USB interface, whereas the others are added as collections to it
+#else
+HIDPowerDevice_ PowerDevice[NUM_BATTERIES];
+#endif
 
-byte CapacityMode = 0;  // unit: 0=mAh, 1=mWh, 2=%
+#ifdef CDC_ENABLED
+BatteryControl Control(PowerDevice, NUM_BATTERIES); // live value injection over the serial port
+#endif
 
-// Physical parameters
-uint16_t Voltage =1499; // centiVolt
-uint16_t RunTimeToEmpty = 0; // maps to BatteryEstimatedTime on Windows
-uint16_t ManufacturerDate = 0; // initialized in setup function
-int16_t  CycleCount = 41;
-uint16_t Temperature = 300; // degrees Kelvin
+#ifdef ENABLE_POTENTIOMETER
+#define BATTERY_ADC_ISR // claim the ADC interrupt for background sampling
+#include <BatteryAdc.h>
 
-// Parameters for ACPI compliancy
-const uint16_t DesignCapacity = 58003*360/Voltage; // AmpSec=mWh*360/centiVolt (1 mAh = 3.6 As)
-uint16_t RemnCapacityLimit = DesignCapacity/20; // critical at 5% (maps to DefaultAlert1 on Windows)
-uint16_t WarnCapacityLimit = DesignCapacity/10; // low  at 10% (maps to DefaultAlert2 on Windows)
-uint16_t FullChargeCapacity = 40690*360/Voltage; // AmpSec=mWh*360/centiVolt (1 mAh = 3.6 As)
+// one potentiometer per battery, starting with the first battery. Batteries without potentiometer follow the previous battery.
+const uint8_t POTENTIOMETER_PINS[] = {PIN_A7};
+uint16_t PrevPotRemaining[sizeof(POTENTIOMETER_PINS)] = {};
+BatteryAdc Adc;
+#endif
 
-uint16_t Remaining[MAX_BATTERIES] = {}; // remaining charge
-uint16_t PrevRemaining=0;
+#ifdef ENABLE_SCENARIO
+// discharge & recharge cycle with temperature excursion, replayed 20x faster than real-time (text form in scenario.txt)
+const uint8_t SCENARIO[] PROGMEM = {
+  SCN_SPEED(20),
+  SCN_OFFSET(1, -10), SCN_OFFSET(2, -20), // batteries 2 & 3 have lower charge
+  SCN_AC(0), SCN_CHARGE(30, 3600), SCN_TEMP(315, 1800), SCN_WAIT(1800), // unplug & discharge while heating up
+  SCN_TEMP(300, 1800), SCN_WAIT(1800), // cool down
+  SCN_AC(1), SCN_CHARGE(100, 1800), SCN_WAIT(1800), // replug & charge
+  SCN_LOOP
+};
+BatteryScenario Scenario;
+#endif
 
-HIDPowerDevice_ PowerDevice[MAX_BATTERIES];
+const uint16_t KEEP_ALIVE_INTERVAL = 30000; // resend unchanged INPUT reports every 30 sec
+const uint16_t UPDATE_INTERVAL = 2000; // battery simulation time step [ms]
+const Ratio CHARGE_STEP = Ratio::FromPercent(2); // charge change per simulation step
+const Ratio MIN_CHARGE = Ratio::FromPercent(25); // lower limit of simulated discharge
+unsigned long LastUpdate = 0; // millis() timestamp of last simulation step
 
 
 void setup() {
 #ifdef CDC_ENABLED
   Serial.begin(57600);
+
+  // report RAM usage to help sizing the number of batteries
+  Serial.print("HID RAM per battery: ");
+  Serial.println(HIDPowerDevice_::RamUsage(1) - HID_::SharedRam() + sizeof(Bank)/NUM_BATTERIES);
+  Serial.print("HID RAM total: ");
+  Serial.println(HIDPowerDevice_::RamUsage(NUM_BATTERIES) + sizeof(Bank));
 #endif
 
-  // initialize batteries with 30% charge
-  for (int i = 0; i < MAX_BATTERIES; i++)
-    Remaining[i] = 0.30f*FullChargeCapacity;
+  // Physical parameters
+  for (int i = 0; i < NUM_BATTERIES; i++) {
+    Bank.Voltage[i] = 1499; // centiVolt
+    Bank.CycleCount[i] = 41;
+    Bank.Temperature[i] = 300; // degrees Kelvin
+  }
 
-  pinMode(LED_BUILTIN, OUTPUT);  // output flushing 1 sec indicating that the arduino cycle is running.
+  // Parameters for ACPI compliancy
+  uint16_t designCapacity = pgm_read_word(&DesignCapacity);
+  for (int i = 0; i < NUM_BATTERIES; i++) {
+    Bank.RemnCapacityLimit[i] = designCapacity/20; // critical at 5% (maps to DefaultAlert1 on Windows)
+    Bank.WarnCapacityLimit[i] = designCapacity/10; // low  at 10% (maps to DefaultAlert2 on Windows)
+    Bank.FullChargeCapacity[i] = AmpSecFromMilliWattHours(40690, Bank.Voltage[i]); // 40690 mWh
 
-  for (int i = 0; i < MAX_BATTERIES; i++) {
-    ManufacturerIdx[i] = stringIdxConter++;
-    PowerDevice[i].SetStringFeature(HID_PD_MANUFACTURER, &ManufacturerIdx[i], STRING_OEMVENDOR[i % 2]);
+    // initialize batteries with 30% charge
+    Bank.Remaining[i] = Ratio::FromPercent(30).Scale(Bank.FullChargeCapacity[i]);
+  }
 
-    SerialIdx[i] = stringIdxConter++;
-    PowerDevice[i].SetStringFeature(HID_PD_SERIAL, &SerialIdx[i], STRING_SERIAL[i % 3]);
+#ifdef ENABLE_POTENTIOMETER
+  Adc.Begin(POTENTIOMETER_PINS, sizeof(POTENTIOMETER_PINS));
+#endif
+#ifdef ENABLE_SCENARIO
+  Scenario.Start(SCENARIO, 30, Bank.Temperature[0]);
+#endif
 
-    PowerDevice[i].SetFeature(HID_PD_PRESENTSTATUS, &PresentStatus, sizeof(PresentStatus));
+  pinMode(LED_BUILTIN, OUTPUT);  // output flushing 1 sec indicating that the arduino cycle is running.
 
-    PowerDevice[i].SetFeature(HID_PD_RUNTIMETOEMPTY, &RunTimeToEmpty, sizeof(RunTimeToEmpty));
+  for (int i = 0; i < NUM_BATTERIES; i++) {
+    PowerDevice[i].SetStringFeature_P(HID_PD_MANUFACTURER, &STRING_INDEX[3*i], HIDStringPool(STRING_OEMVENDOR)[i % 2]);
+    PowerDevice[i].SetStringFeature_P(HID_PD_SERIAL, &STRING_INDEX[3*i + 1], HIDStringPool(STRING_SERIAL)[i % 3]);
+    PowerDevice[i].SetStringFeature_P(HID_PD_IDEVICECHEMISTRY, &STRING_INDEX[3*i + 2], HIDStringPool(STRING_DEVICECHEMISTRY)[i % 3]);
 
-    PowerDevice[i].SetFeature(HID_PD_CAPACITYMODE, &CapacityMode, sizeof(CapacityMode));
-    PowerDevice[i].SetFeature(HID_PD_TEMPERATURE, &Temperature, sizeof(Temperature));
-    PowerDevice[i].SetFeature(HID_PD_VOLTAGE, &Voltage, sizeof(Voltage));
+    PowerDevice[i].SetFeature_P<HID_PD_CAPACITYMODE>(CapacityMode);
+    PowerDevice[i].SetFeature_P<HID_PD_DESIGNCAPACITY>(DesignCapacity);
+    PowerDevice[i].SetFeature_P<HID_PD_MANUFACTUREDATE>(ManufacturerDate);
 
-    DeviceChemistryIdx[i] = stringIdxConter++;
-    PowerDevice[i].SetStringFeature(HID_PD_IDEVICECHEMISTRY, &DeviceChemistryIdx[i], STRING_DEVICECHEMISTRY[i % 3]);
+    PowerDevice[i].SetKeepAlive(KEEP_ALIVE_INTERVAL);
+  }
 
-    PowerDevice[i].SetFeature(HID_PD_DESIGNCAPACITY, &DesignCapacity, sizeof(DesignCapacity));
-    PowerDevice[i].SetFeature(HID_PD_FULLCHRGECAPACITY, &FullChargeCapacity, sizeof(FullChargeCapacity));
-    PowerDevice[i].SetFeature(HID_PD_REMAININGCAPACITY, &Remaining[i], sizeof(Remaining[i]));
-    PowerDevice[i].SetFeature(HID_PD_REMNCAPACITYLIMIT, &RemnCapacityLimit, sizeof(RemnCapacityLimit));
-    PowerDevice[i].SetFeature(HID_PD_WARNCAPACITYLIMIT, &WarnCapacityLimit, sizeof(WarnCapacityLimit));
+  Bank.Register(PowerDevice);
+  Bank.Update();
 
-    uint16_t year = 2024, month = 10, day = 12;
-    ManufacturerDate = (year - 1980)*512 + month*32 + day; // from 4.2.6 Battery Settings in "Universal Serial Bus Usage Tables for HID Power Devices"
-    PowerDevice[i].SetFeature(HID_PD_MANUFACTUREDATE, &ManufacturerDate, sizeof(ManufacturerDate));
+#ifdef CDC_ENABLED
+  // stop simulating & deriving values that are set over the serial port
+  Control.OnSet([](uint8_t battery, uint8_t field) { Bank.Inject(battery, field); });
+#endif
+}
 
-    PowerDevice[i].SetFeature(HID_PD_CYCLE_COUNT, &CycleCount, sizeof(CycleCount));
+/** Advance the battery simulation by one time step. */
+void UpdateBatteries() {
+  // propagate charge state from first to last battery, except for values set over the serial port
+  for (int i = NUM_BATTERIES-1; i > 0; i--) {
+    if (!Bank.IsInjected(i, HID_PD_REMAININGCAPACITY))
+      Bank.Remaining[i] = Bank.Remaining[i-1];
+    if (!Bank.IsInjected(i, HID_PD_PRESENTSTATUS))
+      Bank.Status[i].Charging = Bank.Status[i-1].Charging;
+    if (!Bank.IsInjected(i, HID_PD_CYCLE_COUNT))
+      Bank.CycleCount[i] = Bank.CycleCount[i-1];
   }
-}
 
-void loop() {
-  // propagate charge level from first to last battery
-  for (int i = MAX_BATTERIES-1; i > 0; i--)
-    Remaining[i] = Remaining[i-1];
+  uint16_t& Remaining = Bank.Remaining[0];
+  PresentStatus& Status = Bank.Status[0];
 
 #ifdef ENABLE_POTENTIOMETER
-  // read charge level from potentiometer
-  int BattSoc = analogRead(PIN_A7); // potentiometer value in [0,1024)
-  Remaining[0] = (uint16_t)(round((float)FullChargeCapacity*BattSoc/1024));
-
-  if (Remaining[0] > PrevRemaining + 1) // add a bit hysteresis
-    PresentStatus.Charging = true;
-  else if (Remaining[0] < PrevRemaining - 1) // add a bit hysteresis
-    PresentStatus.Charging = false;
+  // read charge levels from the filtered potentiometer values
+  for (uint8_t i = 0; (i < sizeof(POTENTIOMETER_PINS)) && (i < NUM_BATTERIES); i++) {
+    if (Bank.IsInjected(i, HID_PD_REMAININGCAPACITY))
+      continue;
+    uint16_t value = Adc.Value(i); // in [0, 2^ADC_RESOLUTION_BITS)
+    Bank.Remaining[i] = ((uint32_t)Bank.FullChargeCapacity[i]*value) >> ADC_RESOLUTION_BITS;
+
+    if (Bank.Remaining[i] > PrevPotRemaining[i] + 1) // add a bit hysteresis
+      Bank.Status[i].Charging = true;
+    else if (Bank.Remaining[i] + 1 < PrevPotRemaining[i]) // add a bit hysteresis
+      Bank.Status[i].Charging = false;
+    PrevPotRemaining[i] = Bank.Remaining[i];
+  }
+#elif defined(ENABLE_SCENARIO)
+  // replay scripted scenario
+  Scenario.Update();
+  for (int i = 0; i < NUM_BATTERIES; i++) {
+    if (!Bank.IsInjected(i, HID_PD_REMAININGCAPACITY))
+      Bank.Remaining[i] = Ratio::FromPercent(Scenario.Charge(i)).Scale(Bank.FullChargeCapacity[i]);
+    if (!Bank.IsInjected(i, HID_PD_PRESENTSTATUS))
+      Bank.Status[i].Charging = Scenario.ACPresent();
+    if (!Bank.IsInjected(i, HID_PD_TEMPERATURE))
+      Bank.Temperature[i] = Scenario.Temperature();
+  }
 #else
   // simulate charge & discharge cycles
-  if (PresentStatus.Charging) {
-    Remaining[0] += 0.02f*FullChargeCapacity; // incr. 2%
-
-    if (Remaining[0] > FullChargeCapacity) {
-      Remaining[0] = FullChargeCapacity; // clamp at 100%
-      PresentStatus.Charging = false;
+  uint16_t FullChargeCapacity = Bank.FullChargeCapacity[0];
+  if (Bank.IsInjected(0, HID_PD_REMAININGCAPACITY)) {
+    // charge is set over the serial port
+  } else if (Status.Charging) {
+    Remaining += CHARGE_STEP.Scale(FullChargeCapacity);
+
+    if (Remaining > FullChargeCapacity) {
+      Remaining = FullChargeCapacity; // clamp at 100%
+      Status.Charging = false;
     }
   } else {
-    Remaining[0] -= 0.02f*FullChargeCapacity; // decr. 2%
+    Remaining -= CHARGE_STEP.Scale(FullChargeCapacity);
 
-    if (Remaining[0] < 0.25f*FullChargeCapacity) {
-      Remaining[0] = 0.25f*FullChargeCapacity; // clamp at 25% to prevent battery saver warning or triggering shutdown
-      PresentStatus.Charging = true;
-      CycleCount += 1;
+    if (Remaining < MIN_CHARGE.Scale(FullChargeCapacity)) {
+      Remaining = MIN_CHARGE.Scale(FullChargeCapacity); // clamp to prevent battery saver warning or triggering shutdown
+      Status.Charging = true;
+      if (!Bank.IsInjected(0, HID_PD_CYCLE_COUNT))
+        Bank.CycleCount[0] += 1;
     }
   }
 #endif
 
-  uint16_t AvgTimeToEmpty = 7200;
-  RunTimeToEmpty = (uint16_t)round((float)AvgTimeToEmpty*Remaining[0]/FullChargeCapacity);
+  // derive RunTimeToEmpty & PresentStatus flags for all batteries
+  Bank.Update();
 
-  // Charging
-  PresentStatus.ACPresent = PresentStatus.Charging; // assume charging implies AC present
-  // Discharging
-  if(!PresentStatus.Charging) { // assume not charging implies discharging
-    PresentStatus.Discharging = 1;
-  } else {
-    PresentStatus.Discharging = 0;
-  }
-
-  // Shutdown imminent
-  if(RunTimeToEmpty < 60) {
-    PresentStatus.ShutdownImminent = 1;
 #ifdef CDC_ENABLED
+  if (Status.ShutdownImminent)
     Serial.println("shutdown imminent");
-#endif
-  } else {
-    PresentStatus.ShutdownImminent = 0;
-  }
-
-  //************ Delay ****************************************
-  delay(1000);
-  digitalWrite(LED_BUILTIN, HIGH);   // turn the LED on (HIGH is the voltage level);
-  delay(1000);
-  digitalWrite(LED_BUILTIN, LOW);   // turn the LED off;
 
-  //************ Bulk send or interrupt ***********************
-  int res = 0;
-  for (int i = 0; i < MAX_BATTERIES; i++) {
-    if (res >= 0)
-      res = PowerDevice[i].SendReport(HID_PD_REMAININGCAPACITY, &Remaining[i], sizeof(Remaining[i]));
-
-    if((res >= 0) && !PresentStatus.Charging)
-      res = PowerDevice[i].SendReport(HID_PD_RUNTIMETOEMPTY, &RunTimeToEmpty, sizeof(RunTimeToEmpty));
-
-    if (res >= 0)
-      PowerDevice[i].SendReport(HID_PD_TEMPERATURE, &Temperature, sizeof(Temperature));
+  Serial.print("Remaining charge: ");
+  Serial.println(Remaining);
+#endif
+}
 
-    if (res >= 0)
-      res = PowerDevice[i].SendReport(HID_PD_PRESENTSTATUS, &PresentStatus, sizeof(PresentStatus));
+void loop() {
+#ifdef ENABLE_POTENTIOMETER
+  // filter potentiometer samples collected in the background
+  Adc.Update();
+#endif
+#ifdef CDC_ENABLED
+  // apply value updates from the serial port at loop boundary
+  Control.Poll(Serial);
+#endif
 
-    if (res >= 0)
-      res = PowerDevice[i].SendReport(HID_PD_CYCLE_COUNT, &CycleCount, sizeof(CycleCount));
+  unsigned long now = millis();
+  if (now - LastUpdate >= UPDATE_INTERVAL) {
+    LastUpdate = now;
+    UpdateBatteries();
   }
 
-  PrevRemaining = Remaining[0];
+  // flash LED with 2 sec period indicating that the arduino cycle is running
+  digitalWrite(LED_BUILTIN, (now % 2000 < 1000) ? LOW : HIGH);
 
+  //************ Interrupt send ***********************
+  for (int i = 0; i < NUM_BATTERIES; i++) {
+    // react to values written by the host. Changed INPUT values, like CycleCount, are re-reported by SendInputReports.
+    while (uint8_t id = PowerDevice[i].PopSetReport()) {
 #ifdef CDC_ENABLED
-  Serial.print("Remaining charge: ");
-  Serial.println(Remaining[0]);
+      Serial.print("Host changed report ");
+      Serial.print(id);
+      Serial.print(" of battery ");
+      Serial.println(i);
+#endif
+    }
 
-  Serial.print("SendReport res=");
-  Serial.println(res);
+    PowerDevice[i].Publish(); // make this iteration's updates visible to the host at once
+    int res = PowerDevice[i].SendInputReports(); // only send due values
+#ifdef CDC_ENABLED
+    if (res < 0) {
+      Serial.print("SendReport res=");
+      Serial.println(res);
+    }
 #endif
+  }
 }
@@ -0,0 +1,90 @@
+#include "BatteryAdc.h"
+
+static_assert((ADC_RING_SIZE & (ADC_RING_SIZE - 1)) == 0, "ADC_RING_SIZE must be a power of two");
+static_assert(ADC_RESOLUTION_BITS <= 12, "decimated samples must fit in 12 bits next to the channel index");
+static_assert(ADC_MAX_CHANNELS <= 16, "channel index must fit in 4 bits");
+
+static BatteryAdc* s_active = nullptr; // instance served by the ADC ISR
+
+void BatteryAdc::Begin(const uint8_t* pins, uint8_t count) {
+    if (count > ADC_MAX_CHANNELS)
+        count = ADC_MAX_CHANNELS;
+
+    for (uint8_t i = 0; i < count; i++) {
+        uint8_t pin = pins[i];
+        if (pin >= 18)
+            pin -= 18; // allow for channel or pin numbers, like analogRead
+        m_channels[i] = analogPinToChannel(pin);
+    }
+    m_count = count;
+    if (!count)
+        return;
+
+    s_active = this;
+    m_current = 0;
+    m_samples = 0;
+    m_sum = 0;
+    SelectChannel(0);
+
+    // enable ADC & interrupt with prescaler 128 (125 kHz ADC clock at 16 MHz), and start first conversion
+    ADCSRA = (1 << ADEN) | (1 << ADIE) | (1 << ADPS2) | (1 << ADPS1) | (1 << ADPS0) | (1 << ADSC);
+}
+
+void BatteryAdc::SelectChannel(uint8_t index) {
+    uint8_t channel = m_channels[index];
+    ADCSRB = (ADCSRB & ~(1 << MUX5)) | (((channel >> 3) & 0x01) << MUX5);
+    ADMUX = (1 << REFS0) | (channel & 0x07); // AVcc reference
+}
+
+void BatteryAdc::OnConversion(uint16_t sample) {
+    m_sum += sample;
+    if (++m_samples >= (1 << (2*ADC_OVERSAMPLING_BITS))) {
+        // decimate by discarding the bits that oversampling does not resolve
+        uint16_t value = m_sum >> ADC_OVERSAMPLING_BITS;
+
+        uint8_t head = m_head;
+        if ((uint8_t)(head - m_tail) < ADC_RING_SIZE) {
+            m_ring[head % ADC_RING_SIZE] = ((uint16_t)m_current << 12) | value;
+            m_head = head + 1; // publish slot after writing it
+        } else {
+            m_overruns++;
+        }
+
+        // continue with next channel
+        m_sum = 0;
+        m_samples = 0;
+        m_current = (m_current + 1 < m_count) ? m_current + 1 : 0;
+        SelectChannel(m_current);
+    }
+
+    ADCSRA |= (1 << ADSC); // start next conversion
+}
+
+void BatteryAdc::Update() {
+    while (m_tail != m_head) {
+        uint8_t tail = m_tail;
+        uint16_t entry = m_ring[tail % ADC_RING_SIZE];
+        m_tail = tail + 1; // release slot after reading it
+
+        uint8_t index = entry >> 12;
+        uint16_t value = (entry & 0x0FFF) << 4;
+        if (!m_primed[index]) {
+            m_filtered[index] = value;
+            m_primed[index] = true;
+        } else {
+            // first-order IIR low-pass filter in fixed point
+            m_filtered[index] += ((int32_t)value - m_filtered[index]) >> ADC_FILTER_SHIFT;
+        }
+    }
+}
+
+uint16_t BatteryAdc::Value(uint8_t index) const {
+    if (index >= m_count)
+        return 0;
+    return (m_filtered[index] + 8) >> 4;
+}
+
+void BatteryAdc::OnInterrupt() {
+    if (s_active)
+        s_active->OnConversion(ADC);
+}
@@ -0,0 +1,79 @@
+#pragma once
+#include <Arduino.h>
+
+// max number of analog channels that are sampled in the background
+#ifndef ADC_MAX_CHANNELS
+#define ADC_MAX_CHANNELS       6
+#endif
+
+// oversampling by 4^N samples per decimated sample adds N bits of resolution to the 10-bit ADC
+#ifndef ADC_OVERSAMPLING_BITS
+#define ADC_OVERSAMPLING_BITS  2
+#endif
+
+// number of decimated samples buffered between the ISR and Update(). Must be a power of two.
+#ifndef ADC_RING_SIZE
+#define ADC_RING_SIZE          8
+#endif
+
+// low-pass filter time constant in decimated samples, as power of two
+#ifndef ADC_FILTER_SHIFT
+#define ADC_FILTER_SHIFT       3
+#endif
+
+#define ADC_RESOLUTION_BITS    (10 + ADC_OVERSAMPLING_BITS)
+
+/** Free-running ADC sampling of multiple analog pins from the ADC interrupt.
+    The ISR oversamples and decimates each channel into a ring buffer, which is drained by Update() into fixed-point low-pass filters.
+    Only one instance can be active, and analogRead must not be used while sampling.
+    The ISR is opt-in, see BATTERY_ADC_ISR. While sampling, it fires after every conversion, which is about 9.6 kHz at 16 MHz
+    (125 kHz ADC clock / 13 cycles per conversion), so it takes a few percent of the CPU and delays other interrupts by up to its own duration. */
+class BatteryAdc {
+public:
+    /** Start sampling "count" analog pins, like PIN_A7, round-robin in the background. The "pins" array is copied. */
+    void Begin(const uint8_t* pins, uint8_t count);
+
+    /** Filter the samples collected by the ISR since the last call. Call on every loop() iteration. */
+    void Update();
+
+    /** Filtered value of channel "index" in [0, 2^ADC_RESOLUTION_BITS). */
+    uint16_t Value(uint8_t index) const;
+
+    /** Number of decimated samples dropped because Update() was not called often enough. */
+    uint16_t Overruns() const {
+        return m_overruns;
+    }
+
+    /** Called from the ADC ISR with the result of the last conversion. */
+    void OnConversion(uint16_t sample);
+
+    /** Body of the ADC ISR, which passes the conversion result to the active instance. */
+    static void OnInterrupt();
+
+private:
+    void SelectChannel(uint8_t index);
+
+    uint8_t  m_channels[ADC_MAX_CHANNELS] = {}; // ADC mux channels
+    uint8_t  m_count = 0;
+    uint8_t  m_current = 0;                    // index of channel being converted
+    uint8_t  m_samples = 0;                    // samples accumulated for current channel
+    uint16_t m_sum = 0;                        // oversampling accumulator
+
+    // single-producer (ISR) single-consumer (Update) ring of decimated samples, with the channel index in the upper 4 bits
+    volatile uint16_t m_ring[ADC_RING_SIZE];
+    volatile uint8_t  m_head = 0; // written by ISR only
+    volatile uint8_t  m_tail = 0; // written by Update only
+    volatile uint16_t m_overruns = 0;
+
+    uint16_t m_filtered[ADC_MAX_CHANNELS] = {}; // filter state with 4 fractional bits
+    bool     m_primed[ADC_MAX_CHANNELS] = {};
+};
+
+/* The ADC interrupt vector is only claimed if BATTERY_ADC_ISR is defined before including this header,
+   so that sketches that link the library but do not sample pins keep the vector for their own use.
+   Define it in exactly one translation unit, since Begin() enables the ADC interrupt. */
+#ifdef BATTERY_ADC_ISR
+ISR(ADC_vect) {
+    BatteryAdc::OnInterrupt();
+}
+#endif
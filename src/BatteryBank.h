@@ -0,0 +1,95 @@
+#pragma once
+#include "HIDPowerDevice.h"
+#include "BatteryMath.h"
+
+/** Per-battery state for "N" batteries in struct-of-arrays layout.
+    Each field is stored contiguously across batteries, so that Update() can process all batteries in one tight pass. */
+template <uint8_t N = MAX_BATTERIES>
+class BatteryBank {
+public:
+    // dynamic state
+    PresentStatus Status[N] = {};
+    uint16_t Remaining[N] = {};          // remaining charge
+    uint16_t RunTimeToEmpty[N] = {};     // [s] (maps to BatteryEstimatedTime on Windows)
+    uint16_t Temperature[N] = {};        // [K]
+    uint16_t Voltage[N] = {};            // [cV]
+    int16_t  CycleCount[N] = {};
+
+    // capacity & ACPI limits
+    uint16_t FullChargeCapacity[N] = {};
+    uint16_t RemnCapacityLimit[N] = {};  // maps to DefaultAlert1 on Windows
+    uint16_t WarnCapacityLimit[N] = {};  // maps to DefaultAlert2 on Windows
+
+    // parameters shared by all batteries
+    uint16_t AvgTimeToEmpty = 7200;      // run time at full charge [s]
+
+    // fields set externally, like through BatteryControl, as FieldBit mask. These are neither derived by Update() nor simulated.
+    uint16_t Injected[N] = {};
+
+    static constexpr uint8_t Count() {
+        return N;
+    }
+
+    /** Bit of the field with report ID "id" in Injected, or 0 if the report is not stored in the bank. */
+    static constexpr uint16_t FieldBit(uint8_t id) {
+        return ((id >= HID_PD_PRESENTSTATUS) && (id - HID_PD_PRESENTSTATUS < 16)) ? (1U << (id - HID_PD_PRESENTSTATUS)) : 0;
+    }
+
+    /** Mark field "id" of battery "index" as set externally. Injected fields keep their value until reset. */
+    void Inject(uint8_t index, uint8_t id) {
+        if (index < N)
+            Injected[index] |= FieldBit(id);
+    }
+
+    bool IsInjected(uint8_t index, uint8_t id) const {
+        return Injected[index] & FieldBit(id);
+    }
+
+    /** Snapshot bytes that Register() claims on each device. */
+    static constexpr uint8_t SnapshotBytes() {
+        return sizeof(Status[0]) + sizeof(Remaining[0]) + sizeof(RunTimeToEmpty[0]) + sizeof(Temperature[0]) + sizeof(Voltage[0])
+            + sizeof(CycleCount[0]) + sizeof(FullChargeCapacity[0]) + sizeof(RemnCapacityLimit[0]) + sizeof(WarnCapacityLimit[0]);
+    }
+
+    /** Register the storage of each battery with the matching entry in "devices", which must have "N" elements.
+        Constant features, like DesignCapacity, are not part of the bank and registered separately with SetFeature_P. */
+    void Register(HIDPowerDevice_* devices) {
+        static_assert(SnapshotBytes() <= HID_SNAPSHOT_SIZE, "HID_SNAPSHOT_SIZE too small for the battery bank");
+
+        for (uint8_t i = 0; i < N; i++) {
+            HIDPowerDevice_& dev = devices[i];
+            dev.SetFeature<HID_PD_PRESENTSTATUS>(Status[i]);
+            dev.SetFeature<HID_PD_REMAININGCAPACITY>(Remaining[i]);
+            dev.SetFeature<HID_PD_RUNTIMETOEMPTY>(RunTimeToEmpty[i]);
+            dev.SetFeature<HID_PD_TEMPERATURE>(Temperature[i]);
+            dev.SetFeature<HID_PD_VOLTAGE>(Voltage[i]);
+            dev.SetFeature<HID_PD_CYCLE_COUNT>(CycleCount[i]);
+            dev.SetFeature<HID_PD_FULLCHRGECAPACITY>(FullChargeCapacity[i]);
+            dev.SetFeature<HID_PD_REMNCAPACITYLIMIT>(RemnCapacityLimit[i]);
+            dev.SetFeature<HID_PD_WARNCAPACITYLIMIT>(WarnCapacityLimit[i]);
+
+            // INPUT reports that are sent when changed
+            dev.SetInput(HID_PD_REMAININGCAPACITY, 1000); // at most once per sec
+            dev.SetInput(HID_PD_RUNTIMETOEMPTY, 1000);
+            dev.SetInput(HID_PD_TEMPERATURE, 5000);
+            dev.SetInput(HID_PD_PRESENTSTATUS); // immediately
+            dev.SetInput(HID_PD_CYCLE_COUNT, 10000);
+        }
+    }
+
+    /** Derive RunTimeToEmpty and the PresentStatus flags from the charge state of all batteries, except for injected fields. */
+    void Update() {
+        static_assert(HID_PD_CYCLE_COUNT - HID_PD_PRESENTSTATUS < 16, "bank report IDs do not fit in Injected mask");
+        for (uint8_t i = 0; i < N; i++) {
+            if (!IsInjected(i, HID_PD_RUNTIMETOEMPTY))
+                RunTimeToEmpty[i] = RunTime(Remaining[i], FullChargeCapacity[i], AvgTimeToEmpty);
+            if (IsInjected(i, HID_PD_PRESENTSTATUS))
+                continue;
+
+            PresentStatus& status = Status[i];
+            status.ACPresent = status.Charging;    // assume charging implies AC present
+            status.Discharging = !status.Charging; // assume not charging implies discharging
+            status.ShutdownImminent = (RunTimeToEmpty[i] < 60);
+        }
+    }
+};
@@ -0,0 +1,129 @@
+#include "BatteryControl.h"
+
+
+uint8_t ControlCrc8(uint8_t crc, const uint8_t* data, uint8_t len) {
+    for (uint8_t i = 0; i < len; i++) {
+        crc ^= data[i];
+        for (uint8_t b = 0; b < 8; b++)
+            crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : (crc << 1);
+    }
+    return crc;
+}
+
+void BatteryControl::Poll(Stream& stream) {
+    while (stream.available() > 0) {
+        uint8_t c = stream.read();
+
+        switch (m_state) {
+        case WaitSync:
+            if (c == CTRL_SYNC)
+                m_state = WaitLength;
+            break;
+        case WaitLength:
+            if (!c || (c > CTRL_MAX_PAYLOAD)) {
+                m_state = WaitSync; // invalid length, so resynchronize
+                break;
+            }
+            m_len = c;
+            m_pos = 0;
+            m_state = WaitPayload;
+            break;
+        case WaitPayload:
+            m_payload[m_pos++] = c;
+            if (m_pos == m_len)
+                m_state = WaitCrc;
+            break;
+        case WaitCrc:
+            if (c == ControlCrc8(ControlCrc8(0, &m_len, 1), m_payload, m_len))
+                Execute(stream);
+            m_state = WaitSync; // silently drop corrupt frames
+            break;
+        }
+    }
+}
+
+void BatteryControl::Execute(Stream& stream) {
+    uint8_t cmd = m_payload[0];
+
+    if (cmd == CTRL_CMD_SET) {
+        // validate all updates before applying any of them
+        uint8_t status = Set(false);
+        if (status == CTRL_OK)
+            Set(true);
+
+        uint8_t response[] = {CTRL_CMD_SET | CTRL_RESPONSE, status};
+        Respond(stream, response, sizeof(response));
+    } else if ((cmd == CTRL_CMD_GET) && (m_len == 3)) {
+        uint8_t battery = m_payload[1];
+        uint8_t field = m_payload[2];
+
+        uint8_t response[5 + HID_MAX_REPORT_LENGTH] = {CTRL_CMD_GET | CTRL_RESPONSE, CTRL_OK, battery, field, 0};
+        const HIDReport* report = (battery < m_count) ? m_devices[battery].GetFeature(field) : nullptr;
+        if (battery >= m_count) {
+            response[1] = CTRL_ERR_BATTERY;
+        } else if (!report) {
+            response[1] = CTRL_ERR_FIELD;
+        } else {
+            response[4] = report->length;
+            if (report->progmem)
+                memcpy_P(&response[5], report->data, report->length);
+            else
+                memcpy(&response[5], report->data, report->length);
+        }
+        Respond(stream, response, 5 + response[4]);
+    } else {
+        uint8_t response[] = {(uint8_t)(cmd | CTRL_RESPONSE), CTRL_ERR_COMMAND};
+        Respond(stream, response, sizeof(response));
+    }
+}
+
+uint8_t BatteryControl::Set(bool apply) {
+    for (uint8_t pos = 1; pos < m_len; ) {
+        if (pos + 3 > m_len)
+            return CTRL_ERR_COMMAND;
+
+        uint8_t battery = m_payload[pos];
+        uint8_t field = m_payload[pos + 1];
+        uint8_t length = m_payload[pos + 2];
+        const uint8_t* value = &m_payload[pos + 3];
+        if (pos + 3 + length > m_len)
+            return CTRL_ERR_COMMAND;
+
+        uint8_t first = battery;
+        uint8_t last = battery;
+        if (battery == CTRL_ALL_BATTERIES) {
+            first = 0;
+            last = m_count - 1;
+        } else if (battery >= m_count) {
+            return CTRL_ERR_BATTERY;
+        }
+
+        for (uint8_t i = first; i <= last; i++) {
+            const HIDReport* report = m_devices[i].GetFeature(field);
+            if (!report)
+                return CTRL_ERR_FIELD;
+            if (report->length != length)
+                return CTRL_ERR_LENGTH;
+            if (report->progmem)
+                return CTRL_ERR_READONLY;
+
+            if (apply) {
+                memcpy((uint8_t*)report->data, value, length);
+                if (m_onSet)
+                    m_onSet(i, field);
+            }
+        }
+
+        pos += 3 + length;
+    }
+    return CTRL_OK;
+}
+
+void BatteryControl::Respond(Stream& stream, const uint8_t* payload, uint8_t len) {
+    uint8_t header[] = {CTRL_SYNC, len};
+    uint8_t crc = ControlCrc8(ControlCrc8(0, &len, 1), payload, len);
+
+    stream.write(header, sizeof(header));
+    stream.write(payload, len);
+    stream.write(crc);
+}
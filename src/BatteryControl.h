@@ -0,0 +1,67 @@
+#pragma once
+#include <Arduino.h>
+#include "HIDPowerDevice.h"
+
+// Binary control protocol frame: [SYNC, length, payload[length], CRC-8 of length & payload]
+// The SYNC byte is outside the ASCII range, so it can share a serial port with text logging.
+#define CTRL_SYNC            0xA5
+#define CTRL_MAX_PAYLOAD     48
+
+// Request payloads. Values are raw little-endian HID feature report payloads, so "field" is the HID_PD_* report ID.
+#define CTRL_CMD_SET         0x01 // [CMD, {battery, field, length, value[length]}...] (battery 0xFF = all)
+#define CTRL_CMD_GET         0x02 // [CMD, battery, field]
+#define CTRL_RESPONSE        0x80 // response flag. Responses: [CMD_SET|RESPONSE, status] and [CMD_GET|RESPONSE, status, battery, field, length, value[length]]
+
+// Response status codes
+#define CTRL_OK              0x00
+#define CTRL_ERR_COMMAND     0x01 // unknown command or malformed payload
+#define CTRL_ERR_BATTERY     0x02 // battery index out of range
+#define CTRL_ERR_FIELD       0x03 // report ID not registered
+#define CTRL_ERR_LENGTH      0x04 // value length does not match registered report
+#define CTRL_ERR_READONLY    0x05 // report is a constant stored in flash
+
+#define CTRL_ALL_BATTERIES   0xFF
+
+/** CRC-8 with polynomial 0x07. */
+uint8_t ControlCrc8(uint8_t crc, const uint8_t* data, uint8_t len);
+
+/** Framed binary command protocol for injecting and reading back battery values over a serial port.
+    All updates in a SET frame are validated before being applied together, so the batteries never observe a partially applied frame. */
+class BatteryControl {
+public:
+    /** Called for each battery & report ID written by an applied SET frame. */
+    typedef void (*SetCallback)(uint8_t battery, uint8_t field);
+
+    /** The "devices" array need to outlast this object. */
+    BatteryControl(HIDPowerDevice_* devices, uint8_t count) : m_devices(devices), m_count(count) {}
+
+    /** Notify "callback" about applied updates, for instance to stop simulating injected values. */
+    void OnSet(SetCallback callback) {
+        m_onSet = callback;
+    }
+
+    /** Read available bytes from "stream" without blocking, and execute completed frames.
+        Call at the start or end of loop(), so that updates are applied at a loop boundary. */
+    void Poll(Stream& stream);
+
+private:
+    void Execute(Stream& stream);
+    uint8_t Set(bool apply);
+    void Respond(Stream& stream, const uint8_t* payload, uint8_t len);
+
+    enum State : uint8_t {
+        WaitSync,
+        WaitLength,
+        WaitPayload,
+        WaitCrc,
+    };
+
+    HIDPowerDevice_* m_devices;
+    uint8_t m_count;
+    SetCallback m_onSet = nullptr;
+
+    State   m_state = WaitSync;
+    uint8_t m_len = 0;
+    uint8_t m_pos = 0;
+    uint8_t m_payload[CTRL_MAX_PAYLOAD];
+};
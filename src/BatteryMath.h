@@ -0,0 +1,103 @@
+#pragma once
+#include <stdint.h>
+
+// Integer & fixed-point battery arithmetic, which avoids pulling in soft-float routines on FPU-less AVR.
+// All functions are constexpr, so conversions of constants are done at compile time. Written as single-return
+// functions to stay within C++11, which is used by the Arduino AVR toolchain.
+
+/** Clamp a 32-bit intermediate result to the 16-bit range of HID report values. */
+constexpr uint16_t Saturate16(uint32_t value) {
+    return (value > 0xFFFF) ? 0xFFFF : (uint16_t)value;
+}
+
+/** a*b/c rounded to nearest, with 32-bit widening of the product. Saturates at 0xFFFF, and returns 0 if "c" is 0. */
+constexpr uint16_t MulDiv(uint16_t a, uint16_t b, uint16_t c) {
+    return c ? Saturate16(((uint32_t)a*b + c/2)/c) : 0;
+}
+
+/** Unsigned fixed-point factor with "F" fractional bits, used for scaling capacities and times. */
+template <uint8_t F>
+struct UFixed {
+    static_assert((F > 0) && (F < 16), "unsupported number of fractional bits");
+
+    uint16_t raw;
+
+    static constexpr UFixed FromRaw(uint16_t raw) {
+        return UFixed{raw};
+    }
+
+    /** "num"/"den" rounded to nearest. */
+    static constexpr UFixed FromRatio(uint16_t num, uint16_t den) {
+        return UFixed{Saturate16((((uint32_t)num << F) + den/2)/den)};
+    }
+
+    static constexpr UFixed FromPercent(uint16_t percent) {
+        return FromRatio(percent, 100);
+    }
+
+    /** "value" multiplied by this factor, rounded to nearest. The 16x16 bit product is widened to 32 bits, and the result saturates at 0xFFFF. */
+    constexpr uint16_t Scale(uint16_t value) const {
+        return Saturate16(((uint32_t)value*raw + (1ul << (F - 1))) >> F);
+    }
+
+    constexpr bool operator < (UFixed other) const {
+        return raw < other.raw;
+    }
+};
+
+/** Factor in [0, 4) with 1/16384 resolution, which covers charge levels & rates as fraction of a capacity. */
+typedef UFixed<14> Ratio;
+
+// Capacity units, matching the CapacityMode feature report.
+#define CAPACITY_MODE_MAH      0
+#define CAPACITY_MODE_MWH      1
+#define CAPACITY_MODE_PERCENT  2
+
+/** Capacity [AmpSec] from [mAh] (1 mAh = 3.6 As). */
+constexpr uint16_t AmpSecFromMilliAmpHours(uint16_t mAh) {
+    return Saturate16(((uint32_t)mAh*36 + 5)/10);
+}
+
+/** Capacity [mAh] from [AmpSec]. */
+constexpr uint16_t MilliAmpHoursFromAmpSec(uint16_t ampSec) {
+    return Saturate16(((uint32_t)ampSec*10 + 18)/36);
+}
+
+/** Capacity [AmpSec] from energy [mWh] at a given voltage [cV] (AmpSec = mWh*360/centiVolt). */
+constexpr uint16_t AmpSecFromMilliWattHours(uint32_t mWh, uint16_t centiVolt) {
+    return centiVolt ? Saturate16((mWh*360 + centiVolt/2)/centiVolt) : 0;
+}
+
+/** Energy [mWh] from capacity [AmpSec] at a given voltage [cV]. */
+constexpr uint16_t MilliWattHoursFromAmpSec(uint16_t ampSec, uint16_t centiVolt) {
+    return Saturate16(((uint32_t)ampSec*centiVolt + 180)/360);
+}
+
+/** Capacity [AmpSec] in the unit of a given CapacityMode. Percent is relative to "full" [AmpSec]. */
+template <uint8_t MODE>
+constexpr uint16_t CapacityFromAmpSec(uint16_t ampSec, uint16_t centiVolt, uint16_t full) {
+    static_assert(MODE <= CAPACITY_MODE_PERCENT, "unsupported CapacityMode");
+    return (MODE == CAPACITY_MODE_MAH) ? MilliAmpHoursFromAmpSec(ampSec)
+         : (MODE == CAPACITY_MODE_MWH) ? MilliWattHoursFromAmpSec(ampSec, centiVolt)
+         : MulDiv(ampSec, 100, full);
+}
+
+/** Run time [s] at the present rate, given the run time [s] of a full battery. */
+constexpr uint16_t RunTime(uint16_t remaining, uint16_t full, uint16_t fullRunTime) {
+    return MulDiv(fullRunTime, remaining, full);
+}
+
+/** Voltage [cV] from [mV], rounded to nearest. */
+constexpr uint16_t CentiVoltFromMilliVolt(uint16_t mV) {
+    return Saturate16(((uint32_t)mV + 5)/10);
+}
+
+/** Temperature [K] from [°C]. */
+constexpr uint16_t KelvinFromCelsius(int16_t celsius) {
+    return (uint16_t)(celsius + 273);
+}
+
+/** Temperature [°C] from [K]. */
+constexpr int16_t CelsiusFromKelvin(uint16_t kelvin) {
+    return (int16_t)kelvin - 273;
+}
@@ -0,0 +1,152 @@
+#include "BatteryScenario.h"
+
+
+void BatteryScenario::Ramp::Set(uint16_t value, uint16_t target, uint32_t dur) {
+    from = value;
+    to = target;
+    elapsed = 0;
+    duration = dur;
+}
+
+void BatteryScenario::Ramp::Advance(uint32_t ms) {
+    // saturate, so that the ramp stays at its target however long the scenario waits
+    elapsed = (ms >= duration - elapsed) ? duration : elapsed + ms;
+}
+
+uint16_t BatteryScenario::Ramp::Value() const {
+    if (elapsed >= duration)
+        return to;
+
+    // integer interpolation to avoid soft-float on AVR
+    // scale down time to 15bit so that the product fits in 32bit
+    uint32_t el = elapsed;
+    uint32_t dur = duration;
+    while (dur > 0x7FFF) {
+        el >>= 1;
+        dur >>= 1;
+    }
+    int32_t delta = (int32_t)to - (int32_t)from;
+    return from + delta*(int32_t)el/(int32_t)dur;
+}
+
+void BatteryScenario::Start(const uint8_t* program_P, uint16_t initialCharge, uint16_t initialTemp) {
+    m_program = program_P;
+    m_pc = 0;
+    m_running = true;
+
+    m_lastMillis = millis();
+    m_wait = 0;
+    m_waited = false;
+    m_speed = 1;
+
+    m_charge.Set(initialCharge, initialCharge, 0);
+    m_temp.Set(initialTemp, initialTemp, 0);
+    m_ac = false;
+    memset(m_offset, 0, sizeof(m_offset));
+}
+
+uint8_t BatteryScenario::ReadByte() {
+    return pgm_read_byte(&m_program[m_pc++]);
+}
+
+uint16_t BatteryScenario::ReadWord() {
+    uint16_t lo = ReadByte();
+    return lo | ((uint16_t)ReadByte() << 8);
+}
+
+bool BatteryScenario::Update() {
+    if (!m_running)
+        return false;
+
+    unsigned long now = millis();
+    uint32_t elapsed = now - m_lastMillis; // modulo 2^32 like millis() on AVR, so a wrap-around is harmless
+    m_lastMillis = now;
+
+    // saturate instead of wrapping on fast-forward
+    uint32_t scaled = (elapsed > UINT32_MAX/m_speed) ? UINT32_MAX : elapsed*m_speed;
+    return Advance(scaled);
+}
+
+bool BatteryScenario::Advance(uint32_t ms) {
+    for (;;) {
+        if (ms < m_wait) {
+            m_wait -= ms;
+            m_charge.Advance(ms);
+            m_temp.Advance(ms);
+            return true;
+        }
+
+        // run up to the next instruction, so that ramps started there include the rest of "ms"
+        m_charge.Advance(m_wait);
+        m_temp.Advance(m_wait);
+        ms -= m_wait;
+        m_wait = 0;
+
+        // execute instructions until reaching a wait
+        while (m_wait == 0) {
+            uint8_t op = ReadByte();
+            switch (op) {
+            case SCN_OP_CHARGE: {
+                uint8_t percent = ReadByte();
+                uint16_t sec = ReadWord();
+                m_charge.Set(m_charge.Value(), percent, 1000ul*sec);
+                break;
+            }
+            case SCN_OP_TEMP: {
+                uint16_t kelvin = ReadWord();
+                uint16_t sec = ReadWord();
+                m_temp.Set(m_temp.Value(), kelvin, 1000ul*sec);
+                break;
+            }
+            case SCN_OP_AC:
+                m_ac = ReadByte();
+                break;
+            case SCN_OP_WAIT:
+                m_wait = 1000ul*ReadWord();
+                if (m_wait)
+                    m_waited = true;
+                break;
+            case SCN_OP_SPEED:
+                m_speed = ReadByte();
+                if (!m_speed)
+                    m_speed = 1; // avoid a scenario that never advances
+                break;
+            case SCN_OP_OFFSET: {
+                uint8_t battery = ReadByte();
+                int8_t percent = ReadByte();
+                if (battery < SCENARIO_MAX_BATTERIES)
+                    m_offset[battery] = percent;
+                break;
+            }
+            case SCN_OP_LOOP:
+                if (!m_waited) {
+                    m_running = false; // loop without wait
+                    return false;
+                }
+                m_waited = false;
+                m_pc = 0;
+                break;
+            case SCN_OP_END:
+            default:
+                m_running = false;
+                return false;
+            }
+        }
+    }
+}
+
+uint8_t BatteryScenario::Charge(uint8_t battery) const {
+    int16_t charge = m_charge.Value();
+    if (battery < SCENARIO_MAX_BATTERIES)
+        charge += m_offset[battery];
+
+    if (charge < 0)
+        return 0;
+    if (charge > 100)
+        return 100;
+    return charge;
+}
+
+uint16_t BatteryScenario::Temperature() const {
+    return m_temp.Value();
+}
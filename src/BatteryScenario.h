@@ -0,0 +1,86 @@
+#pragma once
+#include <Arduino.h>
+#include "HIDPowerDevice.h"
+
+// Scenario bytecode. Each instruction is an opcode byte followed by little-endian arguments.
+// Ramps run in the background, whereas SCN_WAIT advances the timeline.
+#define SCN_OP_END     0x00
+#define SCN_OP_CHARGE  0x01 // ramp charge level [%] over a duration [s]
+#define SCN_OP_TEMP    0x02 // ramp temperature [K] over a duration [s]
+#define SCN_OP_AC      0x03 // plug (1) or unplug (0) AC power
+#define SCN_OP_WAIT    0x04 // wait a duration [s]
+#define SCN_OP_SPEED   0x05 // fast-forward time by an integer factor (0 is treated as 1)
+#define SCN_OP_OFFSET  0x06 // signed charge offset [%] for one battery
+#define SCN_OP_LOOP    0x07 // restart from the beginning
+
+// Macros for writing PROGMEM scenarios directly in a sketch, like
+//   const uint8_t SCENARIO[] PROGMEM = { SCN_AC(0), SCN_CHARGE(20, 600), SCN_WAIT(600), SCN_AC(1), SCN_CHARGE(100, 300), SCN_WAIT(300), SCN_LOOP };
+// The host tool test/scenario_compiler generates the same bytecode from a text description.
+#define SCN_END                  SCN_OP_END
+#define SCN_CHARGE(percent, sec) SCN_OP_CHARGE, (uint8_t)(percent), lowByte(sec), highByte(sec)
+#define SCN_TEMP(kelvin, sec)    SCN_OP_TEMP, lowByte(kelvin), highByte(kelvin), lowByte(sec), highByte(sec)
+#define SCN_AC(on)               SCN_OP_AC, (uint8_t)(on)
+#define SCN_WAIT(sec)            SCN_OP_WAIT, lowByte(sec), highByte(sec)
+#define SCN_SPEED(factor)        SCN_OP_SPEED, (uint8_t)(factor)
+#define SCN_OFFSET(battery, percent) SCN_OP_OFFSET, (uint8_t)(battery), (uint8_t)(int8_t)(percent)
+#define SCN_LOOP                 SCN_OP_LOOP
+
+// max number of batteries with individual charge offsets
+#ifndef SCENARIO_MAX_BATTERIES
+#define SCENARIO_MAX_BATTERIES MAX_SHARED_BATTERIES
+#endif
+
+/** Interpreter for scripted battery timelines stored as bytecode in PROGMEM. */
+class BatteryScenario {
+public:
+    /** Start running a PROGMEM scenario. The "program_P" pointer need to outlast this object. */
+    void Start(const uint8_t* program_P, uint16_t initialCharge, uint16_t initialTemp);
+
+    /** Advance the scenario by the millis() time elapsed since the last call, scaled by the speed factor.
+        Only per-call deltas are accumulated, so the scenario keeps running across millis() wrap-arounds and for any duration.
+        Returns false when the scenario has ended. */
+    bool Update();
+
+    /** Charge level [%] for a given battery, including its offset. */
+    uint8_t Charge(uint8_t battery) const;
+
+    /** Temperature [K]. */
+    uint16_t Temperature() const;
+
+    bool ACPresent() const {
+        return m_ac;
+    }
+
+private:
+    /** Linear interpolation between two values over a time interval. */
+    struct Ramp {
+        uint16_t from = 0;
+        uint16_t to = 0;
+        uint32_t elapsed = 0;  // [ms], saturates at duration
+        uint32_t duration = 0; // [ms]
+
+        void Set(uint16_t value, uint16_t target, uint32_t dur);
+        void Advance(uint32_t ms);
+        uint16_t Value() const;
+    };
+
+    /** Advance the ramps by "ms" scenario time, and execute the instructions that become due. */
+    bool Advance(uint32_t ms);
+
+    uint8_t  ReadByte();
+    uint16_t ReadWord();
+
+    const uint8_t* m_program = nullptr; // PROGMEM pointer
+    uint16_t m_pc = 0;                  // program counter
+    bool     m_running = false;
+
+    unsigned long m_lastMillis = 0;
+    uint32_t m_wait = 0;        // scenario time until the next instruction [ms]
+    bool     m_waited = false;  // a wait was executed since the last restart
+    uint8_t  m_speed = 1;
+
+    Ramp   m_charge;
+    Ramp   m_temp;
+    bool   m_ac = false;
+    int8_t m_offset[SCENARIO_MAX_BATTERIES] = {};
+};
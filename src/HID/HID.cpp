@@ -17,20 +17,44 @@
 
 #include "HID.h"
 
+static_assert((HID_SET_QUEUE_SIZE & (HID_SET_QUEUE_SIZE - 1)) == 0, "HID_SET_QUEUE_SIZE must be a power of two");
 
-HIDReport* HID_::m_strReports = nullptr;
+const char* HID_::m_strings[HID_STRING_INDEX_COUNT] = {};
+uint8_t HID_::m_featureSlots[HID_REPORT_ID_COUNT] = {};
+uint8_t HID_::m_featureCount = 0;
 
-HID_::HID_() : PluggableUSBModule(1, 1, m_epType) {
+HID_::HID_(HID_* primary) : PluggableUSBModule(1, 1, m_epType) {
     m_epType[0] = EP_TYPE_INTERRUPT_IN;
+
+    if (primary) {
+        // append as collection to the interface of "primary"
+        HID_* last = primary;
+        while (last->m_nextCollection)
+            last = last->m_nextCollection;
+
+        if (last->m_idOffset + 2*HID_REPORT_ID_COUNT <= 0x100) {
+            m_primary = primary;
+            m_idOffset = last->m_idOffset + HID_REPORT_ID_COUNT;
+            last->m_nextCollection = this;
+            return;
+        }
+        // out of report IDs, so fall back to a separate interface
+    }
+
     PluggableUSB().plug(this);
 }
 
 int HID_::getInterface(uint8_t* interfaceCount)
 {
+    // report descriptors of all collections are concatenated
+    uint16_t descLength = 0;
+    for (const HID_* c = this; c; c = c->m_nextCollection)
+        descLength += c->m_reportDesc.length;
+
     *interfaceCount += 1; // uses 1
     HIDDescriptor hidInterface = {
         D_INTERFACE(pluggedInterface, 1, USB_DEVICE_CLASS_HUMAN_INTERFACE, HID_SUBCLASS_NONE, HID_PROTOCOL_NONE),
-        D_HIDREPORT(m_reportDesc.length),
+        D_HIDREPORT(descLength),
         D_ENDPOINT(USB_ENDPOINT_IN(pluggedEndpoint), USB_ENDPOINT_TYPE_INTERRUPT, USB_EP_SIZE, 0x14)
     };
     return USB_SendControl(0, &hidInterface, sizeof(hidInterface));
@@ -38,38 +62,79 @@ int HID_::getInterface(uint8_t* interfaceCount)
 
 /** Send a USB descriptor string.
   The string is converted from ASCII to UTF-16 with 2-byte prefix.
-  Copied from https://github.com/arduino/ArduinoCore-avr/blob/master/cores/arduino/USBCore.cpp */
+  Expanded in endpoint-sized chunks to minimize the number of USB_SendControl calls.
+  Based on https://github.com/arduino/ArduinoCore-avr/blob/master/cores/arduino/USBCore.cpp */
 static bool USB_SendStringDescriptor(const char* string_P, u8 string_len, uint8_t flags) {
-    u8 c[2] = {sizeof(c) + 2*string_len, // descriptor size
-               0x03};                    // string descriptor type
-    USB_SendControl(0, &c, 2);
+    u8 buf[USB_EP_SIZE];
+    buf[0] = 2 + 2*string_len; // descriptor size
+    buf[1] = 0x03;             // string descriptor type
+    u8 len = 2;
 
     bool pgm = flags & TRANSFER_PGM;
     for(u8 i = 0; i < string_len; i++) {
         // expand from ASCII to UTF-16
-        c[0] = pgm ? pgm_read_byte(&string_P[i]) : string_P[i];
-        c[1] = 0;
-        int r = USB_SendControl(0, &c, 2);
-        if(!r)
-            return false;
+        buf[len++] = pgm ? pgm_read_byte(&string_P[i]) : string_P[i];
+        buf[len++] = 0;
+
+        if (len == sizeof(buf)) {
+            if (USB_SendControl(0, buf, len) <= 0)
+                return false;
+            len = 0;
+        }
     }
+
+    if (len && (USB_SendControl(0, buf, len) <= 0))
+        return false;
     return true;
 }
 
+/** Send a PROGMEM report descriptor with all REPORT_ID values shifted by "idOffset". */
+static int USB_SendReportDescriptor(const uint8_t* desc_P, uint16_t length, uint8_t idOffset) {
+    if (!idOffset)
+        return USB_SendControl(TRANSFER_PGM, desc_P, length);
+
+    uint8_t buf[16]; // room for at least 3 items
+    uint8_t bufLen = 0;
+    int total = 0;
+    for (uint16_t pos = 0; pos < length; ) {
+        uint8_t itemLen = 1 + HIDItemSize(pgm_read_byte(&desc_P[pos]));
+        if (bufLen + itemLen > sizeof(buf)) {
+            int res = USB_SendControl(0, buf, bufLen);
+            if (res < 0)
+                return res;
+            total += res;
+            bufLen = 0;
+        }
+
+        for (uint8_t i = 0; i < itemLen; i++)
+            buf[bufLen + i] = pgm_read_byte(&desc_P[pos + i]);
+        if ((buf[bufLen] & HID_ITEM_PREFIX_MASK) == HID_ITEM_REPORT_ID)
+            buf[bufLen + 1] += idOffset;
+
+        bufLen += itemLen;
+        pos += itemLen;
+    }
+
+    int res = USB_SendControl(0, buf, bufLen);
+    if (res < 0)
+        return res;
+    return total + res;
+}
+
 int HID_::getDescriptor(USBSetup& setup)
 {
     if (setup.bRequest != GET_DESCRIPTOR) // redundant check, since it's already done before calling this method
         return 0;
     
-    if (setup.bmRequestType == REQUEST_DEVICETOHOST | REQUEST_STANDARD | REQUEST_DEVICE) {
+    if (setup.bmRequestType == (REQUEST_DEVICETOHOST | REQUEST_STANDARD | REQUEST_DEVICE)) {
         if (setup.wIndex != 0x0409) // English (matches STRING_LANGUAGE in arduino/USBCore.cpp)
             return 0;
         
         // HID-specific strings
         if(setup.wValueH == USB_STRING_DESCRIPTOR_TYPE) {
-            HIDReport* rep = GetString(setup.wValueL);
-            if(rep)
-                return USB_SendStringDescriptor((char*)rep->data, strlen_P((char*)rep->data), TRANSFER_PGM);
+            const char* str = GetString(setup.wValueL);
+            if(str)
+                return USB_SendStringDescriptor(str, strlen_P(str), TRANSFER_PGM);
         }
         return 0;
     } else if (setup.bmRequestType == REQUEST_DEVICETOHOST_STANDARD_INTERFACE) {
@@ -83,8 +148,11 @@ int HID_::getDescriptor(USBSetup& setup)
             return 0;
 
         int total = 0;
-        if (m_reportDesc.length) {
-            int res = USB_SendControl(TRANSFER_PGM, m_reportDesc.data, m_reportDesc.length);
+        for (const HID_* c = this; c; c = c->m_nextCollection) {
+            if (!c->m_reportDesc.length)
+                continue;
+
+            int res = USB_SendReportDescriptor((const uint8_t*)c->m_reportDesc.data, c->m_reportDesc.length, c->m_idOffset);
             if (res == -1)
                 return -1;
             total += res;
@@ -117,48 +185,303 @@ void HID_::SetDescriptor(const void *data, uint16_t length)
     m_reportDesc.length = length;
 }
 
-void HID_::SetFeature(uint8_t id, const void* data, int len)
+void HID_::SetStatsReport(uint8_t id)
+{
+    m_statsId = id;
+}
+
+bool HID_::SetFeature(uint8_t id, const void* data, int len, bool progmem)
 {
-    if(!m_reports)
-        m_reports = new HIDReport(id, data, len);
-    else
-        m_reports->Append(id, data, len);
+    if (id >= HID_REPORT_ID_COUNT)
+        return false; // report ID out of range
+    if ((len < 0) || (len > HID_MAX_REPORT_LENGTH))
+        return false; // report too large for SET_REPORT buffer
+
+    uint8_t slot = m_featureSlots[id];
+    if (!slot && (m_featureCount >= HID_MAX_FEATURE_REPORTS))
+        return false; // no table entry left for a new report ID
+
+    HIDReport& report = m_reports[slot ? slot - 1 : m_featureCount];
+    if (report.data)
+        return false; // feature already configured
+    if (!progmem && (m_snapshotSize + len > HID_SNAPSHOT_SIZE))
+        return false; // no room in snapshot
+    if (!slot)
+        m_featureSlots[id] = ++m_featureCount; // same entry for this ID in all devices
+    if (!progmem) {
+        report.offset = m_snapshotSize;
+        m_snapshotSize += len;
+    }
+
+    report.data = data;
+    report.length = len;
+    report.progmem = progmem;
+    return true;
+}
+
+void HID_::SetInput(uint8_t id, uint16_t period)
+{
+    const HIDReport* report = GetFeature(id);
+    if (!report || (report->length > HID_MAX_INPUT_LENGTH))
+        return; // feature not registered or too large for change tracking
+    if (report->progmem)
+        return; // constant features never change
+
+    for (HIDInputReport& input : m_inputs) {
+        if (input.id == id)
+            return; // input already configured
+
+        if (!input.id) {
+            input.id = id;
+            input.sent = false;
+            input.period = period;
+            input.idle = m_idle;
+            return;
+        }
+    }
+}
+
+void HID_::SetKeepAlive(uint16_t interval)
+{
+    SetIdle(0, interval);
+}
+
+void HID_::SetIdle(uint8_t id, uint16_t interval)
+{
+    if (!id)
+        m_idle = interval;
+
+    // report ID 0 applies to all reports
+    for (HIDInputReport& input : m_inputs) {
+        if (input.id && (!id || (input.id == id)))
+            input.idle = interval;
+    }
+}
+
+uint8_t HID_::GetIdle(uint8_t id) const
+{
+    uint16_t interval = m_idle;
+    for (const HIDInputReport& input : m_inputs) {
+        if (id && (input.id == id))
+            interval = input.idle;
+    }
+    return (interval/4 > 0xFF) ? 0xFF : interval/4; // 4 ms units
 }
 
 void HID_::SetString(const uint8_t index, const char* data)
 {
-    if(!m_strReports)
-        m_strReports = new HIDReport(index, data, strlen_P(data));
-    else
-        m_strReports->Append(index, data, strlen_P(data));
+    if (index >= HID_STRING_INDEX_COUNT)
+        return; // string index out of range
+
+    if (m_strings[index])
+        return; // string already configured
+
+    m_strings[index] = data;
+}
+
+const char* HIDStringPool::operator [] (uint8_t index) const
+{
+    const char* str = m_pool;
+    for (uint8_t i = 0; i < index; i++) {
+        str += strlen_P(str) + 1; // skip string & null-termination
+        if (str >= m_pool + m_size)
+            return nullptr; // out of range
+    }
+    return str;
+}
+
+uint8_t HIDStringPool::Count() const
+{
+    uint8_t count = 0;
+    for (const char* str = m_pool; str < m_pool + m_size; str += strlen_P(str) + 1)
+        count++;
+    return count;
 }
 
 int HID_::SendReport(uint8_t id, const void* data, int len)
 {
-    auto ret = USB_Send(pluggedEndpoint, &id, 1);
-    if (ret < 0)
-        return ret;
+    if ((len < 0) || (len > HID_MAX_REPORT_LENGTH))
+        return -1;
+
+    // assemble report ID & payload in one buffer to send them in a single transfer
+    uint8_t report[1 + HID_MAX_REPORT_LENGTH];
+    report[0] = m_idOffset + id;
+    memcpy(report + 1, data, len);
 
-    auto ret2 = USB_Send(pluggedEndpoint | TRANSFER_RELEASE, data, len);
-    if (ret2 < 0)
-        return ret2;
-    return ret + ret2;
+    unsigned long start = micros();
+    int res = USB_Send(Endpoint() | TRANSFER_RELEASE, report, 1 + len);
+    uint16_t duration = micros() - start;
+
+    if (res < 0) {
+        m_stats.sendFailures++;
+        m_stats.lastSendError = res;
+    }
+    if (duration > m_stats.sendMaxMicros)
+        m_stats.sendMaxMicros = duration;
+    m_stats.sendAvgMicros += ((int32_t)duration - m_stats.sendAvgMicros)/8; // exponential moving average
+    return res;
 }
 
-const HIDReport* HID_::GetFeature(uint8_t id)
+int HID_::SendInputReports()
 {
-    if (!m_reports)
+    uint16_t now = millis(); // truncated to 16bit, which is sufficient for intervals up to 65 sec
+
+    // queue due reports
+    for (uint8_t i = 0; i < HID_MAX_INPUT_REPORTS; i++) {
+        HIDInputReport& input = m_inputs[i];
+        if (!input.id)
+            break; // no more inputs
+        if (input.queued)
+            continue; // already queued, so merge with pending entry
+
+        uint16_t elapsed = now - input.lastSent;
+        if (input.sent && (elapsed < input.period))
+            continue; // not yet due
+
+        // compare against snapshot of last sent value
+        const HIDReport* report = GetFeature(input.id);
+        bool keepAlive = input.idle && (elapsed >= input.idle);
+        if (input.sent && !keepAlive && !memcmp(Published(input.id, m_front), input.snapshot, report->length))
+            continue; // unchanged
+
+        // the ring has room for all inputs, since each input is queued at most once
+        uint8_t tail = m_txHead + m_txCount;
+        m_txQueue[(tail < HID_MAX_INPUT_REPORTS) ? tail : tail - HID_MAX_INPUT_REPORTS] = i;
+        m_txCount++;
+        input.queued = true;
+    }
+
+    // send queued reports while the endpoint has room
+    int total = 0;
+    while (m_txCount) {
+        HIDInputReport& input = m_inputs[m_txQueue[m_txHead]];
+        const HIDReport* report = GetFeature(input.id);
+        if (USB_SendSpace(Endpoint()) < 1 + report->length)
+            break; // endpoint busy, so retry on next call
+
+        uint8_t value[HID_MAX_INPUT_LENGTH];
+        memcpy(value, Published(input.id, m_front), report->length);
+        int res = SendReport(input.id, value, report->length);
+        if (res < 0)
+            return res; // retry on next call, since the report is still queued
+
+        memcpy(input.snapshot, value, report->length);
+        input.sent = true;
+        input.queued = false;
+        input.lastSent = now;
+        total += res;
+
+        m_txHead = (m_txHead + 1 < HID_MAX_INPUT_REPORTS) ? m_txHead + 1 : 0;
+        m_txCount--;
+    }
+    return total;
+}
+
+void HID_::Publish()
+{
+    // fill the copy that is not served to the host
+    uint8_t back = (m_front == 0) ? 1 : 0;
+    for (const HIDReport& report : m_reports) {
+        if (!report.data || report.progmem)
+            continue;
+        // SET_REPORT writes the storage from the USB ISR, so copy each report with interrupts disabled
+        uint8_t sreg = SREG;
+        cli();
+        memcpy(&m_snapshot[back][report.offset], report.data, report.length);
+        SREG = sreg;
+    }
+
+    // single byte store, so the USB ISR sees either the old or the new copy
+    m_front = back;
+}
+
+uint8_t HID_::PopSetReport()
+{
+    uint8_t tail = m_setTail;
+    if (tail == m_setHead) {
+        if (!m_setOverflow)
+            return 0;
+        m_setOverflow = false;
+        return HID_SET_OVERFLOW;
+    }
+
+    uint8_t id = m_setQueue[tail % HID_SET_QUEUE_SIZE];
+    m_setTail = tail + 1; // release slot after reading it
+    return id;
+}
+
+const void* HID_::Published(uint8_t id, uint8_t front) const
+{
+    const HIDReport& report = m_reports[m_featureSlots[id] - 1];
+    if (report.progmem || (front > 1))
+        return report.data; // constant or not yet published
+
+    return &m_snapshot[front][report.offset];
+}
+
+bool HIDReportBatch::Add(uint8_t id, const void* data, uint8_t len)
+{
+    if (len > HID_MAX_REPORT_LENGTH)
+        return false;
+    if (m_size + 2 + len > HID_REPORT_BATCH_SIZE)
+        return false; // batch full
+
+    m_buf[m_size] = len;
+    m_buf[m_size + 1] = id;
+    memcpy(&m_buf[m_size + 2], data, len);
+    m_size += 2 + len;
+    return true;
+}
+
+int HIDReportBatch::Flush()
+{
+    int total = 0;
+    for (uint8_t pos = 0; pos < m_size; pos += 2 + m_buf[pos]) {
+        // SendReport applies the report ID offset & counts failures, like for any other INPUT report
+        int res = m_hid.SendReport(m_buf[pos + 1], &m_buf[pos + 2], m_buf[pos]);
+        if (res < 0) {
+            m_size = 0;
+            return res;
+        }
+        total += res;
+    }
+
+    m_size = 0;
+    return total;
+}
+
+const HIDReport* HID_::GetFeature(uint8_t id) const
+{
+    if ((id >= HID_REPORT_ID_COUNT) || !m_featureSlots[id])
+        return nullptr;
+
+    const HIDReport* report = &m_reports[m_featureSlots[id] - 1];
+    if (!report->data)
         return nullptr;
 
-    return m_reports->Get(id);
+    return report;
 }
 
-const HIDReport* HID_::GetString(uint8_t id)
+HID_* HID_::GetCollection(uint8_t id)
 {
-    if (!m_strReports)
+    for (HID_* c = this; c; c = c->m_nextCollection) {
+        if ((id >= c->m_idOffset) && (id - c->m_idOffset < HID_REPORT_ID_COUNT))
+            return c;
+    }
+    return nullptr;
+}
+
+uint8_t HID_::Endpoint() const
+{
+    return m_primary ? m_primary->pluggedEndpoint : pluggedEndpoint;
+}
+
+const char* HID_::GetString(uint8_t id)
+{
+    if (id >= HID_STRING_INDEX_COUNT)
         return nullptr;
-    
-    return m_strReports->Get(id);
+
+    return m_strings[id];
 }
 
 bool HID_::setup(USBSetup& setup)
@@ -169,24 +492,44 @@ bool HID_::setup(USBSetup& setup)
     if (setup.bmRequestType == REQUEST_DEVICETOHOST_CLASS_INTERFACE) {
         if (setup.bRequest == HID_GET_REPORT) {
             if(setup.wValueH == HID_REPORT_TYPE_FEATURE) {
-                HIDReport* current = GetFeature(setup.wValueL);
+                HID_* collection = GetCollection(setup.wValueL);
+                uint8_t id = collection ? setup.wValueL - collection->m_idOffset : 0;
+                if (collection && collection->m_statsId && (id == collection->m_statsId)) {
+                    collection->m_stats.getReport++;
+                    int res = USB_SendControl(0, &setup.wValueL, 1);
+                    if (res > 0)
+                        res = USB_SendControl(0, &collection->m_stats, sizeof(HIDStats));
+                    return (res > 0);
+                }
+
+                const HIDReport* current = collection ? collection->GetFeature(id) : nullptr;
                 if(current){
-                    int res = USB_SendControl(0, &(current->id), 1);
-                    if(res > 0)
-                        res = USB_SendControl(0, current->data, current->length);
+                    collection->m_stats.getReport++;
+                    int res = USB_SendControl(0, &setup.wValueL, 1);
+                    if(res > 0) {
+                        const void* data = collection->Published(id, collection->m_front);
+                        res = USB_SendControl(current->progmem ? TRANSFER_PGM : 0, data, current->length);
+                    }
                     return (res > 0);
                 }
 
+                (collection ? collection : this)->m_stats.getReportMiss++;
                 return false;
             }
             return true;
         }
         if (setup.bRequest == HID_GET_PROTOCOL) {
-            // TODO: Send8(m_protocol);
-            return true;
+            m_stats.protocolRequests++;
+            return USB_SendControl(0, &m_protocol, 1) > 0;
         }
         if (setup.bRequest == HID_GET_IDLE) {
-            // TODO: Send8(m_idle);
+            m_stats.idleRequests++;
+            // wValueL contains the report ID
+            HID_* collection = GetCollection(setup.wValueL);
+            if (!collection)
+                return false;
+            uint8_t idle = collection->GetIdle(setup.wValueL - collection->m_idOffset);
+            return USB_SendControl(0, &idle, 1) > 0;
         }
     }
 
@@ -194,28 +537,53 @@ bool HID_::setup(USBSetup& setup)
         if (setup.bRequest == HID_SET_PROTOCOL) {
             // The USB Host tells us if we are in boot or report mode.
             // This only works with a real boot compatible device.
+            m_stats.protocolRequests++;
             m_protocol = setup.wValueL;
             return true;
         }
         if (setup.bRequest == HID_SET_IDLE) {
-            m_idle = setup.wValueL;
+            // wValueH contains the duration in 4 ms units (0 = indefinite), wValueL the report ID (0 = all reports)
+            m_stats.idleRequests++;
+            if (!setup.wValueL) {
+                for (HID_* c = this; c; c = c->m_nextCollection)
+                    c->SetIdle(0, setup.wValueH*4);
+                return true;
+            }
+            HID_* collection = GetCollection(setup.wValueL);
+            if (!collection)
+                return false;
+            collection->SetIdle(setup.wValueL - collection->m_idOffset, setup.wValueH*4);
             return true;
         }
         if (setup.bRequest == HID_SET_REPORT) {
             if(setup.wValueH == HID_REPORT_TYPE_FEATURE) {
-                HIDReport* current = GetFeature(setup.wValueL);
-                if(!current)
-                    return false;
+                HID_* collection = GetCollection(setup.wValueL);
+                const HIDReport* current = collection ? collection->GetFeature(setup.wValueL - collection->m_idOffset) : nullptr;
+                if(!current || current->progmem || (setup.wLength != current->length + 1)) {
+                    (collection ? collection : this)->m_stats.setReportMiss++;
+                    return false; // unknown or read-only feature, or wrong length
+                }
 
-                if(setup.wLength != current->length + 1)
+                // receive into stack buffer to avoid heap allocations in the USB interrupt
+                uint8_t data[1 + HID_MAX_REPORT_LENGTH];
+                if (USB_RecvControl(data, setup.wLength) != setup.wLength)
                     return false;
-
-                uint8_t* data = new uint8_t[setup.wLength];
-                USB_RecvControl(data, setup.wLength);
-                if(*data != current->id)
+                if(data[0] != setup.wValueL)
                     return false;
+                // only write the registered storage, since loop() may be sending from the published copy.
+                // The new value is published by the next Publish call.
                 memcpy((uint8_t*)current->data, data+1, current->length);
-                delete[] data;
+
+                collection->m_stats.setReport++;
+
+                // notify loop() of the change
+                uint8_t head = collection->m_setHead;
+                if ((uint8_t)(head - collection->m_setTail) < HID_SET_QUEUE_SIZE) {
+                    collection->m_setQueue[head % HID_SET_QUEUE_SIZE] = setup.wValueL - collection->m_idOffset;
+                    collection->m_setHead = head + 1; // publish slot after writing it
+                } else {
+                    collection->m_setOverflow = true;
+                }
                 return true;
             }
         }
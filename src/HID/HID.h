@@ -17,7 +17,6 @@
 #pragma once
 #include <stdint.h>
 #include <Arduino.h>
-#include <HardwareSerial.h>
 #include <PluggableUSB.h>
 
 // HID 'Driver'
@@ -49,6 +48,72 @@
 #define HID_REPORT_TYPE_OUTPUT  2
 #define HID_REPORT_TYPE_FEATURE 3
 
+// HID short item prefix (tag & type bits, with size bits masked out) HID1.11 Page 26 6.2.2.2 Short Items
+#define HID_ITEM_PREFIX_MASK    0xFC
+#define HID_ITEM_INPUT          0x80 // Main items
+#define HID_ITEM_OUTPUT         0x90
+#define HID_ITEM_FEATURE        0xB0
+#define HID_ITEM_USAGE_PAGE     0x04 // Global items
+#define HID_ITEM_LOGICAL_MIN    0x14
+#define HID_ITEM_LOGICAL_MAX    0x24
+#define HID_ITEM_UNIT_EXPONENT  0x54
+#define HID_ITEM_UNIT           0x64
+#define HID_ITEM_REPORT_SIZE    0x74
+#define HID_ITEM_REPORT_ID      0x84
+#define HID_ITEM_REPORT_COUNT   0x94
+
+// Compile-time parsing of HID report descriptors. Written as single-return recursive
+// constexpr functions to stay within C++11, which is used by the Arduino AVR toolchain.
+
+/** Data size [bytes] of a short item. */
+constexpr uint8_t HIDItemSize(uint8_t prefix) {
+    return ((prefix & 0x03) == 3) ? 4 : (prefix & 0x03);
+}
+
+/** Unsigned data value of a short item. */
+constexpr uint32_t HIDItemData(const uint8_t* item) {
+    return (HIDItemSize(item[0]) > 0 ? (uint32_t)item[1] : 0)
+         | (HIDItemSize(item[0]) > 1 ? (uint32_t)item[2] << 8 : 0)
+         | (HIDItemSize(item[0]) > 2 ? (uint32_t)item[3] << 16 | (uint32_t)item[4] << 24 : 0);
+}
+
+/** Total size [bits] of the main items of a given type (HID_ITEM_INPUT/OUTPUT/FEATURE) with a given report ID. */
+constexpr uint16_t HIDReportBits(const uint8_t* desc, uint16_t len, uint8_t type, uint8_t id,
+                                 uint16_t pos = 0, uint8_t curId = 0, uint8_t size = 0, uint8_t count = 0) {
+    return (pos >= len) ? 0 :
+        ((((desc[pos] & HID_ITEM_PREFIX_MASK) == type) && (curId == id)) ? size*count : 0)
+        + HIDReportBits(desc, len, type, id, pos + 1 + HIDItemSize(desc[pos]),
+                        ((desc[pos] & HID_ITEM_PREFIX_MASK) == HID_ITEM_REPORT_ID)    ? (uint8_t)HIDItemData(&desc[pos]) : curId,
+                        ((desc[pos] & HID_ITEM_PREFIX_MASK) == HID_ITEM_REPORT_SIZE)  ? (uint8_t)HIDItemData(&desc[pos]) : size,
+                        ((desc[pos] & HID_ITEM_PREFIX_MASK) == HID_ITEM_REPORT_COUNT) ? (uint8_t)HIDItemData(&desc[pos]) : count);
+}
+
+/** Payload length [bytes] of a report, excluding the report ID byte. */
+constexpr uint8_t HIDReportLength(const uint8_t* desc, uint16_t len, uint8_t type, uint8_t id) {
+    return (HIDReportBits(desc, len, type, id) + 7)/8;
+}
+
+/** Number of global items of a given kind that repeat the value already in effect. */
+constexpr uint8_t HIDRedundantItems(const uint8_t* desc, uint16_t len, uint8_t prefix,
+                                    uint16_t pos = 0, bool set = false, uint8_t size = 0, uint32_t value = 0) {
+    return (pos >= len) ? 0 :
+        ((desc[pos] & HID_ITEM_PREFIX_MASK) != prefix)
+        ? HIDRedundantItems(desc, len, prefix, pos + 1 + HIDItemSize(desc[pos]), set, size, value)
+        : (set && (HIDItemSize(desc[pos]) == size) && (HIDItemData(&desc[pos]) == value) ? 1 : 0)
+          + HIDRedundantItems(desc, len, prefix, pos + 1 + HIDItemSize(desc[pos]), true, HIDItemSize(desc[pos]), HIDItemData(&desc[pos]));
+}
+
+/** Number of global items that can be removed without changing the descriptor meaning. */
+constexpr uint8_t HIDRedundantGlobals(const uint8_t* desc, uint16_t len) {
+    return HIDRedundantItems(desc, len, HID_ITEM_USAGE_PAGE)
+         + HIDRedundantItems(desc, len, HID_ITEM_LOGICAL_MIN)
+         + HIDRedundantItems(desc, len, HID_ITEM_LOGICAL_MAX)
+         + HIDRedundantItems(desc, len, HID_ITEM_UNIT_EXPONENT)
+         + HIDRedundantItems(desc, len, HID_ITEM_UNIT)
+         + HIDRedundantItems(desc, len, HID_ITEM_REPORT_SIZE)
+         + HIDRedundantItems(desc, len, HID_ITEM_REPORT_COUNT);
+}
+
 struct HIDDescDescriptor {
   uint8_t len;      // 9
   uint8_t dtype;    // 0x21
@@ -67,50 +132,158 @@ struct HIDDescriptor {
   EndpointDescriptor  in;
 };
 
-class HIDReport {
-public:
-    HIDReport(uint8_t i, const void *d, uint8_t l) : id(i), data(d), length(l) {}
-    
-    void Append(uint8_t id, const void* data, int len) {
-        for (HIDReport* current = this; current; current = current->next) {
-            if(current->id == id)
-                return; // feature already configured
-
-            if(!current->next) {
-                // append at the end
-                current->next = new HIDReport(id, data, len);
-                break;
-            }
-        }
-    }
-    
-    HIDReport* Get (uint8_t id) const {
-        for(HIDReport* current = this; current; current = current->next) {
-            if(id == current->id)
-                return current;
-        }
-        return nullptr;
-    }
-    
-    uint8_t id;
+// Report IDs are used as direct indices into a table shared across HID devices, so they must be small.
+#ifndef HID_REPORT_ID_COUNT
+#define HID_REPORT_ID_COUNT   0x17 // supports report IDs [0x00, 0x16]
+#endif
+
+// Max number of distinct feature report IDs across all HID devices. Each device has one table entry per ID.
+#ifndef HID_MAX_FEATURE_REPORTS
+#define HID_MAX_FEATURE_REPORTS 16
+#endif
+
+// String indices are used as direct indices into a table shared across HID devices.
+#ifndef HID_STRING_INDEX_COUNT
+#define HID_STRING_INDEX_COUNT  32 // supports string indices [0, 31]
+#endif
+
+// Largest report payload (excluding the report ID byte) that can be sent or received. Max 127.
+#ifndef HID_MAX_REPORT_LENGTH
+#define HID_MAX_REPORT_LENGTH    8
+#endif
+
+// Buffer size for reports queued in a HIDReportBatch.
+#ifndef HID_REPORT_BATCH_SIZE
+#define HID_REPORT_BATCH_SIZE   24
+#endif
+
+// Max number of INPUT reports per device that are tracked for changes.
+#ifndef HID_MAX_INPUT_REPORTS
+#define HID_MAX_INPUT_REPORTS    6
+#endif
+
+// Largest INPUT report payload that can be tracked for changes.
+#ifndef HID_MAX_INPUT_LENGTH
+#define HID_MAX_INPUT_LENGTH     2
+#endif
+
+// Size of each of the two published copies of the RAM feature reports of a device.
+#ifndef HID_SNAPSHOT_SIZE
+#define HID_SNAPSHOT_SIZE       20
+#endif
+
+// Number of pending SET_REPORT notifications per device. Must be a power of two.
+#ifndef HID_SET_QUEUE_SIZE
+#define HID_SET_QUEUE_SIZE       4
+#endif
+
+#define HID_SET_OVERFLOW      0xFF // returned by PopSetReport if notifications were lost
+
+/** Storage registered for a report ID. The ID itself is implied by the table entry that HID_ assigned to it. */
+struct HIDReport {
+    HIDReport() : data(nullptr), length(0), progmem(false), offset(0) {}
+
     const void* data;
-    uint16_t length;
-    const HIDReport *next = NULL;
+    uint8_t length : 7;
+    bool    progmem : 1; // "data" is a read-only PROGMEM pointer
+    uint8_t offset;      // position of the published value in the snapshot copies (RAM features only)
+};
+
+/** Send schedule and copy of the last sent value of an INPUT report. */
+struct HIDInputReport {
+    HIDInputReport() : id(0), sent(false), queued(false), period(0), idle(0), lastSent(0) {}
+
+    uint8_t  id; // 0 means unused
+    bool     sent : 1;
+    bool     queued : 1; // waiting in transmit ring
+    uint16_t period;   // min. interval between reports [ms]
+    uint16_t idle;     // max. interval between reports [ms] (0 = only send on change)
+    uint16_t lastSent; // truncated millis() timestamp
+    uint8_t  snapshot[HID_MAX_INPUT_LENGTH];
+};
+
+/** USB performance counters of a HID device. Cheap enough to always be enabled.
+    Counters wrap around, and rare events only have 8 bit counters. Fields are grouped by size to match the report descriptor.
+    Values updated from loop() may be torn when read from the USB ISR, so treat them as diagnostics only. */
+struct HIDStats {
+    uint8_t  getReportMiss = 0;    // GET_REPORT requests for unknown reports
+    uint8_t  setReportMiss = 0;    // SET_REPORT requests for unknown or read-only reports, or with wrong length
+    uint8_t  idleRequests = 0;     // GET_IDLE & SET_IDLE requests
+    uint8_t  protocolRequests = 0; // GET_PROTOCOL & SET_PROTOCOL requests
+    uint8_t  sendFailures = 0;     // SendReport calls where USB_Send failed
+    int8_t   lastSendError = 0;    // last negative USB_Send result
+    uint16_t getReport = 0;        // GET_REPORT requests served
+    uint16_t setReport = 0;        // SET_REPORT requests accepted
+    uint16_t sendMaxMicros = 0;    // worst-case SendReport duration [us]
+    uint16_t sendAvgMicros = 0;    // moving average of SendReport duration [us]
 };
 
 struct HIDReportDescriptor {
-  void* data = nullptr;
+  const void* data = nullptr;
   uint16_t length = 0;
 };
 
 class HID_ : public PluggableUSBModule {
 public:
-    HID_();
+    /** Plug a separate USB interface with its own endpoint if "primary" is null.
+        Otherwise, share the interface & endpoint of "primary" by appending this object as an additional
+        top-level collection to its report descriptor, with report IDs offset by HID_REPORT_ID_COUNT per collection. */
+    HID_(HID_* primary = nullptr);
 
+    /** Send an INPUT report. The report ID and payload are sent as a single transfer. */
     int SendReport(uint8_t id, const void* data, int len);
 
-    /** The "data" pointer need to outlast this object. */ 
-    void SetFeature(uint8_t id, const void* data, int len);
+    /** The "data" pointer need to outlast this object.
+        If "progmem" is set, then "data" is a PROGMEM pointer to a constant feature that is served directly from flash and rejects SET_REPORT.
+        Register all features before the first Publish call.
+        Returns false if the feature was rejected, for instance because it is already registered or the snapshot copies are full. */ 
+    bool SetFeature(uint8_t id, const void* data, int len, bool progmem = false);
+
+    /** Storage registered for a feature report, or null if not registered. */
+    const HIDReport* GetFeature(uint8_t id) const;
+
+    /** Also send an already registered feature report as INPUT report from SendInputReports.
+        Changes are sent at most once per "period" milliseconds. */
+    void SetInput(uint8_t id, uint16_t period = 0);
+
+    /** Resend INPUT reports after "interval" milliseconds without changes. 0 disables resending.
+        Overridden per report by the host through SET_IDLE. */
+    void SetKeepAlive(uint16_t interval);
+
+    /** Queue the INPUT reports that are due, and send queued reports while the endpoint has room. Never blocks, so a host that
+        stops polling only delays this device. Intended to be called on every loop() iteration.
+        A report is due if its value changed and "period" has elapsed, or if the keep-alive interval has elapsed.
+        A report is queued at most once and sent with its latest published value, so stale values are merged.
+        Returns the number of bytes sent, or the first negative SendReport result. */
+    int SendInputReports();
+
+    /** Publish the current value of all RAM feature reports as one consistent snapshot, which is served to the host by
+        GET_REPORT & SendInputReports until the next call. Call from loop() after updating a set of related values.
+        Reports are served directly from the registered storage until the first call.
+        Host writes through SET_REPORT update the registered storage, and are also served once published by the next call. */
+    void Publish();
+
+    /** Report ID of the oldest feature written by the host through SET_REPORT, or 0 if none.
+        Returns HID_SET_OVERFLOW once if notifications were dropped because the queue was full, in which case all writable features should be treated as changed.
+        Intended to be drained from loop(), whereas the USB ISR is the only producer. */
+    uint8_t PopSetReport();
+
+    /** USB performance counters of this device. */
+    const HIDStats& Stats() const {
+        return m_stats;
+    }
+
+
+
+    /** RAM [bytes] used by each HID_ object. All report tables are fixed-size members, so nothing is allocated at runtime. */
+    static constexpr size_t DeviceRam() {
+        return sizeof(HID_);
+    }
+
+    /** RAM [bytes] shared by all HID_ objects. */
+    static constexpr size_t SharedRam() {
+        return sizeof(m_strings) + sizeof(m_featureSlots) + sizeof(m_featureCount);
+    }
 
 protected:
     /** The "data" pointer need to outlast this object. */ 
@@ -118,6 +291,9 @@ protected:
     
     /** The "node" pointer need to outlast this object. */ 
     void SetDescriptor(const void *data, uint16_t length);
+
+    /** Serve the performance counters as read-only FEATURE report "id", which must be declared in the report descriptor with sizeof(HIDStats) bytes. */
+    void SetStatsReport(uint8_t id);
     
     // Implementation of the PluggableUSBModule
     int getInterface(uint8_t* interfaceCount) override;
@@ -126,18 +302,82 @@ protected:
     uint8_t getShortName(char* name) override;
     
 private:
-    const HIDReport* GetFeature(uint8_t id);
-    static const HIDReport* GetString(uint8_t id);
+    HID_* GetCollection(uint8_t id);
+    uint8_t Endpoint() const;
+    void SetIdle(uint8_t id, uint16_t interval);
+    uint8_t GetIdle(uint8_t id) const;
+    static const char* GetString(uint8_t id);
+    const void* Published(uint8_t id, uint8_t front) const;
 
     uint8_t m_epType[1];
 
+    HID_*   m_primary = nullptr;        // owner of the USB interface (null if this object owns it)
+    HID_*   m_nextCollection = nullptr; // next collection sharing the USB interface
+    uint8_t m_idOffset = 0;             // offset of report IDs on the USB interface
+
     HIDReportDescriptor m_reportDesc;
 
     uint8_t m_protocol = HID_REPORT_PROTOCOL;
-    uint8_t m_idle = 1;
+    uint16_t m_idle = 0; // idle interval for report ID 0 [ms], inherited by later SetInput calls
   
-    HIDReport* m_reports = nullptr; // feature reports
-    static HIDReport* m_strReports; // string reports (shared across HID devices)
+    HIDReport m_reports[HID_MAX_FEATURE_REPORTS]; // feature reports, indexed through m_featureSlots
+    HIDInputReport m_inputs[HID_MAX_INPUT_REPORTS]; // INPUT reports with change tracking
+    uint8_t m_txQueue[HID_MAX_INPUT_REPORTS]; // transmit ring of m_inputs indices
+    uint8_t m_txHead = 0;  // index of oldest entry
+    uint8_t m_txCount = 0; // number of entries
+
+    uint8_t m_snapshot[2][HID_SNAPSHOT_SIZE]; // published copies of the RAM feature reports, in registration order
+    uint8_t m_snapshotSize = 0;               // bytes used in each copy
+    volatile uint8_t m_front = 0xFF;          // copy served to the host (0xFF until the first Publish)
+
+    // single-producer (USB ISR) single-consumer (loop) queue of SET_REPORT report IDs
+    volatile uint8_t m_setQueue[HID_SET_QUEUE_SIZE];
+    volatile uint8_t m_setHead = 0;  // written by ISR only
+    volatile uint8_t m_setTail = 0;  // written by loop only
+    volatile bool m_setOverflow = false;
+
+    HIDStats m_stats;
+    uint8_t  m_statsId = 0; // report ID of the performance counters (0 if not exposed)
+    static const char* m_strings[HID_STRING_INDEX_COUNT]; // PROGMEM strings indexed by string index (shared across HID devices)
+    static uint8_t m_featureSlots[HID_REPORT_ID_COUNT];  // m_reports index + 1 for each report ID (0 if unused), shared since devices use the same IDs
+    static uint8_t m_featureCount;                       // assigned m_reports entries
+};
+
+/** Packed PROGMEM pool of null-separated strings with variable length, like "first\0second\0third".
+    The string lookup walks the pool, so resolve strings once during setup and register the returned pointers with the HID_ string table. */
+class HIDStringPool {
+public:
+    template <size_t N>
+    constexpr HIDStringPool(const char (&pool_P)[N]) : m_pool(pool_P), m_size(N) {}
+
+    /** Pointer to string number "index" in PROGMEM, or null if out of range. */
+    const char* operator [] (uint8_t index) const;
+
+    /** Number of strings in the pool. */
+    uint8_t Count() const;
+
+private:
+    const char* m_pool; // PROGMEM pointer
+    uint16_t    m_size; // including final null-termination
+};
+
+/** Queue of INPUT reports for one HID device that are sent together by Flush().
+    The report payloads are copied, so they need not outlast the Add call. */
+class HIDReportBatch {
+public:
+    HIDReportBatch(HID_& hid) : m_hid(hid) {}
+
+    /** Queue a report. Returns false if there is no room left in the batch. */
+    bool Add(uint8_t id, const void* data, uint8_t len);
+
+    /** Send all queued reports through HID_::SendReport and empty the batch.
+        Returns the total number of bytes sent, or the first negative SendReport result. */
+    int Flush();
+
+private:
+    HID_&   m_hid;
+    uint8_t m_buf[HID_REPORT_BATCH_SIZE]; // sequence of [length, report ID, payload] entries
+    uint8_t m_size = 0;
 };
 
 #define D_HIDREPORT(length) { 9, 0x21, 0x01, 0x01, 0, 1, 0x22, lowByte(length), highByte(length) }
@@ -1,143 +1,27 @@
 #include "HIDPowerDevice.h"
 
-// HID report descriptor
-static const uint8_t s_hidReportDescriptor[] PROGMEM = {
-
-    0x05, 0x84, // USAGE_PAGE (Power Device)
-    0x09, 0x04, // USAGE (UPS)
-    0xA1, 0x01, // COLLECTION (Application)
-    0x09, 0x24, //   USAGE (Sink)
-    0xA1, 0x02, //   COLLECTION (Logical)
-    0x75, 0x08, //     REPORT_SIZE (8)
-    0x95, 0x01, //     REPORT_COUNT (1)
-    0x15, 0x00, //     LOGICAL_MINIMUM (0)
-    0x26, 0xFF, 0x00, //     LOGICAL_MAXIMUM (255)
-    0x85, HID_PD_IPRODUCT, //     REPORT_ID (1)
-    0x09, 0xFE, //     USAGE (iProduct)
-    0xB1, 0x23, //     FEATURE (Constant, Variable, Absolute, No Wrap, Linear, No Preferred, No Null Position, Nonvolatile, Bitfield)
-
-    0x85, HID_PD_SERIAL, //     REPORT_ID (2)
-    0x09, 0xFF, //     USAGE (iSerialNumber)
-    0xB1, 0x23, //     FEATURE (Constant, Variable, Absolute, No Wrap, Linear, No Preferred, No Null Position, Nonvolatile, Bitfield)
-
-    0x85, HID_PD_MANUFACTURER, //     REPORT_ID (3)
-    0x09, 0xFD, //     USAGE (iManufacturer)
-    0xB1, 0x23, //     FEATURE (Constant, Variable, Absolute, No Wrap, Linear, No Preferred, No Null Position, Nonvolatile, Bitfield)
-
-    0x05, 0x85, //     USAGE_PAGE (Battery System) ====================
-    0x85, HID_PD_IDEVICECHEMISTRY, //     REPORT_ID (4)
-    0x09, 0x89, //     USAGE (iDeviceChemistry)
-    0xB1, 0x23, //     FEATURE (Constant, Variable, Absolute, No Wrap, Linear, No Preferred, No Null Position, Nonvolatile, Bitfield)
-
-    0x85, HID_PD_CAPACITYMODE, //     REPORT_ID (22)
-    0x09, 0x2C, //     USAGE (CapacityMode)
-    0xB1, 0x23, //     FEATURE (Constant, Variable, Absolute, No Wrap, Linear, No Preferred, No Null Position, Nonvolatile, Bitfield)
-
-    0x85, HID_PD_FULLCHRGECAPACITY, //     REPORT_ID (14)
-    0x09, 0x67, //     USAGE (FullChargeCapacity)
-    0x75, 0x10, //     REPORT_SIZE (16)
-    0x95, 0x01, //     REPORT_COUNT (1)
-    0x67, 0x01, 0x10, 0x10, 0x00, //     UNIT (AmpSec)
-    0x55, 0x00, //     UNIT_EXPONENT (0)
-    0xB1, 0x83, //     FEATURE (Constant, Variable, Absolute, No Wrap, Linear, No Preferred, No Null Position, Volatile, Bitfield)
-
-    0x85, HID_PD_DESIGNCAPACITY, //     REPORT_ID (15)
-    0x09, 0x83, //     USAGE (DesignCapacity)
-    0xB1, 0x83, //     FEATURE (Constant, Variable, Absolute, No Wrap, Linear, No Preferred, No Null Position, Volatile, Bitfield)
-
-    0x85, HID_PD_REMAININGCAPACITY, //     REPORT_ID (12)
-    0x09, 0x66, //     USAGE (RemainingCapacity)
-    0x81, 0xA3, //     INPUT (Constant, Variable, Absolute, No Wrap, Linear, No Preferred, No Null Position, Bitfield)
-    0x09, 0x66, //     USAGE (RemainingCapacity)
-    0xB1, 0xA3, //     FEATURE (Constant, Variable, Absolute, No Wrap, Linear, No Preferred, No Null Position, Volatile, Bitfield)
-
-    0x85, HID_PD_REMNCAPACITYLIMIT, //     REPORT_ID (16)
-    0x09, 0x29, //     USAGE (RemainingCapacityLimit)
-    0xB1, 0xA2, //     FEATURE (Data, Variable, Absolute, No Wrap, Linear, No Preferred, No Null Position, Volatile, Bitfield)
-
-    0x85, HID_PD_WARNCAPACITYLIMIT, //     REPORT_ID (17)
-    0x09, 0x8C, //     USAGE (WarningCapacityLimit)
-    0xB1, 0xA2, //     FEATURE (Data, Variable, Absolute, No Wrap, Linear, No Preferred, No Null Position, Volatile, Bitfield)
-
-    0x85, HID_PD_MANUFACTUREDATE, //     REPORT_ID (9)
-    0x09, 0x85, //     USAGE (ManufacturerDate)
-    0x75, 0x10, //     REPORT_SIZE (16)
-    0x27, 0xFF, 0xFF, 0x00, 0x00, //     LOGICAL_MAXIMUM (65534)
-    0xB1, 0xA3, //     FEATURE (Constant, Variable, Absolute, No Wrap, Linear, No Preferred, No Null Position, Volatile, Bitfield)
-
-    0x85, HID_PD_RUNTIMETOEMPTY, //     REPORT_ID (13)
-    0x09, 0x68, //     USAGE (RunTimeToEmpty)
-    0x81, 0xA3, //     INPUT (Constant, Variable, Absolute, No Wrap, Linear, No Preferred, No Null Position, Bitfield)
-    0x09, 0x68, //     USAGE (RunTimeToEmpty)
-    0xB1, 0xA3, //     FEATURE (Constant, Variable, Absolute, No Wrap, Linear, No Preferred, No Null Position, Volatile, Bitfield)
-
-    0x85, HID_PD_CYCLE_COUNT, //     REPORT_ID (20)
-    0x09, 0x6B, //     USAGE (CycleCount)
-    0x75, 0x10, //     REPORT_SIZE (16)
-    0x15, 0x00, //     LOGICAL_MINIMUM (0)
-    0x27, 0xFF, 0xFF, 0x00, 0x00, //     LOGICAL_MAXIMUM (65534)
-    0x81, 0x22, //     INPUT (Data, Variable, Absolute, No Wrap, Linear, No Preferred, No Null Position, Bitfield)
-    0x09, 0x6B, //     USAGE (CycleCount)
-    0xB1, 0xA2, //     FEATURE (Data, Variable, Absolute, No Wrap, Linear, No Preferred, No Null Position, Volatile, Bitfield)
-
-    0x05, 0x84, //     USAGE_PAGE (Power Device) ====================
-    0x85, HID_PD_TEMPERATURE, //     REPORT_ID (10)
-    0x09, 0x36, //     USAGE (Temperature)
-    0x75, 0x10, //     REPORT_SIZE (16)
-    0x67, 0x01, 0x00, 0x01, 0x00, //     UNIT (Kelvin)
-    0x55, 0x00, //     UNIT_EXPONENT (0)
-    0x81, 0xA3, //     INPUT (Constant, Variable, Absolute, No Wrap, Linear, No Preferred, No Null Position, Bitfield)
-    0x09, 0x36, //     USAGE (Temperature)
-    0xB1, 0xA3, //     FEATURE (Constant, Variable, Absolute, No Wrap, Linear, No Preferred, No Null Position, Volatile, Bitfield)
-
-    0x85, HID_PD_VOLTAGE, //     REPORT_ID (11)
-    0x09, 0x30, //     USAGE (Voltage)
-    0x15, 0x00, //     LOGICAL_MINIMUM (0)
-    0x27, 0xFF, 0xFF, 0x00, 0x00, //     LOGICAL_MAXIMUM (65535)
-    0x67, 0x21, 0xD1, 0xF0, 0x00, //     UNIT (Centivolts)
-    0x55, 0x05, //     UNIT_EXPONENT (5)
-    0x81, 0xA3, //     INPUT (Constant, Variable, Absolute, No Wrap, Linear, No Preferred, No Null Position, Bitfield)
-    0x09, 0x30, //     USAGE (Voltage)
-    0xB1, 0xA3, //     FEATURE (Constant, Variable, Absolute, No Wrap, Linear, No Preferred, No Null Position, Volatile, Bitfield)
-
-    0x09, 0x02, //     USAGE (PresentStatus)
-    0xA1, 0x02, //     COLLECTION (Logical)
-    0x85, HID_PD_PRESENTSTATUS, //       REPORT_ID (7)
-    0x05, 0x85, //       USAGE_PAGE (Battery System) =================
-    0x09, 0x44, //       USAGE (Charging)
-    0x75, 0x01, //       REPORT_SIZE (1)
-    0x15, 0x00, //       LOGICAL_MINIMUM (0)
-    0x25, 0x01, //       LOGICAL_MAXIMUM (1)
-    0x81, 0xA3, //       INPUT (Constant, Variable, Absolute, No Wrap, Linear, No Preferred, No Null Position, Bitfield)
-    0x09, 0x44, //       USAGE (Charging)
-    0xB1, 0xA3, //       FEATURE (Constant, Variable, Absolute, No Wrap, Linear, No Preferred, No Null Position, Volatile, Bitfield)
-    0x09, 0x45, //       USAGE (Discharging)
-    0x81, 0xA3, //       INPUT (Constant, Variable, Absolute, No Wrap, Linear, No Preferred, No Null Position, Bitfield)
-    0x09, 0x45, //       USAGE (Discharging)
-    0xB1, 0xA3, //       FEATURE (Constant, Variable, Absolute, No Wrap, Linear, No Preferred, No Null Position, Volatile, Bitfield)
-    0x09, 0xD0, //       USAGE (ACPresent)
-    0x81, 0xA3, //       INPUT (Constant, Variable, Absolute, No Wrap, Linear, No Preferred, No Null Position, Bitfield)
-    0x09, 0xD0, //       USAGE (ACPresent)
-    0xB1, 0xA3, //       FEATURE (Constant, Variable, Absolute, No Wrap, Linear, No Preferred, No Null Position, Volatile, Bitfield)
-    0x05, 0x84, //       USAGE_PAGE (Power Device) =================
-    0x09, 0x69, //       USAGE (ShutdownImminent)
-    0x81, 0xA3, //       INPUT (Constant, Variable, Absolute, No Wrap, Linear, No Preferred, No Null Position, Bitfield)
-    0x09, 0x69, //       USAGE (ShutdownImminent)
-    0xB1, 0xA3, //       FEATURE (Constant, Variable, Absolute, No Wrap, Linear, No Preferred, No Null Position, Volatile, Bitfield)
-    0x95, 0x04, //       REPORT_COUNT (4) // padding bits to make the report byte aligned
-    0x81, 0x01, //       INPUT (Constant, Array, Absolute)
-    0xB1, 0x01, //       FEATURE (Constant, Array, Absolute, No Wrap, Linear, Preferred State, No Null Position, Nonvolatile, Bitfield)
-    0xC0,       //     END_COLLECTION
-    0xC0,       //   END_COLLECTION
-    0xC0        // END_COLLECTION
-};
+static_assert(HIDRedundantGlobals(s_hidReportDescriptor, sizeof(s_hidReportDescriptor)) == 0, "report descriptor contains redundant global items");
+
+/** Check that INPUT reports have the same size as the FEATURE report they share storage with, and that all reports fit in HID_. */
+static constexpr bool ValidReportSizes(uint16_t id = 0) {
+    return (id > 0xFF) ||
+        ((!HIDPowerDevice_::InputLength(id) || (HIDPowerDevice_::InputLength(id) == HIDPowerDevice_::FeatureLength(id)))
+         && (!HIDPowerDevice_::FeatureLength(id) || (id < HID_REPORT_ID_COUNT))
+         && ((id == HID_PD_STATS) ? (HIDPowerDevice_::FeatureLength(id) == sizeof(HIDStats)) : (HIDPowerDevice_::FeatureLength(id) <= HID_MAX_REPORT_LENGTH))
+         && (HIDPowerDevice_::InputLength(id) <= HID_MAX_INPUT_LENGTH)
+         && ValidReportSizes(id + 1));
+}
+static_assert(ValidReportSizes(), "report descriptor does not match HID_ report storage");
+static_assert(HIDPowerDevice_::InputReportCount() <= HID_MAX_INPUT_REPORTS, "report descriptor has more INPUT reports than HID_MAX_INPUT_REPORTS");
+static_assert(HIDPowerDevice_::FeatureReportCount() - 1 <= HID_MAX_FEATURE_REPORTS, "report descriptor has more FEATURE reports than HID_MAX_FEATURE_REPORTS"); // HID_PD_STATS is served separately
 
-const byte HIDPowerDevice_::s_productIdx = IPRODUCT;
+const byte HIDPowerDevice_::s_productIdx PROGMEM = IPRODUCT;
 
-HIDPowerDevice_::HIDPowerDevice_() {
+HIDPowerDevice_::HIDPowerDevice_(HIDPowerDevice_* primary) : HID_(primary) {
     SetDescriptor(s_hidReportDescriptor, sizeof (s_hidReportDescriptor));
 
-    SetFeature(HID_PD_IPRODUCT, &s_productIdx, sizeof(s_productIdx)); // automatically populated with "Arduino Micro"
+    SetFeature_P<HID_PD_IPRODUCT>(s_productIdx); // automatically populated with "Arduino Micro"
+    SetStatsReport(HID_PD_STATS);
 }
 
 void HIDPowerDevice_::SetStringFeature(uint8_t id, const uint8_t* index, const char* data) {
@@ -146,3 +30,8 @@ void HIDPowerDevice_::SetStringFeature(uint8_t id, const uint8_t* index, const c
     // set string at given index
     SetString(*index , data);
 }
+
+void HIDPowerDevice_::SetStringFeature_P(uint8_t id, const uint8_t* index_P, const char* data) {
+    SetFeature(id, index_P, 1, true);
+    SetString(pgm_read_byte(index_P), data);
+}
@@ -18,6 +18,7 @@
 #define HID_PD_REMNCAPACITYLIMIT     0x10 // 16 FEATURE ONLY (maps to DefaultAlert1 on Windows)
 #define HID_PD_WARNCAPACITYLIMIT     0x11 // 17 FEATURE ONLY (maps to DefaultAlert2 on Windows)
 #define HID_PD_CYCLE_COUNT           0x14 // 20 INPUT OR FEATURE
+#define HID_PD_STATS                 0x15 // 21 FEATURE ONLY (vendor-defined USB performance counters, see HIDStats)
 #define HID_PD_CAPACITYMODE          0x16 // 22 FEATURE ONLY
 
 // PresentStatus dynamic flags
@@ -38,16 +39,231 @@ struct PresentStatus {
 static_assert(sizeof(PresentStatus) == sizeof(uint8_t));
 
 
+// HID report descriptor
+static constexpr uint8_t s_hidReportDescriptor[] PROGMEM = {
+    0x05, 0x84, // USAGE_PAGE (Power Device)
+    0x09, 0x04, // USAGE (UPS)
+    0xA1, 0x01, // COLLECTION (Application)
+    0x09, 0x24, //   USAGE (Sink)
+    0xA1, 0x02, //   COLLECTION (Logical)
+    0x75, 0x08, //     REPORT_SIZE (8)
+    0x95, 0x01, //     REPORT_COUNT (1)
+    0x15, 0x00, //     LOGICAL_MINIMUM (0)
+    0x26, 0xFF, 0x00, //     LOGICAL_MAXIMUM (255)
+    0x85, HID_PD_IPRODUCT, //     REPORT_ID (1)
+    0x09, 0xFE, //     USAGE (iProduct)
+    0xB1, 0x23, //     FEATURE (Constant, Variable, Absolute, No Wrap, Linear, No Preferred, No Null Position, Nonvolatile, Bitfield)
+
+    0x85, HID_PD_SERIAL, //     REPORT_ID (2)
+    0x09, 0xFF, //     USAGE (iSerialNumber)
+    0xB1, 0x23, //     FEATURE (Constant, Variable, Absolute, No Wrap, Linear, No Preferred, No Null Position, Nonvolatile, Bitfield)
+
+    0x85, HID_PD_MANUFACTURER, //     REPORT_ID (3)
+    0x09, 0xFD, //     USAGE (iManufacturer)
+    0xB1, 0x23, //     FEATURE (Constant, Variable, Absolute, No Wrap, Linear, No Preferred, No Null Position, Nonvolatile, Bitfield)
+
+    0x05, 0x85, //     USAGE_PAGE (Battery System) ====================
+    0x85, HID_PD_IDEVICECHEMISTRY, //     REPORT_ID (4)
+    0x09, 0x89, //     USAGE (iDeviceChemistry)
+    0xB1, 0x23, //     FEATURE (Constant, Variable, Absolute, No Wrap, Linear, No Preferred, No Null Position, Nonvolatile, Bitfield)
+
+    0x85, HID_PD_CAPACITYMODE, //     REPORT_ID (22)
+    0x09, 0x2C, //     USAGE (CapacityMode)
+    0xB1, 0x23, //     FEATURE (Constant, Variable, Absolute, No Wrap, Linear, No Preferred, No Null Position, Nonvolatile, Bitfield)
+
+    0x85, HID_PD_FULLCHRGECAPACITY, //     REPORT_ID (14)
+    0x09, 0x67, //     USAGE (FullChargeCapacity)
+    0x75, 0x10, //     REPORT_SIZE (16)
+    0x67, 0x01, 0x10, 0x10, 0x00, //     UNIT (AmpSec)
+    0x55, 0x00, //     UNIT_EXPONENT (0)
+    0xB1, 0x83, //     FEATURE (Constant, Variable, Absolute, No Wrap, Linear, No Preferred, No Null Position, Volatile, Bitfield)
+
+    0x85, HID_PD_DESIGNCAPACITY, //     REPORT_ID (15)
+    0x09, 0x83, //     USAGE (DesignCapacity)
+    0xB1, 0x83, //     FEATURE (Constant, Variable, Absolute, No Wrap, Linear, No Preferred, No Null Position, Volatile, Bitfield)
+
+    0x85, HID_PD_REMAININGCAPACITY, //     REPORT_ID (12)
+    0x09, 0x66, //     USAGE (RemainingCapacity)
+    0x81, 0xA3, //     INPUT (Constant, Variable, Absolute, No Wrap, Linear, No Preferred, No Null Position, Bitfield)
+    0x09, 0x66, //     USAGE (RemainingCapacity)
+    0xB1, 0xA3, //     FEATURE (Constant, Variable, Absolute, No Wrap, Linear, No Preferred, No Null Position, Volatile, Bitfield)
+
+    0x85, HID_PD_REMNCAPACITYLIMIT, //     REPORT_ID (16)
+    0x09, 0x29, //     USAGE (RemainingCapacityLimit)
+    0xB1, 0xA2, //     FEATURE (Data, Variable, Absolute, No Wrap, Linear, No Preferred, No Null Position, Volatile, Bitfield)
+
+    0x85, HID_PD_WARNCAPACITYLIMIT, //     REPORT_ID (17)
+    0x09, 0x8C, //     USAGE (WarningCapacityLimit)
+    0xB1, 0xA2, //     FEATURE (Data, Variable, Absolute, No Wrap, Linear, No Preferred, No Null Position, Volatile, Bitfield)
+
+    0x85, HID_PD_MANUFACTUREDATE, //     REPORT_ID (9)
+    0x09, 0x85, //     USAGE (ManufacturerDate)
+    0x27, 0xFF, 0xFF, 0x00, 0x00, //     LOGICAL_MAXIMUM (65534)
+    0xB1, 0xA3, //     FEATURE (Constant, Variable, Absolute, No Wrap, Linear, No Preferred, No Null Position, Volatile, Bitfield)
+
+    0x85, HID_PD_RUNTIMETOEMPTY, //     REPORT_ID (13)
+    0x09, 0x68, //     USAGE (RunTimeToEmpty)
+    0x81, 0xA3, //     INPUT (Constant, Variable, Absolute, No Wrap, Linear, No Preferred, No Null Position, Bitfield)
+    0x09, 0x68, //     USAGE (RunTimeToEmpty)
+    0xB1, 0xA3, //     FEATURE (Constant, Variable, Absolute, No Wrap, Linear, No Preferred, No Null Position, Volatile, Bitfield)
+
+    0x85, HID_PD_CYCLE_COUNT, //     REPORT_ID (20)
+    0x09, 0x6B, //     USAGE (CycleCount)
+    0x81, 0x22, //     INPUT (Data, Variable, Absolute, No Wrap, Linear, No Preferred, No Null Position, Bitfield)
+    0x09, 0x6B, //     USAGE (CycleCount)
+    0xB1, 0xA2, //     FEATURE (Data, Variable, Absolute, No Wrap, Linear, No Preferred, No Null Position, Volatile, Bitfield)
+
+    0x05, 0x84, //     USAGE_PAGE (Power Device) ====================
+    0x85, HID_PD_TEMPERATURE, //     REPORT_ID (10)
+    0x09, 0x36, //     USAGE (Temperature)
+    0x67, 0x01, 0x00, 0x01, 0x00, //     UNIT (Kelvin)
+    0x81, 0xA3, //     INPUT (Constant, Variable, Absolute, No Wrap, Linear, No Preferred, No Null Position, Bitfield)
+    0x09, 0x36, //     USAGE (Temperature)
+    0xB1, 0xA3, //     FEATURE (Constant, Variable, Absolute, No Wrap, Linear, No Preferred, No Null Position, Volatile, Bitfield)
+
+    0x85, HID_PD_VOLTAGE, //     REPORT_ID (11)
+    0x09, 0x30, //     USAGE (Voltage)
+    0x67, 0x21, 0xD1, 0xF0, 0x00, //     UNIT (Centivolts)
+    0x55, 0x05, //     UNIT_EXPONENT (5)
+    0x81, 0xA3, //     INPUT (Constant, Variable, Absolute, No Wrap, Linear, No Preferred, No Null Position, Bitfield)
+    0x09, 0x30, //     USAGE (Voltage)
+    0xB1, 0xA3, //     FEATURE (Constant, Variable, Absolute, No Wrap, Linear, No Preferred, No Null Position, Volatile, Bitfield)
+
+    0x09, 0x02, //     USAGE (PresentStatus)
+    0xA1, 0x02, //     COLLECTION (Logical)
+    0x85, HID_PD_PRESENTSTATUS, //       REPORT_ID (7)
+    0x05, 0x85, //       USAGE_PAGE (Battery System) =================
+    0x09, 0x44, //       USAGE (Charging)
+    0x75, 0x01, //       REPORT_SIZE (1)
+    0x25, 0x01, //       LOGICAL_MAXIMUM (1)
+    0x81, 0xA3, //       INPUT (Constant, Variable, Absolute, No Wrap, Linear, No Preferred, No Null Position, Bitfield)
+    0x09, 0x44, //       USAGE (Charging)
+    0xB1, 0xA3, //       FEATURE (Constant, Variable, Absolute, No Wrap, Linear, No Preferred, No Null Position, Volatile, Bitfield)
+    0x09, 0x45, //       USAGE (Discharging)
+    0x81, 0xA3, //       INPUT (Constant, Variable, Absolute, No Wrap, Linear, No Preferred, No Null Position, Bitfield)
+    0x09, 0x45, //       USAGE (Discharging)
+    0xB1, 0xA3, //       FEATURE (Constant, Variable, Absolute, No Wrap, Linear, No Preferred, No Null Position, Volatile, Bitfield)
+    0x09, 0xD0, //       USAGE (ACPresent)
+    0x81, 0xA3, //       INPUT (Constant, Variable, Absolute, No Wrap, Linear, No Preferred, No Null Position, Bitfield)
+    0x09, 0xD0, //       USAGE (ACPresent)
+    0xB1, 0xA3, //       FEATURE (Constant, Variable, Absolute, No Wrap, Linear, No Preferred, No Null Position, Volatile, Bitfield)
+    0x05, 0x84, //       USAGE_PAGE (Power Device) =================
+    0x09, 0x69, //       USAGE (ShutdownImminent)
+    0x81, 0xA3, //       INPUT (Constant, Variable, Absolute, No Wrap, Linear, No Preferred, No Null Position, Bitfield)
+    0x09, 0x69, //       USAGE (ShutdownImminent)
+    0xB1, 0xA3, //       FEATURE (Constant, Variable, Absolute, No Wrap, Linear, No Preferred, No Null Position, Volatile, Bitfield)
+    0x95, 0x04, //       REPORT_COUNT (4) // padding bits to make the report byte aligned
+    0x81, 0x01, //       INPUT (Constant, Array, Absolute)
+    0xB1, 0x01, //       FEATURE (Constant, Array, Absolute, No Wrap, Linear, Preferred State, No Null Position, Nonvolatile, Bitfield)
+    0xC0,       //     END_COLLECTION
+    0xC0,       //   END_COLLECTION
+
+    0x06, 0x00, 0xFF, //   USAGE_PAGE (Vendor Defined) ====================
+    0x85, HID_PD_STATS, //   REPORT_ID (21)
+    0x09, 0x01, //   USAGE (Vendor Usage 1)
+    0x75, 0x08, //   REPORT_SIZE (8)
+    0x95, 0x05, //   REPORT_COUNT (5)
+    0x26, 0xFF, 0x00, //   LOGICAL_MAXIMUM (255)
+    0x65, 0x00, //   UNIT (None)
+    0x55, 0x00, //   UNIT_EXPONENT (0)
+    0xB1, 0x03, //   FEATURE (Constant, Variable, Absolute)
+    0x09, 0x02, //   USAGE (Vendor Usage 2) // lastSendError
+    0x95, 0x01, //   REPORT_COUNT (1)
+    0x15, 0x80, //   LOGICAL_MINIMUM (-128)
+    0x25, 0x7F, //   LOGICAL_MAXIMUM (127)
+    0xB1, 0x03, //   FEATURE (Constant, Variable, Absolute)
+    0x09, 0x03, //   USAGE (Vendor Usage 3)
+    0x75, 0x10, //   REPORT_SIZE (16)
+    0x95, 0x04, //   REPORT_COUNT (4)
+    0x15, 0x00, //   LOGICAL_MINIMUM (0)
+    0x27, 0xFF, 0xFF, 0x00, 0x00, //   LOGICAL_MAXIMUM (65535)
+    0xB1, 0x03, //   FEATURE (Constant, Variable, Absolute)
+    0xC0        // END_COLLECTION
+};
+
+
 class HIDPowerDevice_ : public HID_ {
 public:
-  HIDPowerDevice_();
+  /** Use a separate USB interface if "primary" is null. Otherwise, add this battery as collection to the USB interface of "primary". */
+  HIDPowerDevice_(HIDPowerDevice_* primary = nullptr);
+
+  /** FEATURE report payload length [bytes] as defined by the report descriptor (0 if undefined). */
+  static constexpr uint8_t FeatureLength(uint8_t id) {
+    return HIDReportLength(s_hidReportDescriptor, sizeof(s_hidReportDescriptor), HID_ITEM_FEATURE, id);
+  }
+
+  /** INPUT report payload length [bytes] as defined by the report descriptor (0 if undefined). */
+  static constexpr uint8_t InputLength(uint8_t id) {
+    return HIDReportLength(s_hidReportDescriptor, sizeof(s_hidReportDescriptor), HID_ITEM_INPUT, id);
+  }
+
+  /** Number of report IDs with an INPUT report in the report descriptor. */
+  static constexpr uint8_t InputReportCount(uint16_t id = 0) {
+    return (id > 0xFF) ? 0 : (InputLength(id) ? 1 : 0) + InputReportCount(id + 1);
+  }
+
+  /** Number of report IDs with a FEATURE report in the report descriptor. */
+  static constexpr uint8_t FeatureReportCount(uint16_t id = 0) {
+    return (id > 0xFF) ? 0 : (FeatureLength(id) ? 1 : 0) + FeatureReportCount(id + 1);
+  }
+
+  /** RAM [bytes] used by the HID stack for "batteries" power devices. */
+  static constexpr size_t RamUsage(uint8_t batteries) {
+    return batteries*sizeof(HIDPowerDevice_) + SharedRam();
+  }
+
+  using HID_::SetFeature;
+
+  /** Compile-time checked SetFeature variant that rejects storage with different size than the report descriptor.
+      The "data" reference need to outlast this object. */
+  template <uint8_t ID, class T>
+  bool SetFeature(const T& data) {
+    static_assert(sizeof(T) == FeatureLength(ID), "storage size does not match report descriptor");
+    return HID_::SetFeature(ID, &data, sizeof(T));
+  }
+
+  /** SetFeature variant for constant PROGMEM storage that is served directly from flash. */
+  template <uint8_t ID, class T>
+  bool SetFeature_P(const T& data_P) {
+    static_assert(sizeof(T) == FeatureLength(ID), "storage size does not match report descriptor");
+    return HID_::SetFeature(ID, &data_P, sizeof(T), true);
+  }
   
   /** The "index" & "data" pointers need to outlast this object. */ 
   void SetStringFeature(uint8_t id, const uint8_t* index, const char* data);
+
+  /** SetStringFeature variant where "index_P" points to a constant string index in PROGMEM. */
+  void SetStringFeature_P(uint8_t id, const uint8_t* index_P, const char* data);
   
 private:
   static const byte s_productIdx;
 };
 
+// max number of batteries that can share a single USB interface (limited by the report ID range)
+#define MAX_SHARED_BATTERIES (0x100/HID_REPORT_ID_COUNT)
+
+template <uint8_t... I> struct HIDIndices {};
+template <uint8_t N, uint8_t... I> struct HIDMakeIndices : HIDMakeIndices<N - 1, N - 1, I...> {};
+template <uint8_t... I> struct HIDMakeIndices<0, I...> { typedef HIDIndices<I...> type; };
+
+/** "N" batteries that share a single USB interface & endpoint. The first battery owns the interface, whereas the others are added as collections to it.
+    Converts to a HIDPowerDevice_ array, so it can be indexed & passed like one. */
+template <uint8_t N>
+class HIDPowerDeviceGroup {
+  static_assert((N > 0) && (N <= MAX_SHARED_BATTERIES), "too many batteries for the report ID range of a shared interface");
+public:
+  HIDPowerDeviceGroup() : HIDPowerDeviceGroup(typename HIDMakeIndices<N>::type()) {}
+
+  operator HIDPowerDevice_* () {
+    return m_devices;
+  }
+
+private:
+  template <uint8_t... I>
+  HIDPowerDeviceGroup(HIDIndices<I...>) : m_devices{(I ? &m_devices[0] : nullptr)...} {}
+
+  HIDPowerDevice_ m_devices[N];
+};
+
 // max number of batteries supported by the HW
 #define MAX_BATTERIES (USB_ENDPOINTS - CDC_FIRST_ENDPOINT - CDC_ENPOINT_COUNT) // 3 by default; 6 if defining CDC_DISABLED in %LOCALAPPDATA%\Arduino15\packages\arduino\hardware\avr\<version>\cores\arduino\USBDesc.h
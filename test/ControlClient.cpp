@@ -0,0 +1,128 @@
+#include "ControlClient.h"
+#include <chrono>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+int ControlClient::Open(const char* device) {
+    int fd = open(device, O_RDWR | O_NOCTTY);
+    if (fd < 0)
+        return -1;
+
+    termios tio = {};
+    if (tcgetattr(fd, &tio) < 0) {
+        close(fd);
+        return -1;
+    }
+    cfmakeraw(&tio);
+    cfsetspeed(&tio, B57600); // ignored by USB CDC, but matches the sketch
+    if (tcsetattr(fd, TCSANOW, &tio) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int ControlClient::Set(const std::vector<Update>& updates) {
+    std::vector<uint8_t> payload(1, CTRL_CMD_SET);
+    for (const Update& update : updates) {
+        payload.push_back(update.battery);
+        payload.push_back(update.field);
+        payload.push_back((uint8_t)update.value.size());
+        payload.insert(payload.end(), update.value.begin(), update.value.end());
+    }
+
+    std::vector<uint8_t> response;
+    if (!Transact(payload, response) || (response.size() != 2) || (response[0] != (CTRL_CMD_SET | CTRL_RESPONSE)))
+        return -1;
+    return response[1];
+}
+
+int ControlClient::Set(uint8_t battery, uint8_t field, uint16_t value) {
+    return Set({Update{battery, field, {lowByte(value), highByte(value)}}});
+}
+
+int ControlClient::Get(uint8_t battery, uint8_t field, std::vector<uint8_t>& value) {
+    std::vector<uint8_t> response;
+    if (!Transact({CTRL_CMD_GET, battery, field}, response) || (response.size() < 5) || (response[0] != (CTRL_CMD_GET | CTRL_RESPONSE)))
+        return -1;
+    if ((response[2] != battery) || (response[3] != field) || (response.size() != 5u + response[4]))
+        return -1;
+
+    value.assign(response.begin() + 5, response.end());
+    return response[1];
+}
+
+bool ControlClient::Transact(const std::vector<uint8_t>& payload, std::vector<uint8_t>& response) {
+    if (payload.empty() || (payload.size() > CTRL_MAX_PAYLOAD))
+        return false;
+
+    uint8_t len = (uint8_t)payload.size();
+    std::vector<uint8_t> frame = {CTRL_SYNC, len};
+    frame.insert(frame.end(), payload.begin(), payload.end());
+    frame.push_back(ControlCrc8(ControlCrc8(0, &len, 1), payload.data(), len));
+    if (!Write(frame))
+        return false;
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(m_timeoutMs);
+    for (;;) {
+        int remaining = (int)std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+        if (remaining < 0)
+            return false;
+
+        // hunt for the next frame, skipping text logging
+        int c = ReadByte(remaining);
+        if (c < 0)
+            return false;
+        if (c != CTRL_SYNC)
+            continue;
+
+        int respLen = ReadByte(m_timeoutMs);
+        if (respLen < 0)
+            return false;
+        if (!respLen || (respLen > CTRL_MAX_PAYLOAD))
+            continue;
+
+        response.resize(respLen);
+        bool complete = true;
+        for (uint8_t& b : response) {
+            int value = ReadByte(m_timeoutMs);
+            if (value < 0) {
+                complete = false;
+                break;
+            }
+            b = (uint8_t)value;
+        }
+        int crc = complete ? ReadByte(m_timeoutMs) : -1;
+        if (crc < 0)
+            return false;
+
+        uint8_t respLen8 = (uint8_t)respLen;
+        if (crc == ControlCrc8(ControlCrc8(0, &respLen8, 1), response.data(), respLen8))
+            return true;
+        // corrupt frame, so keep hunting
+    }
+}
+
+bool ControlClient::Write(const std::vector<uint8_t>& data) {
+    size_t pos = 0;
+    while (pos < data.size()) {
+        ssize_t n = write(m_fd, data.data() + pos, data.size() - pos);
+        if (n < 0)
+            return false;
+        pos += n;
+    }
+    return true;
+}
+
+int ControlClient::ReadByte(int timeoutMs) {
+    pollfd pfd = {m_fd, POLLIN, 0};
+    if (poll(&pfd, 1, timeoutMs) <= 0)
+        return -1;
+
+    uint8_t c = 0;
+    if (read(m_fd, &c, 1) != 1)
+        return -1;
+    return c;
+}
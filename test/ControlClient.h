@@ -0,0 +1,40 @@
+#pragma once
+/* Host-side client for the BatteryControl serial protocol, for scripting battery values from Linux test rigs.
+   Works on any file descriptor of a serial port or pseudo-terminal, and skips the text logging that shares the port with the protocol. */
+#include <BatteryControl.h>
+#include <vector>
+
+class ControlClient {
+public:
+    /** Value update of a SET frame. "battery" may be CTRL_ALL_BATTERIES. */
+    struct Update {
+        uint8_t battery;
+        uint8_t field; // HID_PD_* report ID
+        std::vector<uint8_t> value; // raw little-endian report payload
+    };
+
+    /** Talk over "fd", which must already be configured for raw mode. "timeoutMs" limits the wait for each response. */
+    explicit ControlClient(int fd, int timeoutMs = 1000) : m_fd(fd), m_timeoutMs(timeoutMs) {}
+
+    /** Open a serial port, like "/dev/ttyACM0", in raw mode. Returns -1 on failure. */
+    static int Open(const char* device);
+
+    /** Apply all "updates" together. Returns the CTRL_* status of the response, or -1 on I/O error or timeout. */
+    int Set(const std::vector<Update>& updates);
+
+    /** Set a 16-bit field of one battery. */
+    int Set(uint8_t battery, uint8_t field, uint16_t value);
+
+    /** Read back a field. Returns the CTRL_* status of the response, or -1 on I/O error or timeout. */
+    int Get(uint8_t battery, uint8_t field, std::vector<uint8_t>& value);
+
+    /** Send a frame with "payload" and wait for the response payload, skipping unrelated bytes & corrupt frames. */
+    bool Transact(const std::vector<uint8_t>& payload, std::vector<uint8_t>& response);
+
+private:
+    bool Write(const std::vector<uint8_t>& data);
+    int ReadByte(int timeoutMs);
+
+    int m_fd;
+    int m_timeoutMs;
+};
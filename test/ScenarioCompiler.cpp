@@ -0,0 +1,91 @@
+#include "ScenarioCompiler.h"
+#include <stdio.h>
+#include <sstream>
+#include <BatteryScenario.h>
+
+namespace {
+
+/** Instruction with its opcode and argument value ranges. Arguments above 255 are encoded as little-endian words. */
+struct Instruction {
+    const char* name;
+    uint8_t     op;
+    uint8_t     argCount;
+    long        min[2];
+    long        max[2];
+};
+
+const Instruction INSTRUCTIONS[] = {
+    {"end",    SCN_OP_END,    0, {},        {}},
+    {"charge", SCN_OP_CHARGE, 2, {0, 0},    {100, 65535}},
+    {"temp",   SCN_OP_TEMP,   2, {0, 0},    {65535, 65535}},
+    {"ac",     SCN_OP_AC,     1, {0},       {1}},
+    {"wait",   SCN_OP_WAIT,   1, {0},       {65535}},
+    {"speed",  SCN_OP_SPEED,  1, {1},       {255}},
+    {"offset", SCN_OP_OFFSET, 2, {0, -100}, {SCENARIO_MAX_BATTERIES - 1, 100}},
+    {"loop",   SCN_OP_LOOP,   0, {},        {}},
+};
+
+bool Fail(std::string& error, int line, const std::string& reason) {
+    error = "line " + std::to_string(line) + ": " + reason;
+    return false;
+}
+
+} // namespace
+
+bool CompileScenario(std::istream& text, std::vector<uint8_t>& bytecode, std::string& error) {
+    std::string content;
+    for (int line = 1; std::getline(text, content); line++) {
+        content = content.substr(0, content.find('#'));
+        std::istringstream tokens(content);
+        std::string name;
+        if (!(tokens >> name))
+            continue; // blank or comment line
+
+        const Instruction* instr = nullptr;
+        for (const Instruction& candidate : INSTRUCTIONS) {
+            if (name == candidate.name)
+                instr = &candidate;
+        }
+        if (!instr)
+            return Fail(error, line, "unknown instruction \"" + name + "\"");
+
+        bytecode.push_back(instr->op);
+        for (uint8_t i = 0; i < instr->argCount; i++) {
+            std::string arg;
+            if (!(tokens >> arg))
+                return Fail(error, line, name + " expects " + std::to_string(instr->argCount) + " arguments");
+            size_t used = 0;
+            long value = 0;
+            try {
+                value = std::stol(arg, &used);
+            } catch (const std::exception&) {
+            }
+            if ((used == 0) || (used != arg.size()))
+                return Fail(error, line, "\"" + arg + "\" is not a number");
+            if ((value < instr->min[i]) || (value > instr->max[i]))
+                return Fail(error, line, arg + " is outside [" + std::to_string(instr->min[i]) + ", " + std::to_string(instr->max[i]) + "]");
+
+            bytecode.push_back((uint8_t)value);
+            if (instr->max[i] > 255)
+                bytecode.push_back((uint8_t)(value >> 8));
+        }
+        std::string extra;
+        if (tokens >> extra)
+            return Fail(error, line, "unexpected \"" + extra + "\"");
+    }
+    return true;
+}
+
+std::string FormatScenario(const std::vector<uint8_t>& bytecode, const std::string& name) {
+    std::string out = "const uint8_t " + name + "[] PROGMEM = {";
+    for (size_t i = 0; i < bytecode.size(); i++) {
+        char hex[8];
+        snprintf(hex, sizeof(hex), "0x%02X", bytecode[i]);
+        out += (i % 12 == 0) ? "\n  " : " ";
+        out += hex;
+        if (i + 1 < bytecode.size())
+            out += ",";
+    }
+    out += "\n};\n";
+    return out;
+}
@@ -0,0 +1,21 @@
+#pragma once
+/* Host-side compiler from the text form of a battery scenario to BatteryScenario bytecode.
+   One instruction per line, with arguments separated by whitespace and "#" starting a comment:
+     speed <factor>              fast-forward time by 1-255
+     offset <battery> <percent>  signed charge offset of one battery
+     ac <0|1>                    unplug or plug AC power
+     charge <percent> <sec>      ramp the charge level
+     temp <kelvin> <sec>         ramp the temperature
+     wait <sec>                  advance the timeline
+     loop                        restart from the beginning
+     end                         stop the scenario */
+#include <istream>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+/** Append the bytecode of "text" to "bytecode". Returns false on the first invalid line, with "error" set to "line <n>: <reason>". */
+bool CompileScenario(std::istream& text, std::vector<uint8_t>& bytecode, std::string& error);
+
+/** PROGMEM array definition of "bytecode" named "name", for pasting into a sketch. */
+std::string FormatScenario(const std::vector<uint8_t>& bytecode, const std::string& name);
@@ -0,0 +1,40 @@
+#pragma once
+/* The battery sketch on the host. Its globals are restarted like on a board reset, so that tests & benchmarks using it
+   are independent of each other and of their order. */
+#include <new>
+#include <ArduinoStub.h>
+#include <UsbStub.h>
+#include "../battery/battery.ino"
+
+/** Destroy and default-construct a global, like the startup code after a reset. */
+template <class T>
+void Reconstruct(T& obj) {
+    obj.~T();
+    new (&obj) T();
+}
+
+template <class T, size_t N>
+void Reconstruct(T (&array)[N]) {
+    for (T& obj : array)
+        Reconstruct(obj);
+}
+
+/** Restore the stubs & sketch globals to their power-on state, with no device plugged. Call setup() afterwards. */
+inline void ResetSketch() {
+    UsbStub::Reset(); // unplug before the devices are reconstructed
+    ArduinoStub::Reset();
+
+    Reconstruct(PowerDevice);
+    Reconstruct(Bank);
+#ifdef CDC_ENABLED
+    Control = BatteryControl(PowerDevice, NUM_BATTERIES);
+#endif
+#ifdef ENABLE_POTENTIOMETER
+    Reconstruct(Adc);
+    Reconstruct(PrevPotRemaining);
+#endif
+#ifdef ENABLE_SCENARIO
+    Reconstruct(Scenario);
+#endif
+    LastUpdate = 0;
+}
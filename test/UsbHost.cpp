@@ -0,0 +1,124 @@
+#include "UsbHost.h"
+#include <algorithm>
+#include <HID/HID.h>
+
+bool UsbHost::Enumerate() {
+    m_interfaces.clear();
+
+    // interface, HID & endpoint descriptors of all modules, as embedded in the configuration descriptor
+    uint8_t interfaceCount = 0;
+    UsbStub::ClearControl();
+    int len = PluggableUSB().getInterface(&interfaceCount);
+    std::vector<uint8_t> config;
+    UsbStub::TakeControlIn(config);
+    if ((len < 0) || ((size_t)len != config.size()))
+        return false;
+
+    for (size_t pos = 0; pos < config.size(); pos += config[pos]) {
+        const uint8_t* desc = &config[pos];
+        if ((desc[0] < 2) || (pos + desc[0] > config.size()))
+            return false; // truncated descriptor
+
+        if ((desc[1] == USB_INTERFACE_DESCRIPTOR_TYPE) && (desc[5] == USB_DEVICE_CLASS_HUMAN_INTERFACE)) {
+            m_interfaces.push_back(Interface());
+            m_interfaces.back().number = desc[2];
+        } else if (m_interfaces.empty()) {
+            return false; // class or endpoint descriptor outside an interface
+        } else if (desc[1] == HID_HID_DESCRIPTOR_TYPE) {
+            m_interfaces.back().reportDescLength = desc[7] | (desc[8] << 8);
+        } else if (desc[1] == USB_ENDPOINT_DESCRIPTOR_TYPE) {
+            m_interfaces.back().endpoint = desc[2] & 0x7F;
+            m_interfaces.back().interval = desc[6];
+        }
+    }
+    if (m_interfaces.size() != interfaceCount)
+        return false;
+
+    for (Interface& intf : m_interfaces) {
+        USBSetup setup = {REQUEST_DEVICETOHOST_STANDARD_INTERFACE, GET_DESCRIPTOR, 0, HID_REPORT_DESCRIPTOR_TYPE, intf.number, intf.reportDescLength};
+        if (!Control(setup, intf.reportDesc) || (intf.reportDesc.size() != intf.reportDescLength))
+            return false;
+    }
+    return true;
+}
+
+std::string UsbHost::GetString(uint8_t index) {
+    USBSetup setup = {REQUEST_DEVICETOHOST, GET_DESCRIPTOR, index, USB_STRING_DESCRIPTOR_TYPE, 0x0409, 0xFF};
+    std::vector<uint8_t> desc;
+    if (!Control(setup, desc) || (desc.size() < 2) || (desc[0] != desc.size()) || (desc[1] != USB_STRING_DESCRIPTOR_TYPE))
+        return std::string();
+
+    // UTF-16 to ASCII
+    std::string str;
+    for (size_t i = 2; i + 1 < desc.size(); i += 2)
+        str += (char)desc[i];
+    return str;
+}
+
+bool UsbHost::GetFeature(uint8_t interface, uint8_t id, std::vector<uint8_t>& report) {
+    USBSetup setup = {REQUEST_DEVICETOHOST_CLASS_INTERFACE, HID_GET_REPORT, id, HID_REPORT_TYPE_FEATURE, interface, USB_EP_SIZE};
+    return Control(setup, report);
+}
+
+bool UsbHost::SetFeature(uint8_t interface, uint8_t id, const std::vector<uint8_t>& payload) {
+    std::vector<uint8_t> report(1 + payload.size(), id);
+    std::copy(payload.begin(), payload.end(), report.begin() + 1);
+
+    USBSetup setup = {REQUEST_HOSTTODEVICE_CLASS_INTERFACE, HID_SET_REPORT, id, HID_REPORT_TYPE_FEATURE, interface, (uint16_t)report.size()};
+    return Control(setup, report);
+}
+
+bool UsbHost::SetIdle(uint8_t interface, uint8_t id, uint8_t duration) {
+    USBSetup setup = {REQUEST_HOSTTODEVICE_CLASS_INTERFACE, HID_SET_IDLE, id, duration, interface, 0};
+    std::vector<uint8_t> data;
+    return Control(setup, data);
+}
+
+bool UsbHost::GetIdle(uint8_t interface, uint8_t id, uint8_t& duration) {
+    USBSetup setup = {REQUEST_DEVICETOHOST_CLASS_INTERFACE, HID_GET_IDLE, id, 0, interface, 1};
+    std::vector<uint8_t> data;
+    if (!Control(setup, data) || (data.size() != 1))
+        return false;
+    duration = data[0];
+    return true;
+}
+
+std::vector<std::vector<uint8_t>> UsbHost::Poll(uint8_t interface) {
+    std::vector<std::vector<uint8_t>> reports;
+    const Interface* intf = Find(interface);
+    if (!intf)
+        return reports;
+
+    std::vector<uint8_t> packet;
+    while (UsbStub::Poll(intf->endpoint, packet))
+        reports.push_back(packet);
+    return reports;
+}
+
+bool UsbHost::Control(USBSetup setup, std::vector<uint8_t>& data) {
+    UsbStub::ClearControl();
+    if (!(setup.bmRequestType & REQUEST_DIRECTION))
+        UsbStub::SetControlOut(data);
+
+    // standard requests are handled by the core, which only forwards GET_DESCRIPTOR
+    bool handled;
+    if ((setup.bmRequestType & REQUEST_TYPE) == REQUEST_STANDARD)
+        handled = (setup.bRequest == GET_DESCRIPTOR) && (PluggableUSB().getDescriptor(setup) > 0);
+    else
+        handled = PluggableUSB().setup(setup);
+
+    if (setup.bmRequestType & REQUEST_DIRECTION) {
+        UsbStub::TakeControlIn(data);
+        if (data.size() > setup.wLength)
+            data.resize(setup.wLength); // the core truncates the data stage to the requested length
+    }
+    return handled;
+}
+
+const UsbHost::Interface* UsbHost::Find(uint8_t interface) const {
+    for (const Interface& intf : m_interfaces) {
+        if (intf.number == interface)
+            return &intf;
+    }
+    return nullptr;
+}
@@ -0,0 +1,53 @@
+#pragma once
+/* Scripted USB host that drives the plugged modules through the same PluggableUSB entry points as the USB core on the target,
+   so that enumeration, control requests and interrupt polling can be tested & benchmarked on Linux. */
+#include <UsbStub.h>
+#include <string>
+#include <vector>
+
+class UsbHost {
+public:
+    /** HID interface found during enumeration. */
+    struct Interface {
+        uint8_t number = 0;
+        uint8_t endpoint = 0;     // interrupt IN endpoint, without direction bit
+        uint8_t interval = 0;     // polling interval [ms]
+        uint16_t reportDescLength = 0; // as announced in the HID descriptor
+        std::vector<uint8_t> reportDesc;
+    };
+
+    /** Fetch the interface descriptors of all plugged modules like the core does for the configuration descriptor, followed by the
+        report descriptor of each HID interface. Returns false if a descriptor is malformed or has a different size than announced. */
+    bool Enumerate();
+
+    /** HID interfaces found by the last Enumerate() call. */
+    const std::vector<Interface>& Interfaces() const {
+        return m_interfaces;
+    }
+
+    /** String descriptor "index" converted back to ASCII, or an empty string if not served. */
+    std::string GetString(uint8_t index);
+
+    /** GET_REPORT of FEATURE report "id". "report" receives the report ID byte followed by the payload. */
+    bool GetFeature(uint8_t interface, uint8_t id, std::vector<uint8_t>& report);
+
+    /** SET_REPORT of FEATURE report "id" with "payload" (without the report ID byte). */
+    bool SetFeature(uint8_t interface, uint8_t id, const std::vector<uint8_t>& payload);
+
+    /** SET_IDLE with "duration" in 4 ms units (0 = indefinite). Report ID 0 applies to all reports. */
+    bool SetIdle(uint8_t interface, uint8_t id, uint8_t duration);
+
+    /** GET_IDLE, with "duration" in 4 ms units. */
+    bool GetIdle(uint8_t interface, uint8_t id, uint8_t& duration);
+
+    /** Read all INPUT reports waiting on the interrupt endpoint of "interface", which frees the endpoint for the next reports. */
+    std::vector<std::vector<uint8_t>> Poll(uint8_t interface);
+
+    /** Issue a control request. Data sent by the device is returned in "data" for IN requests, whereas "data" is sent to the device for OUT requests. */
+    bool Control(USBSetup setup, std::vector<uint8_t>& data);
+
+private:
+    const Interface* Find(uint8_t interface) const;
+
+    std::vector<Interface> m_interfaces;
+};
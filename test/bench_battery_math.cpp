@@ -0,0 +1,81 @@
+// Fixed-point battery arithmetic against the float expressions it replaced. On the host, float is done in hardware,
+// so these numbers only bound the integer cost. On AVR, the float variants additionally pull in the soft-float routines.
+#include <benchmark/benchmark.h>
+#include <cmath>
+#include <vector>
+#include <BatteryMath.h>
+
+/** Pseudo-random 16-bit inputs, so that the compiler cannot fold the conversions. */
+static std::vector<uint16_t> Inputs() {
+    std::vector<uint16_t> values(256);
+    uint32_t x = 12345;
+    for (uint16_t& v : values) {
+        x = x*1103515245 + 12345;
+        v = (uint16_t)(x >> 16);
+    }
+    return values;
+}
+
+static void BM_ScaleFixed(benchmark::State& state) {
+    const std::vector<uint16_t> values = Inputs();
+    const Ratio step = Ratio::FromPercent(2);
+    for (auto _ : state) {
+        for (uint16_t v : values)
+            benchmark::DoNotOptimize(step.Scale(v));
+    }
+    state.SetItemsProcessed(state.iterations()*values.size());
+}
+BENCHMARK(BM_ScaleFixed);
+
+static void BM_ScaleFloat(benchmark::State& state) {
+    const std::vector<uint16_t> values = Inputs();
+    volatile float percent = 2;
+    for (auto _ : state) {
+        for (uint16_t v : values)
+            benchmark::DoNotOptimize((uint16_t)(v*percent/100 + 0.5f));
+    }
+    state.SetItemsProcessed(state.iterations()*values.size());
+}
+BENCHMARK(BM_ScaleFloat);
+
+static void BM_AmpSecFromMilliWattHoursFixed(benchmark::State& state) {
+    const std::vector<uint16_t> values = Inputs();
+    for (auto _ : state) {
+        for (uint16_t v : values)
+            benchmark::DoNotOptimize(AmpSecFromMilliWattHours(v, 1499));
+    }
+    state.SetItemsProcessed(state.iterations()*values.size());
+}
+BENCHMARK(BM_AmpSecFromMilliWattHoursFixed);
+
+static void BM_AmpSecFromMilliWattHoursFloat(benchmark::State& state) {
+    const std::vector<uint16_t> values = Inputs();
+    volatile float volt = 14.99f;
+    for (auto _ : state) {
+        for (uint16_t v : values)
+            benchmark::DoNotOptimize((uint16_t)(v*3.6f/volt + 0.5f));
+    }
+    state.SetItemsProcessed(state.iterations()*values.size());
+}
+BENCHMARK(BM_AmpSecFromMilliWattHoursFloat);
+
+static void BM_RunTimeFixed(benchmark::State& state) {
+    const std::vector<uint16_t> values = Inputs();
+    for (auto _ : state) {
+        for (uint16_t v : values)
+            benchmark::DoNotOptimize(RunTime(v, 0xFFFF, 7200));
+    }
+    state.SetItemsProcessed(state.iterations()*values.size());
+}
+BENCHMARK(BM_RunTimeFixed);
+
+static void BM_RunTimeFloat(benchmark::State& state) {
+    const std::vector<uint16_t> values = Inputs();
+    volatile float full = 0xFFFF;
+    for (auto _ : state) {
+        for (uint16_t v : values)
+            benchmark::DoNotOptimize((uint16_t)(7200*(v/full) + 0.5f));
+    }
+    state.SetItemsProcessed(state.iterations()*values.size());
+}
+BENCHMARK(BM_RunTimeFloat);
@@ -0,0 +1,234 @@
+// HID stack benchmarks with recording disabled, so that only the library & stub costs are measured.
+// The absolute numbers are for the host CPU. Compare them between revisions rather than with the 16 MHz target.
+#include <benchmark/benchmark.h>
+#include <type_traits>
+#include <vector>
+#include <ArduinoStub.h>
+#include <BatteryBank.h>
+#include "UsbHost.h"
+
+/** "N" batteries on a shared interface, or on separate interfaces if "SHARED" is false. */
+template <uint8_t N, bool SHARED>
+struct Batteries {
+    typedef typename std::conditional<SHARED, HIDPowerDeviceGroup<N>, HIDPowerDevice_[N]>::type Devices;
+
+    static_assert(SHARED || (N <= MAX_BATTERIES), "not enough endpoints for separate interfaces");
+
+    Batteries() {
+        bank.Register(Array());
+        for (uint8_t i = 0; i < N; i++)
+            Array()[i].Publish();
+        host.Enumerate();
+        UsbStub::Record(false);
+    }
+
+    HIDPowerDevice_* Array() {
+        return devices;
+    }
+
+    Devices devices;
+    BatteryBank<N> bank;
+    UsbHost host;
+};
+
+/** Restart with no modules plugged. Called before constructing the devices of a benchmark. */
+static void Reset() {
+    UsbStub::Reset();
+    ArduinoStub::Reset();
+}
+
+// Feature lookup through the report table, as the number of batteries grows. Looks up every report ID on every battery,
+// like a host that reads all features after enumeration.
+template <uint8_t N>
+static void BM_FeatureLookup(benchmark::State& state) {
+    Reset();
+    Batteries<N, true> batteries;
+
+    for (auto _ : state) {
+        for (uint8_t i = 0; i < N; i++) {
+            const HID_& dev = batteries.Array()[i];
+            for (uint8_t id = 0; id < HID_REPORT_ID_COUNT; id++)
+                benchmark::DoNotOptimize(dev.GetFeature(id));
+        }
+    }
+    state.counters["lookups"] = benchmark::Counter(state.iterations()*N*HID_REPORT_ID_COUNT, benchmark::Counter::kIsRate);
+}
+BENCHMARK_TEMPLATE(BM_FeatureLookup, 1);
+BENCHMARK_TEMPLATE(BM_FeatureLookup, 2);
+BENCHMARK_TEMPLATE(BM_FeatureLookup, 4);
+BENCHMARK_TEMPLATE(BM_FeatureLookup, 8);
+BENCHMARK_TEMPLATE(BM_FeatureLookup, MAX_SHARED_BATTERIES);
+
+/** Per-device linked list of reports that the table replaced, as reference for BM_FeatureLookup. */
+struct ReportNode {
+    uint8_t id;
+    const HIDReport* report;
+    ReportNode* next;
+};
+
+template <uint8_t N>
+static void BM_FeatureLookupList(benchmark::State& state) {
+    Reset();
+    Batteries<N, true> batteries;
+
+    // same reports, in registration order
+    std::vector<ReportNode> nodes(N*HID_REPORT_ID_COUNT);
+    ReportNode* heads[N] = {};
+    for (uint8_t i = 0; i < N; i++) {
+        ReportNode* tail = nullptr;
+        for (uint8_t id = 0; id < HID_REPORT_ID_COUNT; id++) {
+            const HIDReport* report = batteries.Array()[i].GetFeature(id);
+            if (!report)
+                continue;
+            ReportNode* node = &nodes[i*HID_REPORT_ID_COUNT + id];
+            *node = ReportNode{id, report, nullptr};
+            (tail ? tail->next : heads[i]) = node;
+            tail = node;
+        }
+    }
+
+    for (auto _ : state) {
+        for (uint8_t i = 0; i < N; i++) {
+            for (uint8_t id = 0; id < HID_REPORT_ID_COUNT; id++) {
+                const ReportNode* node = heads[i];
+                while (node && (node->id != id))
+                    node = node->next;
+                benchmark::DoNotOptimize(node);
+            }
+        }
+    }
+    state.counters["lookups"] = benchmark::Counter(state.iterations()*N*HID_REPORT_ID_COUNT, benchmark::Counter::kIsRate);
+}
+BENCHMARK_TEMPLATE(BM_FeatureLookupList, 1);
+BENCHMARK_TEMPLATE(BM_FeatureLookupList, 8);
+
+// Cost and USB traffic of sending one INPUT report
+static void BM_SendReport(benchmark::State& state) {
+    Reset();
+    Batteries<1, false> batteries;
+    HIDPowerDevice_& dev = batteries.Array()[0];
+    uint8_t ep = PluggableUSB().endpoint(0);
+    UsbStub::ClearLog();
+
+    std::vector<uint8_t> packet;
+    uint16_t value = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(dev.SendReport(HID_PD_REMAININGCAPACITY, &value, sizeof(value)));
+        UsbStub::Poll(ep, packet);
+        value++;
+    }
+    state.counters["USB_Send/report"] = (double)UsbStub::Calls(UsbStub::Send)/state.iterations();
+    state.counters["bytes/report"] = (double)UsbStub::Bytes(UsbStub::Send)/state.iterations();
+}
+BENCHMARK(BM_SendReport);
+
+// Two INPUT reports queued in a HIDReportBatch and flushed together
+static void BM_ReportBatch(benchmark::State& state) {
+    Reset();
+    Batteries<1, false> batteries;
+    HIDReportBatch batch(batteries.Array()[0]);
+    uint8_t ep = PluggableUSB().endpoint(0);
+    UsbStub::SetBanks(2);
+    UsbStub::ClearLog();
+
+    std::vector<uint8_t> packet;
+    uint16_t value = 0;
+    uint8_t status = 0;
+    for (auto _ : state) {
+        batch.Add(HID_PD_REMAININGCAPACITY, &value, sizeof(value));
+        batch.Add(HID_PD_PRESENTSTATUS, &status, sizeof(status));
+        benchmark::DoNotOptimize(batch.Flush());
+        while (UsbStub::Poll(ep, packet)) {}
+        value++;
+    }
+    state.counters["USB_Send/batch"] = (double)UsbStub::Calls(UsbStub::Send)/state.iterations();
+}
+BENCHMARK(BM_ReportBatch);
+
+// GET_REPORT & SET_REPORT handling for the last battery, whose collection is found last on a shared interface
+template <uint8_t N>
+static void BM_GetReportRequest(benchmark::State& state) {
+    Reset();
+    Batteries<N, true> batteries;
+    uint8_t intf = batteries.host.Interfaces()[0].number;
+    uint8_t id = HID_PD_REMAININGCAPACITY + (N - 1)*HID_REPORT_ID_COUNT;
+    USBSetup setup = {REQUEST_DEVICETOHOST_CLASS_INTERFACE, HID_GET_REPORT, id, HID_REPORT_TYPE_FEATURE, intf, USB_EP_SIZE};
+
+    std::vector<uint8_t> data(USB_EP_SIZE);
+    for (auto _ : state)
+        benchmark::DoNotOptimize(batteries.host.Control(setup, data));
+    if (data.size() != 3)
+        state.SkipWithError("GET_REPORT failed");
+}
+BENCHMARK_TEMPLATE(BM_GetReportRequest, 1);
+BENCHMARK_TEMPLATE(BM_GetReportRequest, 8);
+
+template <uint8_t N>
+static void BM_SetReportRequest(benchmark::State& state) {
+    Reset();
+    Batteries<N, true> batteries;
+    HIDPowerDevice_& last = batteries.Array()[N - 1];
+    uint8_t intf = batteries.host.Interfaces()[0].number;
+    uint8_t id = HID_PD_REMNCAPACITYLIMIT + (N - 1)*HID_REPORT_ID_COUNT;
+    USBSetup setup = {REQUEST_HOSTTODEVICE_CLASS_INTERFACE, HID_SET_REPORT, id, HID_REPORT_TYPE_FEATURE, intf, 3};
+
+    std::vector<uint8_t> data = {id, 0, 0};
+    for (auto _ : state) {
+        data[1]++;
+        benchmark::DoNotOptimize(batteries.host.Control(setup, data));
+        last.PopSetReport();
+    }
+    if (last.Stats().setReportMiss)
+        state.SkipWithError("SET_REPORT failed");
+}
+BENCHMARK_TEMPLATE(BM_SetReportRequest, 1);
+BENCHMARK_TEMPLATE(BM_SetReportRequest, 8);
+
+// INPUT report throughput per endpoint as the number of batteries grows. Each iteration simulates 1 ms of loop() on all
+// batteries, with the host polling each endpoint at its interval. All INPUT values change every "changePeriod" ms (argument),
+// so a single endpoint saturates when enough batteries share it.
+template <uint8_t N, bool SHARED>
+static void BM_InputThroughput(benchmark::State& state) {
+    Reset();
+    Batteries<N, SHARED> batteries;
+    BatteryBank<N>& bank = batteries.bank;
+    const unsigned long changePeriod = state.range(0);
+
+    std::vector<uint8_t> packet;
+    size_t delivered = 0;
+    unsigned long elapsed = 0;
+    for (auto _ : state) {
+        ArduinoStub::Advance(1);
+        elapsed++;
+
+        if (elapsed % changePeriod == 0) {
+            for (uint8_t i = 0; i < N; i++) {
+                bank.Remaining[i]++;
+                bank.RunTimeToEmpty[i]++;
+                bank.Temperature[i]++;
+                bank.CycleCount[i]++;
+                bank.Status[i].Charging = !bank.Status[i].Charging;
+            }
+        }
+        for (uint8_t i = 0; i < N; i++) {
+            batteries.Array()[i].Publish();
+            batteries.Array()[i].SendInputReports();
+        }
+
+        for (const UsbHost::Interface& intf : batteries.host.Interfaces()) {
+            if (elapsed % intf.interval == 0)
+                delivered += batteries.host.Poll(intf.number).size();
+        }
+    }
+
+    double seconds = elapsed/1000.0;
+    state.counters["reports/s"] = delivered/seconds;
+    state.counters["reports/s/endpoint"] = delivered/seconds/batteries.host.Interfaces().size();
+    state.counters["reports/s/battery"] = delivered/seconds/N;
+}
+BENCHMARK_TEMPLATE(BM_InputThroughput, 1, false)->Arg(100)->Arg(1000);
+BENCHMARK_TEMPLATE(BM_InputThroughput, 3, false)->Arg(100)->Arg(1000);
+BENCHMARK_TEMPLATE(BM_InputThroughput, 1, true)->Arg(100)->Arg(1000);
+BENCHMARK_TEMPLATE(BM_InputThroughput, 3, true)->Arg(100)->Arg(1000);
+BENCHMARK_TEMPLATE(BM_InputThroughput, 8, true)->Arg(100)->Arg(1000);
+BENCHMARK_TEMPLATE(BM_InputThroughput, MAX_SHARED_BATTERIES, true)->Arg(100)->Arg(1000);
@@ -0,0 +1,94 @@
+// Report parsing with a compiled ReportPlan, against walking the fields bit by bit and scanning all fields per report.
+#include <benchmark/benchmark.h>
+#include <vector>
+#include <ReportPlan.hpp>
+
+/** Reference extraction one bit at a time. */
+static long long ExtractBitwise(const unsigned char* report, unsigned int reportLen, const ReportField& field) {
+    if (!field.BitSize || (field.BitSize > 32) || ((field.BitOffset + field.BitSize + 7u)/8 > reportLen))
+        return 0;
+
+    unsigned long long raw = 0;
+    for (unsigned int i = 0; i < field.BitSize; i++) {
+        unsigned int bit = field.BitOffset + i;
+        raw |= (unsigned long long)((report[bit/8] >> (bit%8)) & 1) << i;
+    }
+    if (field.Signed && (raw >> (field.BitSize - 1)))
+        return (long long)raw - (1ll << field.BitSize);
+    return (long long)raw;
+}
+
+/** Plan with "count" fields spread over two fields per report ID, with unaligned & 8/16-bit fields like a battery. */
+template <unsigned int N>
+static void MakePlan(ReportPlan<N>& plan, unsigned int count) {
+    for (unsigned int i = 0; i < count; i++) {
+        ReportField field;
+        field.ReportID = (unsigned char)(1 + i/2);
+        field.BitOffset = (i % 2) ? 21 : 8;
+        field.BitSize = (i % 2) ? 11 : 16;
+        field.Signed = (i % 4 == 3);
+        field.Target = (unsigned char)i;
+        plan.Add(field);
+    }
+}
+
+static const unsigned char REPORT[] = {0x01, 0x34, 0x12, 0xB6, 0x5F, 0x00};
+
+static void BM_ExtractValue(benchmark::State& state) {
+    ReportPlan<64> plan;
+    MakePlan(plan, 64);
+    for (auto _ : state) {
+        for (const ReportField& field : plan)
+            benchmark::DoNotOptimize(ExtractValue(REPORT, sizeof(REPORT), field));
+    }
+    state.SetItemsProcessed(state.iterations()*plan.Count());
+}
+BENCHMARK(BM_ExtractValue);
+
+static void BM_ExtractBitwise(benchmark::State& state) {
+    ReportPlan<64> plan;
+    MakePlan(plan, 64);
+    for (auto _ : state) {
+        for (const ReportField& field : plan)
+            benchmark::DoNotOptimize(ExtractBitwise(REPORT, sizeof(REPORT), field));
+    }
+    state.SetItemsProcessed(state.iterations()*plan.Count());
+}
+BENCHMARK(BM_ExtractBitwise);
+
+// Dispatch of one report of every ID to its fields, as the number of fields (argument) grows
+static void BM_DispatchIndexed(benchmark::State& state) {
+    ReportPlan<64> plan;
+    MakePlan(plan, (unsigned int)state.range(0));
+    std::vector<unsigned char> report(REPORT, REPORT + sizeof(REPORT));
+    const unsigned int reports = (plan.Count() + 1)/2;
+
+    for (auto _ : state) {
+        for (unsigned int id = 1; id <= reports; id++) {
+            report[0] = (unsigned char)id;
+            for (const ReportField& field : plan.Fields(report[0]))
+                benchmark::DoNotOptimize(ExtractValue(report.data(), (unsigned int)report.size(), field));
+        }
+    }
+    state.SetItemsProcessed(state.iterations()*reports);
+}
+BENCHMARK(BM_DispatchIndexed)->Arg(4)->Arg(16)->Arg(64);
+
+static void BM_DispatchScan(benchmark::State& state) {
+    ReportPlan<64> plan;
+    MakePlan(plan, (unsigned int)state.range(0));
+    std::vector<unsigned char> report(REPORT, REPORT + sizeof(REPORT));
+    const unsigned int reports = (plan.Count() + 1)/2;
+
+    for (auto _ : state) {
+        for (unsigned int id = 1; id <= reports; id++) {
+            report[0] = (unsigned char)id;
+            for (const ReportField& field : plan) {
+                if (field.ReportID == report[0])
+                    benchmark::DoNotOptimize(ExtractValue(report.data(), (unsigned int)report.size(), field));
+            }
+        }
+    }
+    state.SetItemsProcessed(state.iterations()*reports);
+}
+BENCHMARK(BM_DispatchScan)->Arg(4)->Arg(16)->Arg(64);
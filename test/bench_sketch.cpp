@@ -0,0 +1,82 @@
+// The battery sketch on the host, with a scripted USB host polling its endpoints & issuing control requests.
+#include <benchmark/benchmark.h>
+#include "UsbHost.h"
+#include "Sketch.h"
+
+/** Restart the sketch and enumerate it. */
+static UsbHost& Host() {
+    static UsbHost host;
+    ResetSketch();
+    setup();
+    host.Enumerate();
+    UsbStub::Record(false);
+    return host;
+}
+
+// setup() after a reset, which registers the reports & strings of all batteries
+static void BM_Setup(benchmark::State& state) {
+    for (auto _ : state) {
+        state.PauseTiming();
+        ResetSketch();
+        UsbStub::Record(false);
+        state.ResumeTiming();
+        setup();
+    }
+}
+BENCHMARK(BM_Setup);
+
+// One millisecond of loop(), with the host polling each endpoint at its interval
+static void BM_Loop(benchmark::State& state) {
+    UsbHost& host = Host();
+    size_t delivered = 0;
+    unsigned long elapsed = 0;
+    for (auto _ : state) {
+        loop();
+        for (const UsbHost::Interface& intf : host.Interfaces()) {
+            if (millis() % intf.interval == 0)
+                delivered += host.Poll(intf.number).size();
+        }
+        ArduinoStub::Advance(1);
+        elapsed++;
+        Serial.Clear();
+    }
+    state.counters["reports/s"] = delivered*1000.0/elapsed;
+}
+BENCHMARK(BM_Loop);
+
+static void BM_GetReportRequest(benchmark::State& state) {
+    UsbHost& host = Host();
+    std::vector<uint8_t> report;
+    for (auto _ : state)
+        benchmark::DoNotOptimize(host.GetFeature(host.Interfaces()[0].number, HID_PD_REMAININGCAPACITY, report));
+}
+BENCHMARK(BM_GetReportRequest);
+
+static void BM_SetReportRequest(benchmark::State& state) {
+    UsbHost& host = Host();
+    std::vector<uint8_t> limit = {0x00, 0x01};
+    for (auto _ : state) {
+        limit[0]++;
+        benchmark::DoNotOptimize(host.SetFeature(host.Interfaces()[0].number, HID_PD_REMNCAPACITYLIMIT, limit));
+        loop(); // applies the new value
+        Serial.Clear();
+    }
+}
+BENCHMARK(BM_SetReportRequest);
+
+// A serial control frame that sets the temperature of all batteries, including the response
+static void BM_ControlFrame(benchmark::State& state) {
+    Host();
+    const uint8_t payload[] = {CTRL_CMD_SET, CTRL_ALL_BATTERIES, HID_PD_TEMPERATURE, 2, 0x3B, 0x01};
+    uint8_t len = sizeof(payload);
+    std::vector<uint8_t> frame = {CTRL_SYNC, len};
+    frame.insert(frame.end(), payload, payload + len);
+    frame.push_back(ControlCrc8(ControlCrc8(0, &len, 1), payload, len));
+
+    for (auto _ : state) {
+        Serial.Input(frame.data(), frame.size());
+        Control.Poll(Serial);
+        Serial.Clear();
+    }
+}
+BENCHMARK(BM_ControlFrame);
@@ -0,0 +1,27 @@
+// Compile a text scenario to a PROGMEM array for battery.ino:
+//   scenario_compiler scenario.txt [SCENARIO] > scenario.h
+#include <stdio.h>
+#include <fstream>
+#include "ScenarioCompiler.h"
+
+int main(int argc, char* argv[]) {
+    if ((argc < 2) || (argc > 3)) {
+        fprintf(stderr, "usage: %s <scenario.txt> [array name]\n", argv[0]);
+        return 2;
+    }
+
+    std::ifstream text(argv[1]);
+    if (!text) {
+        fprintf(stderr, "%s: cannot open\n", argv[1]);
+        return 1;
+    }
+    std::vector<uint8_t> bytecode;
+    std::string error;
+    if (!CompileScenario(text, bytecode, error)) {
+        fprintf(stderr, "%s:%s\n", argv[1], error.c_str() + 5); // "file:<n>: reason", like compiler diagnostics
+        return 1;
+    }
+
+    fputs(FormatScenario(bytecode, (argc > 2) ? argv[2] : "SCENARIO").c_str(), stdout);
+    return 0;
+}
@@ -0,0 +1,142 @@
+#pragma once
+/* Host stand-in for the Arduino AVR core, with just enough of the API to build the library & sketch on Linux.
+   Time is simulated, and Serial is an in-memory loopback. See ArduinoStub.h for the test hooks. */
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+
+typedef uint8_t byte;
+typedef uint8_t u8;
+typedef uint16_t u16;
+
+// flash is ordinary memory on the host
+#define PROGMEM
+#define pgm_read_byte(addr) (*(const uint8_t*)(addr))
+#define pgm_read_word(addr) (*(const uint16_t*)(addr))
+#define strlen_P strlen
+#define memcpy_P memcpy
+
+#define lowByte(w)  ((uint8_t)((w) & 0xFF))
+#define highByte(w) ((uint8_t)((w) >> 8))
+
+#define LOW          0
+#define HIGH         1
+#define INPUT        0
+#define OUTPUT       1
+#define LED_BUILTIN 13
+#define PIN_A7      25 // ATmega32u4 (Leonardo & Micro)
+
+#define DEC 10
+#define HEX 16
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int analogRead(uint8_t pin);
+
+// ADC channel of analog input "P" (0 = A0), like the ATmega32u4 variant
+uint8_t analogPinToChannel(uint8_t P);
+
+// interrupts are simulated by direct calls, so there is nothing to mask
+#define cli()
+#define sei()
+extern uint8_t SREG;
+#define ISR(vector) extern "C" void vector()
+
+// ADC registers, which tests can inspect & drive through ADC_vect
+extern volatile uint8_t ADMUX;
+extern volatile uint8_t ADCSRA;
+extern volatile uint8_t ADCSRB;
+extern volatile uint16_t ADC;
+#define MUX5  5
+#define ADEN  7
+#define ADSC  6
+#define ADIE  3
+#define ADPS2 2
+#define ADPS1 1
+#define ADPS0 0
+#define REFS0 6
+
+class Print {
+public:
+    virtual ~Print() {}
+
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t* buffer, size_t size) {
+        size_t n = 0;
+        while (size--)
+            n += write(*buffer++);
+        return n;
+    }
+
+    size_t print(const char* str) {
+        return write((const uint8_t*)str, strlen(str));
+    }
+    size_t print(char c) {
+        return write((uint8_t)c);
+    }
+    size_t print(long value, int base = DEC);
+    size_t print(unsigned long value, int base = DEC);
+    size_t print(int value, int base = DEC) {
+        return print((long)value, base);
+    }
+    size_t print(unsigned int value, int base = DEC) {
+        return print((unsigned long)value, base);
+    }
+
+    size_t println() {
+        return print("\r\n");
+    }
+    template <class T>
+    size_t println(T value) {
+        size_t n = print(value);
+        return n + println();
+    }
+};
+
+class Stream : public Print {
+public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+};
+
+/** USB CDC serial port. Bytes written by the sketch are collected in Output(), and bytes for the sketch to read are queued with Input(). */
+class Serial_ : public Stream {
+public:
+    void begin(unsigned long baud) {
+        (void)baud;
+    }
+    operator bool() {
+        return true;
+    }
+
+    int available() override;
+    int read() override;
+    int peek() override;
+    size_t write(uint8_t c) override;
+    using Print::write;
+
+    /** Queue bytes to be read by the sketch. */
+    void Input(const void* data, size_t len);
+
+    /** Bytes written by the sketch since the last Clear(). */
+    const std::vector<uint8_t>& Output() const {
+        return m_output;
+    }
+
+    void Clear();
+
+private:
+    std::vector<uint8_t> m_input;
+    size_t m_inputPos = 0;
+    std::vector<uint8_t> m_output;
+};
+
+extern Serial_ Serial;
+
+#include "USBAPI.h"
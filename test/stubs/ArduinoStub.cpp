@@ -0,0 +1,127 @@
+#include "ArduinoStub.h"
+#include <stdio.h>
+
+#define PIN_COUNT 32
+
+Serial_ Serial;
+uint8_t SREG = 0;
+volatile uint8_t ADMUX = 0;
+volatile uint8_t ADCSRA = 0;
+volatile uint8_t ADCSRB = 0;
+volatile uint16_t ADC = 0;
+
+static uint64_t s_micros = 0; // wider than millis() & micros(), which wrap around at 32bit like on AVR
+static int s_analog[PIN_COUNT] = {};
+static uint8_t s_digital[PIN_COUNT] = {};
+
+unsigned long millis() {
+    return (uint32_t)(s_micros/1000);
+}
+
+unsigned long micros() {
+    return (uint32_t)s_micros;
+}
+
+void delay(unsigned long ms) {
+    ArduinoStub::Advance(ms);
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {
+    (void)pin;
+    (void)mode;
+}
+
+void digitalWrite(uint8_t pin, uint8_t value) {
+    if (pin < PIN_COUNT)
+        s_digital[pin] = value;
+}
+
+int analogRead(uint8_t pin) {
+    if (pin >= 18)
+        pin -= 18; // allow for channel or pin numbers
+    return (pin < PIN_COUNT) ? s_analog[pin] : 0;
+}
+
+uint8_t analogPinToChannel(uint8_t P) {
+    static const uint8_t channels[] = {7, 6, 5, 4, 1, 0, 8, 10, 11, 12, 13, 9}; // A0 - A11
+    return (P < sizeof(channels)) ? channels[P] : 0;
+}
+
+size_t Print::print(long value, int base) {
+    if (value < 0)
+        return print('-') + print((unsigned long)-value, base);
+    return print((unsigned long)value, base);
+}
+
+size_t Print::print(unsigned long value, int base) {
+    char buf[8*sizeof(long) + 1];
+    snprintf(buf, sizeof(buf), (base == HEX) ? "%lX" : "%lu", value);
+    return print(buf);
+}
+
+int Serial_::available() {
+    return (int)(m_input.size() - m_inputPos);
+}
+
+int Serial_::read() {
+    if (m_inputPos >= m_input.size())
+        return -1;
+    return m_input[m_inputPos++];
+}
+
+int Serial_::peek() {
+    if (m_inputPos >= m_input.size())
+        return -1;
+    return m_input[m_inputPos];
+}
+
+size_t Serial_::write(uint8_t c) {
+    m_output.push_back(c);
+    return 1;
+}
+
+void Serial_::Input(const void* data, size_t len) {
+    if (m_inputPos == m_input.size()) {
+        m_input.clear(); // everything consumed, so start over
+        m_inputPos = 0;
+    }
+    m_input.insert(m_input.end(), (const uint8_t*)data, (const uint8_t*)data + len);
+}
+
+void Serial_::Clear() {
+    m_input.clear();
+    m_inputPos = 0;
+    m_output.clear();
+}
+
+namespace ArduinoStub {
+
+void Reset() {
+    s_micros = 0;
+    for (int& value : s_analog)
+        value = 0;
+    for (uint8_t& value : s_digital)
+        value = LOW;
+    Serial.Clear();
+}
+
+void Advance(unsigned long ms) {
+    s_micros += 1000*ms;
+}
+
+void AdvanceMicros(unsigned long us) {
+    s_micros += us;
+}
+
+void SetAnalog(uint8_t pin, int value) {
+    if (pin >= 18)
+        pin -= 18; // allow for channel or pin numbers, like analogRead
+    if (pin < PIN_COUNT)
+        s_analog[pin] = value;
+}
+
+uint8_t DigitalPin(uint8_t pin) {
+    return (pin < PIN_COUNT) ? s_digital[pin] : LOW;
+}
+
+} // namespace ArduinoStub
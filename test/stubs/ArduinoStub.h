@@ -0,0 +1,22 @@
+#pragma once
+/* Test hooks of the Arduino core stubs. Time only advances through these calls, so tests are deterministic. */
+#include <Arduino.h>
+
+namespace ArduinoStub {
+
+/** Reset time to 0, clear Serial and restore the default pin states & analog values. */
+void Reset();
+
+/** Advance millis() & micros() by "ms" milliseconds. */
+void Advance(unsigned long ms);
+
+/** Advance micros() by "us" microseconds. */
+void AdvanceMicros(unsigned long us);
+
+/** Value returned by analogRead() for analog input "pin" (like PIN_A7). */
+void SetAnalog(uint8_t pin, int value);
+
+/** Last value written with digitalWrite() to "pin". */
+uint8_t DigitalPin(uint8_t pin);
+
+} // namespace ArduinoStub
@@ -0,0 +1,60 @@
+#pragma once
+/* Host stand-in for PluggableUSB.h of the Arduino AVR core. Interfaces & endpoints are assigned like on the target,
+   and the control request dispatch is driven by the scripted host in UsbHost.h. */
+#include "USBAPI.h"
+
+class PluggableUSBModule {
+public:
+    PluggableUSBModule(uint8_t numEps, uint8_t numIfs, uint8_t* epType) :
+        numEndpoints(numEps), numInterfaces(numIfs), endpointType(epType) {}
+
+protected:
+    virtual bool setup(USBSetup& setup) = 0;
+    virtual int getInterface(uint8_t* interfaceCount) = 0;
+    virtual int getDescriptor(USBSetup& setup) = 0;
+    virtual uint8_t getShortName(char* name) {
+        name[0] = 'A' + pluggedInterface;
+        return 1;
+    }
+
+    uint8_t pluggedInterface;
+    uint8_t pluggedEndpoint;
+
+    const uint8_t numEndpoints;
+    const uint8_t numInterfaces;
+    const uint8_t* endpointType;
+
+    PluggableUSBModule* next = nullptr;
+
+    friend class PluggableUSB_;
+};
+
+class PluggableUSB_ {
+public:
+    PluggableUSB_();
+    bool plug(PluggableUSBModule* node);
+    int getInterface(uint8_t* interfaceCount);
+    int getDescriptor(USBSetup& setup);
+    bool setup(USBSetup& setup);
+    void getShortName(char* iSerialNum);
+
+    /** Unplug all modules, so that each test starts with a freshly attached device. The modules are not destroyed. */
+    void reset();
+
+    /** Number of plugged modules. */
+    uint8_t count() const;
+
+    /** First endpoint of plugged module "index", or 0 if out of range. */
+    uint8_t endpoint(uint8_t index) const;
+
+    /** First interface of plugged module "index", or 0xFF if out of range. */
+    uint8_t interface(uint8_t index) const;
+
+private:
+    uint8_t lastIf;
+    uint8_t lastEp;
+    PluggableUSBModule* rootNode;
+    uint8_t totalEP;
+};
+
+PluggableUSB_& PluggableUSB();
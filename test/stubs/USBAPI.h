@@ -0,0 +1,109 @@
+#pragma once
+/* Host stand-in for the USB API of the Arduino AVR core (USBAPI.h, USBCore.h & USBDesc.h) with the ATmega32u4 defaults.
+   All transfers are recorded, see UsbStub.h. */
+#include <stdint.h>
+
+#define USB_ENDPOINTS       7 // ATmega32u4
+#define USB_EP_SIZE        64
+
+// CDC serial port, which claims the first interfaces & endpoints
+#define CDC_ENABLED
+#define CDC_INTERFACE_COUNT 2
+#define CDC_ENPOINT_COUNT   3
+#define CDC_ACM_INTERFACE   0
+#define CDC_FIRST_ENDPOINT  1
+
+// device string indices
+#define IMANUFACTURER 1
+#define IPRODUCT      2
+#define ISERIAL       3
+
+// USB_Send & USB_SendControl flags
+#define TRANSFER_PGM     0x80
+#define TRANSFER_RELEASE 0x40
+#define TRANSFER_ZERO    0x20
+
+#define EP_TYPE_INTERRUPT_IN 0xC1
+
+// bmRequestType
+#define REQUEST_HOSTTODEVICE 0x00
+#define REQUEST_DEVICETOHOST 0x80
+#define REQUEST_DIRECTION    0x80
+
+#define REQUEST_STANDARD     0x00
+#define REQUEST_CLASS        0x20
+#define REQUEST_VENDOR       0x40
+#define REQUEST_TYPE         0x60
+
+#define REQUEST_DEVICE       0x00
+#define REQUEST_INTERFACE    0x01
+#define REQUEST_ENDPOINT     0x02
+#define REQUEST_OTHER        0x03
+#define REQUEST_RECIPIENT    0x03
+
+#define REQUEST_DEVICETOHOST_CLASS_INTERFACE    (REQUEST_DEVICETOHOST | REQUEST_CLASS | REQUEST_INTERFACE)
+#define REQUEST_HOSTTODEVICE_CLASS_INTERFACE    (REQUEST_HOSTTODEVICE | REQUEST_CLASS | REQUEST_INTERFACE)
+#define REQUEST_DEVICETOHOST_STANDARD_INTERFACE (REQUEST_DEVICETOHOST | REQUEST_STANDARD | REQUEST_INTERFACE)
+
+// bRequest
+#define GET_STATUS        0
+#define CLEAR_FEATURE     1
+#define SET_FEATURE       3
+#define SET_ADDRESS       5
+#define GET_DESCRIPTOR    6
+#define SET_DESCRIPTOR    7
+#define GET_CONFIGURATION 8
+#define SET_CONFIGURATION 9
+
+// descriptor types
+#define USB_DEVICE_DESCRIPTOR_TYPE        1
+#define USB_CONFIGURATION_DESCRIPTOR_TYPE 2
+#define USB_STRING_DESCRIPTOR_TYPE        3
+#define USB_INTERFACE_DESCRIPTOR_TYPE     4
+#define USB_ENDPOINT_DESCRIPTOR_TYPE      5
+
+#define USB_DEVICE_CLASS_HUMAN_INTERFACE 0x03
+#define USB_ENDPOINT_TYPE_INTERRUPT      0x03
+#define USB_ENDPOINT_IN(addr)            (lowByte((addr) | 0x80))
+
+typedef struct {
+    uint8_t bmRequestType;
+    uint8_t bRequest;
+    uint8_t wValueL;
+    uint8_t wValueH;
+    uint16_t wIndex;
+    uint16_t wLength;
+} USBSetup;
+
+// descriptors are packed like on the 8-bit target
+typedef struct __attribute__((packed)) {
+    uint8_t len; // 9
+    uint8_t dtype; // 4
+    uint8_t number;
+    uint8_t alternate;
+    uint8_t numEndpoints;
+    uint8_t interfaceClass;
+    uint8_t interfaceSubClass;
+    uint8_t protocol;
+    uint8_t iInterface;
+} InterfaceDescriptor;
+
+typedef struct __attribute__((packed)) {
+    uint8_t len; // 7
+    uint8_t dtype; // 5
+    uint8_t addr;
+    uint8_t attr;
+    uint16_t packetSize;
+    uint8_t interval;
+} EndpointDescriptor;
+
+#define D_INTERFACE(_n, _numEndpoints, _class, _subClass, _protocol) \
+    { 9, 4, _n, 0, _numEndpoints, _class, _subClass, _protocol, 0 }
+
+#define D_ENDPOINT(_addr, _attr, _packetSize, _interval) \
+    { 7, 5, _addr, _attr, _packetSize, _interval }
+
+int USB_SendControl(uint8_t flags, const void* d, int len);
+int USB_RecvControl(void* d, int len);
+uint8_t USB_SendSpace(uint8_t ep);
+int USB_Send(uint8_t ep, const void* data, int len);
@@ -0,0 +1,232 @@
+#include "UsbStub.h"
+#include <deque>
+
+static std::vector<UsbStub::Transfer> s_log;
+static bool s_record = true;
+static size_t s_calls[3] = {};
+static size_t s_bytes[3] = {};
+
+static uint8_t s_banks = 1;
+static int s_sendError = 0;
+static std::deque<std::vector<uint8_t>> s_endpoints[USB_ENDPOINTS];
+
+static std::vector<uint8_t> s_controlIn;
+static std::vector<uint8_t> s_controlOut;
+static size_t s_controlOutPos = 0;
+
+static void LogTransfer(UsbStub::TransferType type, uint8_t ep, uint8_t flags, const void* data, int len, int result) {
+    s_calls[type]++;
+    if (result > 0)
+        s_bytes[type] += result;
+    if (!s_record)
+        return;
+
+    const uint8_t* bytes = (const uint8_t*)data;
+    s_log.push_back(UsbStub::Transfer{type, ep, flags, std::vector<uint8_t>(bytes, bytes + ((len > 0) ? len : 0)), result});
+}
+
+int USB_SendControl(uint8_t flags, const void* d, int len) {
+    const uint8_t* bytes = (const uint8_t*)d;
+    s_controlIn.insert(s_controlIn.end(), bytes, bytes + len);
+    LogTransfer(UsbStub::SendControl, 0, flags, d, len, len);
+    return len;
+}
+
+int USB_RecvControl(void* d, int len) {
+    int n = 0;
+    for (; (n < len) && (s_controlOutPos < s_controlOut.size()); n++)
+        ((uint8_t*)d)[n] = s_controlOut[s_controlOutPos++];
+    LogTransfer(UsbStub::RecvControl, 0, 0, d, n, n);
+    return n;
+}
+
+uint8_t USB_SendSpace(uint8_t ep) {
+    ep &= 0x07;
+    return (s_endpoints[ep].size() < s_banks) ? USB_EP_SIZE : 0;
+}
+
+int USB_Send(uint8_t ep, const void* data, int len) {
+    uint8_t flags = ep & 0xF8;
+    ep &= 0x07;
+
+    int res = len;
+    if (s_sendError)
+        res = s_sendError;
+    else if ((len > USB_EP_SIZE) || (s_endpoints[ep].size() >= s_banks))
+        res = -1; // the target times out after 250 ms if the host does not poll
+    else
+        s_endpoints[ep].push_back(std::vector<uint8_t>((const uint8_t*)data, (const uint8_t*)data + len));
+
+    LogTransfer(UsbStub::Send, ep, flags, data, len, res);
+    return res;
+}
+
+// Modelled on PluggableUSB.cpp of the Arduino AVR core
+PluggableUSB_::PluggableUSB_() : lastIf(CDC_ACM_INTERFACE + CDC_INTERFACE_COUNT), lastEp(CDC_FIRST_ENDPOINT + CDC_ENPOINT_COUNT),
+    rootNode(nullptr), totalEP(USB_ENDPOINTS) {
+}
+
+bool PluggableUSB_::plug(PluggableUSBModule* node) {
+    if ((lastEp + node->numEndpoints) > totalEP)
+        return false;
+
+    if (!rootNode) {
+        rootNode = node;
+    } else {
+        PluggableUSBModule* current = rootNode;
+        while (current->next)
+            current = current->next;
+        current->next = node;
+    }
+
+    node->next = nullptr;
+    node->pluggedInterface = lastIf;
+    node->pluggedEndpoint = lastEp;
+    lastIf += node->numInterfaces;
+    lastEp += node->numEndpoints;
+    return true;
+}
+
+int PluggableUSB_::getInterface(uint8_t* interfaceCount) {
+    int sent = 0;
+    for (PluggableUSBModule* node = rootNode; node; node = node->next) {
+        int res = node->getInterface(interfaceCount);
+        if (res < 0)
+            return -1;
+        sent += res;
+    }
+    return sent;
+}
+
+int PluggableUSB_::getDescriptor(USBSetup& setup) {
+    for (PluggableUSBModule* node = rootNode; node; node = node->next) {
+        int ret = node->getDescriptor(setup);
+        if (ret)
+            return ret; // request has been processed
+    }
+    return 0;
+}
+
+void PluggableUSB_::getShortName(char* iSerialNum) {
+    for (PluggableUSBModule* node = rootNode; node; node = node->next)
+        iSerialNum += node->getShortName(iSerialNum);
+    *iSerialNum = 0;
+}
+
+bool PluggableUSB_::setup(USBSetup& setup) {
+    for (PluggableUSBModule* node = rootNode; node; node = node->next) {
+        if (node->setup(setup))
+            return true;
+    }
+    return false;
+}
+
+void PluggableUSB_::reset() {
+    // modules may already be destroyed, so only forget them
+    lastIf = CDC_ACM_INTERFACE + CDC_INTERFACE_COUNT;
+    lastEp = CDC_FIRST_ENDPOINT + CDC_ENPOINT_COUNT;
+    rootNode = nullptr;
+}
+
+uint8_t PluggableUSB_::count() const {
+    uint8_t n = 0;
+    for (const PluggableUSBModule* node = rootNode; node; node = node->next)
+        n++;
+    return n;
+}
+
+uint8_t PluggableUSB_::endpoint(uint8_t index) const {
+    const PluggableUSBModule* node = rootNode;
+    for (; node && index; index--)
+        node = node->next;
+    return node ? node->pluggedEndpoint : 0;
+}
+
+uint8_t PluggableUSB_::interface(uint8_t index) const {
+    const PluggableUSBModule* node = rootNode;
+    for (; node && index; index--)
+        node = node->next;
+    return node ? node->pluggedInterface : 0xFF;
+}
+
+PluggableUSB_& PluggableUSB() {
+    static PluggableUSB_ obj;
+    return obj;
+}
+
+namespace UsbStub {
+
+void Reset() {
+    PluggableUSB().reset();
+    Clear();
+}
+
+void Clear() {
+    for (std::deque<std::vector<uint8_t>>& packets : s_endpoints)
+        packets.clear();
+    ClearControl();
+    s_banks = 1;
+    s_sendError = 0;
+    s_record = true;
+    ClearLog();
+}
+
+const std::vector<Transfer>& Log() {
+    return s_log;
+}
+
+void ClearLog() {
+    s_log.clear();
+    for (size_t& calls : s_calls)
+        calls = 0;
+    for (size_t& bytes : s_bytes)
+        bytes = 0;
+}
+
+void Record(bool enable) {
+    s_record = enable;
+}
+
+size_t Calls(TransferType type) {
+    return s_calls[type];
+}
+
+size_t Bytes(TransferType type) {
+    return s_bytes[type];
+}
+
+void SetBanks(uint8_t banks) {
+    s_banks = banks;
+}
+
+void FailSends(int error) {
+    s_sendError = error;
+}
+
+bool Poll(uint8_t ep, std::vector<uint8_t>& packet) {
+    ep &= 0x07;
+    if (s_endpoints[ep].empty())
+        return false;
+
+    packet = s_endpoints[ep].front();
+    s_endpoints[ep].pop_front();
+    return true;
+}
+
+void ClearControl() {
+    s_controlIn.clear();
+    s_controlOut.clear();
+    s_controlOutPos = 0;
+}
+
+void TakeControlIn(std::vector<uint8_t>& data) {
+    data.assign(s_controlIn.begin(), s_controlIn.end());
+    s_controlIn.clear();
+}
+
+void SetControlOut(const std::vector<uint8_t>& data) {
+    s_controlOut = data;
+    s_controlOutPos = 0;
+}
+
+} // namespace UsbStub
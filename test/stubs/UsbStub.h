@@ -0,0 +1,60 @@
+#pragma once
+/* Test hooks of the USB stubs. Every transfer is recorded, and each IN endpoint models the FIFO banks of the ATmega32u4:
+   a released packet occupies a bank until the host polls it, so USB_SendSpace reports 0 and USB_Send fails while all banks are full. */
+#include <PluggableUSB.h>
+#include <stddef.h>
+#include <vector>
+
+namespace UsbStub {
+
+enum TransferType : uint8_t {
+    Send,        // USB_Send
+    SendControl, // USB_SendControl
+    RecvControl, // USB_RecvControl
+};
+
+struct Transfer {
+    TransferType type;
+    uint8_t ep;    // endpoint without TRANSFER_* flags (0 for control transfers)
+    uint8_t flags; // TRANSFER_* flags
+    std::vector<uint8_t> data;
+    int result;
+};
+
+/** Unplug all modules, and Clear(). */
+void Reset();
+
+/** Empty the endpoints & control pipe, clear the transfer log and restore the defaults, but keep the modules plugged. */
+void Clear();
+
+/** Transfers since the last Reset() or ClearLog(). */
+const std::vector<Transfer>& Log();
+void ClearLog();
+
+/** Stop or resume recording transfers, for instance while benchmarking. Counters are always updated. */
+void Record(bool enable);
+
+/** Number of calls & bytes of a transfer type since the last Reset() or ClearLog(). */
+size_t Calls(TransferType type);
+size_t Bytes(TransferType type);
+
+/** Number of packets that fit in each IN endpoint before the host must poll it (1 by default, like a single-bank endpoint). */
+void SetBanks(uint8_t banks);
+
+/** Let USB_Send return "error" without sending, like a suspended device. 0 restores normal operation. */
+void FailSends(int error);
+
+/** Take the oldest packet from IN endpoint "ep", which frees its bank. Returns false if the endpoint is empty. */
+bool Poll(uint8_t ep, std::vector<uint8_t>& packet);
+
+/** Discard the data stages of earlier control requests. */
+void ClearControl();
+
+/** Move the data that the device sent with USB_SendControl into "data" (IN data stage of a control request).
+    Reuses the capacity of "data", so that repeated requests do not allocate. */
+void TakeControlIn(std::vector<uint8_t>& data);
+
+/** Data to be received with USB_RecvControl (OUT data stage of a control request). */
+void SetControlOut(const std::vector<uint8_t>& data);
+
+} // namespace UsbStub
@@ -0,0 +1,128 @@
+// BatteryAdc driven through its ADC interrupt like by the ATmega32u4 ADC, with the sketch reading a potentiometer.
+#include <gtest/gtest.h>
+#include <functional>
+#define ENABLE_POTENTIOMETER // also claims ADC_vect
+#include "Sketch.h"
+
+static_assert(ADC_OVERSAMPLING_BITS == 2, "tests assume 16 conversions per decimated sample");
+static const int CONVERSIONS = 1 << (2*ADC_OVERSAMPLING_BITS);
+
+/** Stand-in for the ADC hardware: completes conversions of the channel selected by the ISR & raises its interrupt. */
+class AdcTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        ResetSketch();
+        ADMUX = ADCSRA = ADCSRB = 0;
+        ADC = 0;
+    }
+
+    /** ADC mux channel selected by ADMUX & ADCSRB. */
+    static uint8_t Channel() {
+        return (ADMUX & 0x07) | (((ADCSRB >> MUX5) & 0x01) << 3);
+    }
+
+    /** Complete "count" conversions, with the input of each channel from "inputs" (indexed by channel). */
+    void Convert(int count) {
+        for (int i = 0; i < count; i++) {
+            ASSERT_TRUE(ADCSRA & (1 << ADSC)) << "no conversion started";
+            uint8_t channel = Channel();
+            m_converted.push_back(channel);
+            ADC = m_inputs[channel](m_converted.size());
+            ADCSRA &= ~(1 << ADSC); // cleared by the hardware when the conversion completes
+            ADC_vect();
+        }
+    }
+
+    /** 10-bit input value of each channel, as function of the conversion count. */
+    std::function<uint16_t(size_t)> m_inputs[16] = {};
+    std::vector<uint8_t> m_converted; // channel of each conversion
+
+    BatteryAdc m_adc;
+};
+
+TEST_F(AdcTest, SequencesChannelsRoundRobin) {
+    const uint8_t pins[] = {0, PIN_A7, 11}; // A0, A7 & A11
+    for (auto& input : m_inputs)
+        input = [](size_t) { return 0; };
+    m_adc.Begin(pins, sizeof(pins));
+    EXPECT_EQ(ADCSRA & ((1 << ADEN) | (1 << ADIE)), (1 << ADEN) | (1 << ADIE));
+    EXPECT_TRUE(ADMUX & (1 << REFS0));
+
+    Convert(2*3*CONVERSIONS);
+    // all oversampling conversions of a channel in a row, with the ATmega32u4 channels 7, 10 & 9
+    const uint8_t channels[] = {7, 10, 9, 7, 10, 9};
+    for (size_t i = 0; i < m_converted.size(); i++)
+        ASSERT_EQ(m_converted[i], channels[i/CONVERSIONS]) << "conversion " << i;
+    EXPECT_TRUE(ADCSRA & (1 << ADSC)); // keeps converting
+}
+
+TEST_F(AdcTest, DecimatesAndFilters) {
+    const uint8_t pins[] = {0, PIN_A7};
+    m_inputs[7] = [](size_t n) { return 512 + (n & 1); }; // dithered between two codes
+    m_inputs[10] = [](size_t) { return 1023; };
+    m_adc.Begin(pins, sizeof(pins));
+
+    // the first decimated sample primes the filter
+    Convert(2*CONVERSIONS);
+    m_adc.Update();
+    EXPECT_EQ(m_adc.Value(0), 2050); // oversampling resolves the dithered input in 12 bits
+    EXPECT_EQ(m_adc.Value(1), 4092);
+    EXPECT_EQ(m_adc.Value(2), 0);    // not sampled
+
+    // a step is low-pass filtered
+    m_inputs[7] = [](size_t) { return 768; };
+    Convert(2*CONVERSIONS);
+    m_adc.Update();
+    EXPECT_EQ(m_adc.Value(0), ((2050 << 4) + (((3072 - 2050) << 4) >> ADC_FILTER_SHIFT) + 8) >> 4); // 4 fractional filter bits
+    for (int i = 0; i < 50; i++) {
+        Convert(2*CONVERSIONS);
+        m_adc.Update();
+    }
+    EXPECT_NEAR(m_adc.Value(0), 3072, 8);
+    EXPECT_EQ(m_adc.Value(1), 4092);
+    EXPECT_EQ(m_adc.Overruns(), 0);
+}
+
+TEST_F(AdcTest, CountsOverruns) {
+    const uint8_t pins[] = {PIN_A7};
+    m_inputs[10] = [](size_t) { return 100; };
+    m_adc.Begin(pins, sizeof(pins));
+
+    Convert((ADC_RING_SIZE + 3)*CONVERSIONS); // without Update
+    EXPECT_EQ(m_adc.Overruns(), 3);
+    m_adc.Update();
+    EXPECT_EQ(m_adc.Value(0), 400);
+}
+
+TEST_F(AdcTest, PotentiometerSetsCharge) {
+    setup();
+    UsbStub::Record(false);
+    uint16_t full = Bank.FullChargeCapacity[0];
+    m_inputs[10] = [](size_t) { return 768; }; // A7 at 3/4
+
+    // sample in the background of loop(), up to the next simulation step
+    while (millis() <= UPDATE_INTERVAL) {
+        Convert(CONVERSIONS);
+        loop();
+        ArduinoStub::Advance(10);
+    }
+    uint16_t expected = ((uint32_t)full*3072) >> ADC_RESOLUTION_BITS;
+    EXPECT_EQ(Adc.Value(0), 3072);
+    EXPECT_EQ(Bank.Remaining[0], expected);
+    EXPECT_TRUE(Bank.Status[0].Charging); // increased
+
+    // the value reaches the published reports of the first battery, and the next battery one step later
+    const HIDReport* report = PowerDevice[0].GetFeature(HID_PD_REMAININGCAPACITY);
+    ASSERT_NE(report, nullptr);
+    EXPECT_EQ(*(const uint16_t*)report->data, expected);
+
+    m_inputs[10] = [](size_t) { return 256; }; // turned down
+    while (millis() <= 2*UPDATE_INTERVAL + 500) {
+        Convert(CONVERSIONS);
+        loop();
+        ArduinoStub::Advance(10);
+    }
+    EXPECT_EQ(Bank.Remaining[1], expected);
+    EXPECT_LT(Bank.Remaining[0], expected);
+    EXPECT_FALSE(Bank.Status[0].Charging);
+}
@@ -0,0 +1,80 @@
+#include <gtest/gtest.h>
+#include <cmath>
+#include <BatteryMath.h>
+
+// The fixed-point conversions must match the float reference rounded to nearest, except for saturation.
+
+static uint16_t Round16(double value) {
+    return (value >= 0xFFFF) ? 0xFFFF : (uint16_t)std::lround(value);
+}
+
+TEST(BatteryMath, MulDivMatchesFloat) {
+    for (uint32_t a = 0; a <= 0xFFFF; a += 97) {
+        for (uint32_t c = 1; c <= 0xFFFF; c += 1031) {
+            uint16_t b = (uint16_t)(c*7 + 13);
+            double exact = (double)a*b/c;
+            if (std::fabs(exact - std::floor(exact) - 0.5) < 1e-9)
+                continue; // ties round up in integer arithmetic
+            ASSERT_EQ(MulDiv(a, b, c), Round16(exact)) << a << "*" << b << "/" << c;
+        }
+    }
+    EXPECT_EQ(MulDiv(1, 2, 0), 0);
+    EXPECT_EQ(MulDiv(0xFFFF, 0xFFFF, 1), 0xFFFF);
+}
+
+TEST(BatteryMath, RatioScaleMatchesFloat) {
+    for (uint16_t percent = 0; percent <= 100; percent++) {
+        Ratio ratio = Ratio::FromPercent(percent);
+        for (uint32_t value = 0; value <= 0xFFFF; value += 251) {
+            // rounding of the result, plus the quantization of the ratio to 1/16384 steps
+            double exact = value*percent/100.0;
+            ASSERT_LE(std::fabs(ratio.Scale(value) - exact), 0.5 + value/32768.0) << percent << "% of " << value;
+        }
+    }
+    EXPECT_EQ(Ratio::FromPercent(100).Scale(0xFFFF), 0xFFFF);
+    EXPECT_EQ(Ratio::FromPercent(200).Scale(0xFFFF), 0xFFFF); // saturates
+}
+
+TEST(BatteryMath, CapacityConversionsMatchFloat) {
+    for (uint32_t mAh = 0; mAh <= 18000; mAh += 7)
+        ASSERT_EQ(AmpSecFromMilliAmpHours(mAh), Round16(mAh*36/10.0)) << mAh;
+    for (uint32_t ampSec = 0; ampSec <= 0xFFFF; ampSec += 11)
+        ASSERT_EQ(MilliAmpHoursFromAmpSec(ampSec), Round16(ampSec*10/36.0)) << ampSec;
+
+    for (uint16_t centiVolt : {370, 740, 1110, 1499, 2000}) {
+        for (uint32_t mWh = 0; mWh <= 200000; mWh += 997) {
+            double exact = mWh*360.0/centiVolt;
+            if (std::fabs(exact - std::floor(exact) - 0.5) < 1e-9)
+                continue;
+            ASSERT_EQ(AmpSecFromMilliWattHours(mWh, centiVolt), Round16(exact)) << mWh << " mWh at " << centiVolt << " cV";
+        }
+        for (uint32_t ampSec = 0; ampSec <= 0xFFFF; ampSec += 13)
+            ASSERT_LE(std::abs(MilliWattHoursFromAmpSec(ampSec, centiVolt) - Round16(ampSec*centiVolt/360.0)), 1) << ampSec;
+    }
+    EXPECT_EQ(AmpSecFromMilliWattHours(1000, 0), 0);
+}
+
+TEST(BatteryMath, CapacityModes) {
+    const uint16_t full = AmpSecFromMilliWattHours(40690, 1499);
+    const uint16_t half = full/2;
+    EXPECT_EQ(CapacityFromAmpSec<CAPACITY_MODE_MAH>(half, 1499, full), MilliAmpHoursFromAmpSec(half));
+    EXPECT_EQ(CapacityFromAmpSec<CAPACITY_MODE_MWH>(half, 1499, full), MilliWattHoursFromAmpSec(half, 1499));
+    EXPECT_EQ(CapacityFromAmpSec<CAPACITY_MODE_PERCENT>(half, 1499, full), 50);
+}
+
+TEST(BatteryMath, RunTimeAndUnits) {
+    EXPECT_EQ(RunTime(0, 1000, 7200), 0);
+    EXPECT_EQ(RunTime(300, 1000, 7200), 2160);
+    EXPECT_EQ(RunTime(1000, 1000, 7200), 7200);
+    EXPECT_EQ(RunTime(100, 0, 7200), 0); // unknown full capacity
+
+    EXPECT_EQ(CentiVoltFromMilliVolt(14994), 1499);
+    EXPECT_EQ(CentiVoltFromMilliVolt(14995), 1500);
+    EXPECT_EQ(KelvinFromCelsius(-273), 0);
+    EXPECT_EQ(KelvinFromCelsius(27), 300);
+    EXPECT_EQ(CelsiusFromKelvin(KelvinFromCelsius(-40)), -40);
+}
+
+// conversions of constants are evaluated by the compiler
+static_assert(AmpSecFromMilliWattHours(58003, 1499) == 13930, "58003 mWh at 14.99 V");
+static_assert(Ratio::FromPercent(25).Scale(1000) == 250, "25% of 1000");
@@ -0,0 +1,200 @@
+#include <gtest/gtest.h>
+#include <atomic>
+#include <thread>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+#include <ArduinoStub.h>
+#include <UsbStub.h>
+#include <BatteryBank.h>
+#include "ControlClient.h"
+
+/** Stream over the device end of a pseudo-terminal, in place of the CDC serial port of the sketch. */
+class FdStream : public Stream {
+public:
+    explicit FdStream(int fd) : m_fd(fd) {}
+
+    int available() override {
+        int count = 0;
+        return (ioctl(m_fd, FIONREAD, &count) < 0) ? 0 : count;
+    }
+    int read() override {
+        uint8_t c = 0;
+        return (::read(m_fd, &c, 1) == 1) ? c : -1;
+    }
+    int peek() override {
+        return -1; // not used by BatteryControl
+    }
+    size_t write(uint8_t c) override {
+        return write(&c, 1);
+    }
+    size_t write(const uint8_t* buffer, size_t size) override {
+        ssize_t n = ::write(m_fd, buffer, size);
+        return (n < 0) ? 0 : n;
+    }
+
+private:
+    int m_fd;
+};
+
+static std::atomic<int> s_setCalls(0);
+static BatteryBank<2>* s_bank = nullptr;
+
+/** Batteries served by BatteryControl on a pseudo-terminal, with the test acting as host through ControlClient. */
+class ControlTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        UsbStub::Reset();
+        ArduinoStub::Reset();
+
+        m_master = posix_openpt(O_RDWR | O_NOCTTY);
+        ASSERT_GE(m_master, 0);
+        ASSERT_EQ(grantpt(m_master), 0);
+        ASSERT_EQ(unlockpt(m_master), 0);
+        m_slave = open(ptsname(m_master), O_RDWR | O_NOCTTY);
+        ASSERT_GE(m_slave, 0);
+
+        // binary transparent, like a USB CDC port opened by ControlClient::Open
+        termios tio = {};
+        ASSERT_EQ(tcgetattr(m_slave, &tio), 0);
+        cfmakeraw(&tio);
+        ASSERT_EQ(tcsetattr(m_slave, TCSANOW, &tio), 0);
+
+        m_bank.Register(m_devices);
+        s_bank = &m_bank;
+        s_setCalls = 0;
+        m_control.OnSet([](uint8_t battery, uint8_t field) {
+            s_setCalls++;
+            s_bank->Inject(battery, field);
+        });
+    }
+
+    void TearDown() override {
+        Stop();
+        close(m_slave);
+        close(m_master);
+    }
+
+    /** Poll the protocol on a device thread, like loop() does. "log" is printed after each poll that received data, to check that the client skips text. */
+    void Start(const char* log = nullptr) {
+        m_stop = false;
+        m_device = std::thread([this, log]() {
+            FdStream stream(m_slave);
+            while (!m_stop) {
+                bool received = stream.available() > 0;
+                m_control.Poll(stream);
+                if (log && received)
+                    stream.print(log);
+                std::this_thread::sleep_for(std::chrono::microseconds(200));
+            }
+        });
+    }
+
+    /** Stop the device thread, after which the battery state can be inspected. */
+    void Stop() {
+        m_stop = true;
+        if (m_device.joinable())
+            m_device.join();
+    }
+
+    HIDPowerDevice_ m_devices[2];
+    BatteryBank<2> m_bank;
+    BatteryControl m_control{m_devices, 2};
+    int m_master = -1;
+    int m_slave = -1;
+    std::thread m_device;
+    std::atomic<bool> m_stop{false};
+};
+
+TEST_F(ControlTest, SetAndReadBack) {
+    Start();
+    ControlClient client(m_master);
+
+    EXPECT_EQ(client.Set(1, HID_PD_REMAININGCAPACITY, 1234), CTRL_OK);
+    std::vector<uint8_t> value;
+    EXPECT_EQ(client.Get(1, HID_PD_REMAININGCAPACITY, value), CTRL_OK);
+    EXPECT_EQ(value, std::vector<uint8_t>({0xD2, 0x04}));
+    EXPECT_EQ(client.Get(0, HID_PD_REMAININGCAPACITY, value), CTRL_OK);
+    EXPECT_EQ(value, std::vector<uint8_t>({0, 0}));
+    Stop();
+
+    EXPECT_EQ(m_bank.Remaining[1], 1234);
+    EXPECT_EQ(m_bank.Remaining[0], 0);
+    EXPECT_TRUE(m_bank.IsInjected(1, HID_PD_REMAININGCAPACITY));
+    EXPECT_FALSE(m_bank.IsInjected(0, HID_PD_REMAININGCAPACITY));
+    EXPECT_EQ(s_setCalls, 1);
+}
+
+TEST_F(ControlTest, BatchIsAppliedTogether) {
+    Start();
+    ControlClient client(m_master);
+
+    // the invalid second update rejects the whole frame
+    EXPECT_EQ(client.Set({{0, HID_PD_REMAININGCAPACITY, {0x10, 0x00}}, {0, HID_PD_STATS, {0x01}}}), CTRL_ERR_FIELD);
+    EXPECT_EQ(client.Set({{0, HID_PD_REMAININGCAPACITY, {0x10, 0x00}}, {5, HID_PD_VOLTAGE, {0x01, 0x00}}}), CTRL_ERR_BATTERY);
+    std::vector<uint8_t> value;
+    EXPECT_EQ(client.Get(0, HID_PD_REMAININGCAPACITY, value), CTRL_OK);
+    EXPECT_EQ(value, std::vector<uint8_t>({0, 0}));
+
+    EXPECT_EQ(client.Set({{CTRL_ALL_BATTERIES, HID_PD_VOLTAGE, {0xDB, 0x05}}, {0, HID_PD_PRESENTSTATUS, {0x01}}}), CTRL_OK);
+    Stop();
+
+    EXPECT_EQ(m_bank.Voltage[0], 1499);
+    EXPECT_EQ(m_bank.Voltage[1], 1499);
+    EXPECT_EQ(m_bank.Status[0].Charging, 1);
+    EXPECT_EQ(s_setCalls, 3);
+}
+
+TEST_F(ControlTest, RejectsInvalidUpdates) {
+    Start();
+    ControlClient client(m_master);
+
+    EXPECT_EQ(client.Set(2, HID_PD_VOLTAGE, 1499), CTRL_ERR_BATTERY);
+    EXPECT_EQ(client.Set(0, HID_PD_TEMPERATURE + 0x40, 300), CTRL_ERR_FIELD);
+    EXPECT_EQ(client.Set({{0, HID_PD_VOLTAGE, {0x01}}}), CTRL_ERR_LENGTH);
+    EXPECT_EQ(client.Set(0, HID_PD_IPRODUCT, 1), CTRL_ERR_LENGTH);
+    EXPECT_EQ(client.Set({{0, HID_PD_IPRODUCT, {0x01}}}), CTRL_ERR_READONLY);
+
+    std::vector<uint8_t> value;
+    EXPECT_EQ(client.Get(2, HID_PD_VOLTAGE, value), CTRL_ERR_BATTERY);
+    EXPECT_EQ(client.Get(0, HID_PD_MANUFACTUREDATE, value), CTRL_ERR_FIELD);
+    EXPECT_EQ(client.Get(0, HID_PD_IPRODUCT, value), CTRL_OK); // constants are readable
+    EXPECT_EQ(value, std::vector<uint8_t>({IPRODUCT}));
+
+    std::vector<uint8_t> response;
+    ASSERT_TRUE(client.Transact({0x7F}, response));
+    EXPECT_EQ(response, std::vector<uint8_t>({0x7F | CTRL_RESPONSE, CTRL_ERR_COMMAND}));
+    ASSERT_TRUE(client.Transact({CTRL_CMD_SET, 0, HID_PD_VOLTAGE, 2, 0xDB}, response)); // truncated value
+    EXPECT_EQ(response, std::vector<uint8_t>({CTRL_CMD_SET | CTRL_RESPONSE, CTRL_ERR_COMMAND}));
+    Stop();
+
+    EXPECT_EQ(m_bank.Voltage[0], 0);
+    EXPECT_EQ(s_setCalls, 0);
+}
+
+TEST_F(ControlTest, ResynchronizesAfterCorruptFrames) {
+    Start("Remaining charge: 100\r\n"); // text logging on the same port
+    ControlClient client(m_master);
+
+    // bad CRC, invalid length and stray SYNC bytes are dropped
+    const uint8_t garbage[] = {CTRL_SYNC, 3, CTRL_CMD_GET, 0, HID_PD_VOLTAGE, 0x00, CTRL_SYNC, 0, CTRL_SYNC, CTRL_MAX_PAYLOAD + 1, 'x'};
+    ASSERT_EQ(write(m_master, garbage, sizeof(garbage)), (ssize_t)sizeof(garbage));
+
+    for (int i = 0; i < 20; i++)
+        EXPECT_EQ(client.Set(0, HID_PD_TEMPERATURE, 300 + i), CTRL_OK);
+    std::vector<uint8_t> value;
+    EXPECT_EQ(client.Get(0, HID_PD_TEMPERATURE, value), CTRL_OK);
+    EXPECT_EQ(value, std::vector<uint8_t>({lowByte(319), highByte(319)}));
+}
+
+TEST_F(ControlTest, TimesOutWithoutDevice) {
+    ControlClient client(m_master, 50);
+    EXPECT_EQ(client.Set(0, HID_PD_VOLTAGE, 1499), -1);
+}
+
+TEST(ControlCrc, MatchesReference) {
+    // CRC-8 (poly 0x07, init 0) check value
+    const uint8_t check[] = {'1', '2', '3', '4', '5', '6', '7', '8', '9'};
+    EXPECT_EQ(ControlCrc8(0, check, sizeof(check)), 0xF4);
+}
@@ -0,0 +1,469 @@
+// HID_ & HIDPowerDevice_ against the recording USB stubs, with a scripted host issuing the control requests.
+#include <gtest/gtest.h>
+#include <malloc.h>
+#include <new>
+#include <ArduinoStub.h>
+#include <HIDPowerDevice.h>
+#include "UsbHost.h"
+
+// count heap allocations, to check that the USB request handling never allocates
+static size_t s_allocations = 0;
+
+static void* Allocate(size_t size) {
+    s_allocations++;
+    if (void* ptr = malloc(size ? size : 1))
+        return ptr;
+    throw std::bad_alloc();
+}
+
+void* operator new(size_t size) {
+    return Allocate(size);
+}
+
+void* operator new[](size_t size) {
+    return Allocate(size);
+}
+
+void operator delete(void* ptr) noexcept {
+    free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+    free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+    free(ptr);
+}
+
+void operator delete[](void* ptr, size_t) noexcept {
+    free(ptr);
+}
+
+static std::vector<uint8_t> Report(uint8_t id, uint16_t value) {
+    return {id, lowByte(value), highByte(value)};
+}
+
+class HidTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        UsbStub::Reset();
+        ArduinoStub::Reset();
+    }
+
+    /** Send a control request without heap allocations once "data" has been sized by a previous call. */
+    bool Control(const USBSetup& setup, std::vector<uint8_t>& data) {
+        return m_host.Control(setup, data);
+    }
+
+    UsbHost m_host;
+};
+
+TEST_F(HidTest, EnumeratesInterfaceAfterCdc) {
+    HIDPowerDevice_ dev;
+    ASSERT_TRUE(m_host.Enumerate());
+
+    ASSERT_EQ(m_host.Interfaces().size(), 1u);
+    const UsbHost::Interface& intf = m_host.Interfaces()[0];
+    EXPECT_EQ(intf.number, CDC_ACM_INTERFACE + CDC_INTERFACE_COUNT);
+    EXPECT_EQ(intf.endpoint, CDC_FIRST_ENDPOINT + CDC_ENPOINT_COUNT);
+    EXPECT_EQ(intf.reportDesc, std::vector<uint8_t>(s_hidReportDescriptor, s_hidReportDescriptor + sizeof(s_hidReportDescriptor)));
+
+    // the unshifted descriptor is sent from flash in one transfer
+    size_t descTransfers = 0;
+    for (const UsbStub::Transfer& t : UsbStub::Log())
+        descTransfers += (t.type == UsbStub::SendControl) && (t.flags & TRANSFER_PGM);
+    EXPECT_EQ(descTransfers, 1u);
+}
+
+TEST_F(HidTest, ServesStringDescriptors) {
+    static const char name[] PROGMEM = "BatteryVendor";
+    static const uint8_t index PROGMEM = ISERIAL + 20;
+
+    HIDPowerDevice_ dev;
+    dev.SetStringFeature_P(HID_PD_MANUFACTURER, &index, name);
+    ASSERT_TRUE(m_host.Enumerate());
+
+    EXPECT_EQ(m_host.GetString(ISERIAL + 20), "BatteryVendor");
+    EXPECT_EQ(m_host.GetString(ISERIAL + 19), ""); // not registered
+
+    std::vector<uint8_t> report;
+    ASSERT_TRUE(m_host.GetFeature(m_host.Interfaces()[0].number, HID_PD_MANUFACTURER, report));
+    EXPECT_EQ(report, std::vector<uint8_t>({HID_PD_MANUFACTURER, ISERIAL + 20}));
+}
+
+TEST_F(HidTest, FeatureTableLookup) {
+    uint16_t remaining = 1234;
+    uint16_t voltage = 1499;
+
+    HIDPowerDevice_ dev;
+    EXPECT_TRUE(dev.SetFeature<HID_PD_REMAININGCAPACITY>(remaining));
+    EXPECT_TRUE(dev.SetFeature<HID_PD_VOLTAGE>(voltage));
+
+    const HIDReport* report = dev.GetFeature(HID_PD_REMAININGCAPACITY);
+    ASSERT_NE(report, nullptr);
+    EXPECT_EQ(report->data, &remaining);
+    EXPECT_EQ(report->length, sizeof(remaining));
+    EXPECT_FALSE(report->progmem);
+
+    EXPECT_EQ(dev.GetFeature(HID_PD_VOLTAGE)->data, &voltage);
+    EXPECT_EQ(dev.GetFeature(HID_PD_TEMPERATURE), nullptr);     // not registered
+    EXPECT_EQ(dev.GetFeature(HID_REPORT_ID_COUNT), nullptr);    // out of range
+    EXPECT_TRUE(dev.GetFeature(HID_PD_IPRODUCT)->progmem);      // registered by constructor
+
+    EXPECT_FALSE(dev.SetFeature<HID_PD_REMAININGCAPACITY>(voltage)); // already registered
+    EXPECT_FALSE(dev.SetFeature(HID_REPORT_ID_COUNT, &voltage, 2));  // ID out of range
+    EXPECT_FALSE(dev.SetFeature(HID_PD_TEMPERATURE, &voltage, HID_MAX_REPORT_LENGTH + 1)); // too large
+}
+
+TEST_F(HidTest, FeatureTableIsPerDevice) {
+    uint16_t remaining[2] = {100, 200};
+
+    HIDPowerDevice_ dev[2];
+    ASSERT_TRUE(dev[0].SetFeature<HID_PD_REMAININGCAPACITY>(remaining[0]));
+    ASSERT_TRUE(dev[1].SetFeature<HID_PD_REMAININGCAPACITY>(remaining[1]));
+    EXPECT_EQ(dev[0].GetFeature(HID_PD_REMAININGCAPACITY)->data, &remaining[0]);
+    EXPECT_EQ(dev[1].GetFeature(HID_PD_REMAININGCAPACITY)->data, &remaining[1]);
+
+    ASSERT_TRUE(m_host.Enumerate());
+    ASSERT_EQ(m_host.Interfaces().size(), 2u);
+    std::vector<uint8_t> report;
+    ASSERT_TRUE(m_host.GetFeature(m_host.Interfaces()[1].number, HID_PD_REMAININGCAPACITY, report));
+    EXPECT_EQ(report, Report(HID_PD_REMAININGCAPACITY, 200));
+}
+
+TEST_F(HidTest, DeviceCountLimitedByEndpoints) {
+    HIDPowerDevice_ dev[MAX_BATTERIES + 1];
+    (void)dev; // only plugged
+    EXPECT_EQ(PluggableUSB().count(), MAX_BATTERIES); // the last device finds no free endpoint
+    EXPECT_EQ(PluggableUSB().endpoint(MAX_BATTERIES - 1), USB_ENDPOINTS - 1);
+}
+
+TEST_F(HidTest, SendReportIsSingleTransfer) {
+    HIDPowerDevice_ dev;
+    uint8_t endpoint = PluggableUSB().endpoint(0);
+
+    uint16_t value = 0x1234;
+    EXPECT_EQ(dev.SendReport(HID_PD_REMAININGCAPACITY, &value, sizeof(value)), 3);
+
+    ASSERT_EQ(UsbStub::Calls(UsbStub::Send), 1u);
+    EXPECT_EQ(UsbStub::Bytes(UsbStub::Send), 3u);
+    const UsbStub::Transfer& t = UsbStub::Log()[0];
+    EXPECT_EQ(t.ep, endpoint);
+    EXPECT_EQ(t.flags, TRANSFER_RELEASE);
+    EXPECT_EQ(t.data, Report(HID_PD_REMAININGCAPACITY, 0x1234));
+
+    // too large payloads are rejected without a transfer
+    uint8_t large[HID_MAX_REPORT_LENGTH + 1] = {};
+    EXPECT_EQ(dev.SendReport(HID_PD_REMAININGCAPACITY, large, sizeof(large)), -1);
+    EXPECT_EQ(UsbStub::Calls(UsbStub::Send), 1u);
+}
+
+TEST_F(HidTest, SendFailuresAreCounted) {
+    HIDPowerDevice_ dev;
+    uint16_t value = 1;
+
+    UsbStub::FailSends(-3);
+    EXPECT_EQ(dev.SendReport(HID_PD_REMAININGCAPACITY, &value, sizeof(value)), -3);
+    EXPECT_EQ(dev.SendReport(HID_PD_REMAININGCAPACITY, &value, sizeof(value)), -3);
+    EXPECT_EQ(dev.Stats().sendFailures, 2);
+    EXPECT_EQ(dev.Stats().lastSendError, -3);
+}
+
+TEST_F(HidTest, ReportBatchSendsEachReportOnce) {
+    HIDPowerDevice_ primary;
+    HIDPowerDevice_ second(&primary);
+    uint8_t endpoint = PluggableUSB().endpoint(0);
+    UsbStub::SetBanks(8);
+
+    HIDReportBatch batch(second);
+    uint16_t remaining = 0x1234;
+    uint8_t status = 0x05;
+    EXPECT_TRUE(batch.Add(HID_PD_REMAININGCAPACITY, &remaining, sizeof(remaining)));
+    EXPECT_TRUE(batch.Add(HID_PD_PRESENTSTATUS, &status, sizeof(status)));
+    remaining = 0; // payloads are copied
+    EXPECT_EQ(batch.Flush(), 5);
+
+    // one transfer per report, with the report IDs of the second collection
+    const uint8_t offset = HID_REPORT_ID_COUNT;
+    ASSERT_EQ(UsbStub::Calls(UsbStub::Send), 2u);
+    EXPECT_EQ(UsbStub::Log()[0].ep, endpoint);
+    EXPECT_EQ(UsbStub::Log()[0].data, Report(offset + HID_PD_REMAININGCAPACITY, 0x1234));
+    EXPECT_EQ(UsbStub::Log()[1].data, std::vector<uint8_t>({(uint8_t)(offset + HID_PD_PRESENTSTATUS), 0x05}));
+
+    // the batch is empty after Flush
+    EXPECT_EQ(batch.Flush(), 0);
+    EXPECT_EQ(UsbStub::Calls(UsbStub::Send), 2u);
+}
+
+TEST_F(HidTest, ReportBatchLimits) {
+    HIDPowerDevice_ dev;
+    HIDReportBatch batch(dev);
+
+    uint8_t large[HID_MAX_REPORT_LENGTH + 1] = {};
+    EXPECT_FALSE(batch.Add(HID_PD_REMAININGCAPACITY, large, sizeof(large)));
+    int queued = 0;
+    while (batch.Add(HID_PD_REMAININGCAPACITY, large, HID_MAX_REPORT_LENGTH))
+        queued++;
+    EXPECT_EQ(queued, HID_REPORT_BATCH_SIZE/(2 + HID_MAX_REPORT_LENGTH));
+
+    // a failed send is counted like for SendReport, and drops the remaining reports
+    UsbStub::FailSends(-3);
+    EXPECT_EQ(batch.Flush(), -3);
+    EXPECT_EQ(dev.Stats().sendFailures, 1);
+    EXPECT_EQ(dev.Stats().lastSendError, -3);
+    UsbStub::FailSends(0);
+    EXPECT_EQ(batch.Flush(), 0);
+}
+
+TEST_F(HidTest, SendsOneTransferPerChangedInput) {
+    uint16_t remaining = 100;
+    uint16_t runTime = 3600;
+    HIDPowerDevice_ dev;
+    dev.SetFeature<HID_PD_REMAININGCAPACITY>(remaining);
+    dev.SetFeature<HID_PD_RUNTIMETOEMPTY>(runTime);
+    dev.SetInput(HID_PD_REMAININGCAPACITY);
+    dev.SetInput(HID_PD_RUNTIMETOEMPTY, 1000);
+    ASSERT_TRUE(m_host.Enumerate());
+    uint8_t intf = m_host.Interfaces()[0].number;
+
+    UsbStub::SetBanks(8);
+    dev.Publish();
+    EXPECT_EQ(dev.SendInputReports(), 6);
+    EXPECT_EQ(m_host.Poll(intf), std::vector<std::vector<uint8_t>>({Report(HID_PD_REMAININGCAPACITY, 100), Report(HID_PD_RUNTIMETOEMPTY, 3600)}));
+
+    // unchanged values are not resent
+    dev.Publish();
+    EXPECT_EQ(dev.SendInputReports(), 0);
+
+    // changes are sent at most once per period
+    remaining = 90;
+    runTime = 3000;
+    dev.Publish();
+    ArduinoStub::Advance(10);
+    EXPECT_EQ(dev.SendInputReports(), 3);
+    EXPECT_EQ(m_host.Poll(intf), std::vector<std::vector<uint8_t>>({Report(HID_PD_REMAININGCAPACITY, 90)}));
+    ArduinoStub::Advance(1000);
+    EXPECT_EQ(dev.SendInputReports(), 3);
+    EXPECT_EQ(m_host.Poll(intf), std::vector<std::vector<uint8_t>>({Report(HID_PD_RUNTIMETOEMPTY, 3000)}));
+    EXPECT_EQ(UsbStub::Calls(UsbStub::Send), 4u);
+}
+
+TEST_F(HidTest, BusyEndpointQueuesLatestValue) {
+    uint16_t remaining = 100;
+    uint8_t status = 0;
+    HIDPowerDevice_ dev;
+    dev.SetFeature<HID_PD_REMAININGCAPACITY>(remaining);
+    dev.SetFeature(HID_PD_PRESENTSTATUS, &status, sizeof(status));
+    dev.SetInput(HID_PD_REMAININGCAPACITY);
+    dev.SetInput(HID_PD_PRESENTSTATUS);
+    ASSERT_TRUE(m_host.Enumerate());
+    uint8_t intf = m_host.Interfaces()[0].number;
+
+    // only one report fits in the endpoint bank until the host polls
+    dev.Publish();
+    EXPECT_EQ(dev.SendInputReports(), 3);
+    EXPECT_EQ(dev.SendInputReports(), 0); // does not block on the busy endpoint
+    EXPECT_EQ(UsbStub::Calls(UsbStub::Send), 1u);
+
+    // queued reports are merged and sent with the latest value
+    status = 0x05;
+    dev.Publish();
+    EXPECT_EQ(dev.SendInputReports(), 0);
+    EXPECT_EQ(m_host.Poll(intf), std::vector<std::vector<uint8_t>>({Report(HID_PD_REMAININGCAPACITY, 100)}));
+    EXPECT_EQ(dev.SendInputReports(), 2);
+    EXPECT_EQ(m_host.Poll(intf), std::vector<std::vector<uint8_t>>({{HID_PD_PRESENTSTATUS, 0x05}}));
+    EXPECT_EQ(dev.Stats().sendFailures, 0);
+}
+
+TEST_F(HidTest, KeepAliveAndSetIdle) {
+    uint16_t remaining = 100;
+    HIDPowerDevice_ dev;
+    dev.SetFeature<HID_PD_REMAININGCAPACITY>(remaining);
+    dev.SetKeepAlive(400);
+    dev.SetInput(HID_PD_REMAININGCAPACITY);
+    ASSERT_TRUE(m_host.Enumerate());
+    uint8_t intf = m_host.Interfaces()[0].number;
+
+    uint8_t duration = 0;
+    ASSERT_TRUE(m_host.GetIdle(intf, HID_PD_REMAININGCAPACITY, duration));
+    EXPECT_EQ(duration, 100); // 4 ms units
+
+    dev.Publish();
+    EXPECT_EQ(dev.SendInputReports(), 3);
+    m_host.Poll(intf);
+    ArduinoStub::Advance(399);
+    EXPECT_EQ(dev.SendInputReports(), 0);
+    ArduinoStub::Advance(1);
+    EXPECT_EQ(dev.SendInputReports(), 3); // unchanged value resent
+    m_host.Poll(intf);
+
+    // the host disables resending
+    ASSERT_TRUE(m_host.SetIdle(intf, 0, 0));
+    ASSERT_TRUE(m_host.GetIdle(intf, HID_PD_REMAININGCAPACITY, duration));
+    EXPECT_EQ(duration, 0);
+    ArduinoStub::Advance(10000);
+    EXPECT_EQ(dev.SendInputReports(), 0);
+    EXPECT_EQ(dev.Stats().idleRequests, 3);
+}
+
+TEST_F(HidTest, GetReportServesPublishedSnapshot) {
+    uint16_t remaining = 100;
+    uint16_t runTime = 3600;
+    HIDPowerDevice_ dev;
+    dev.SetFeature<HID_PD_REMAININGCAPACITY>(remaining);
+    dev.SetFeature<HID_PD_RUNTIMETOEMPTY>(runTime);
+    ASSERT_TRUE(m_host.Enumerate());
+    uint8_t intf = m_host.Interfaces()[0].number;
+
+    // served from the registered storage until the first Publish
+    std::vector<uint8_t> report;
+    remaining = 110;
+    ASSERT_TRUE(m_host.GetFeature(intf, HID_PD_REMAININGCAPACITY, report));
+    EXPECT_EQ(report, Report(HID_PD_REMAININGCAPACITY, 110));
+
+    dev.Publish();
+    remaining = 50;
+    runTime = 1800;
+    ASSERT_TRUE(m_host.GetFeature(intf, HID_PD_REMAININGCAPACITY, report));
+    EXPECT_EQ(report, Report(HID_PD_REMAININGCAPACITY, 110)); // related updates are not observed half-way
+    ASSERT_TRUE(m_host.GetFeature(intf, HID_PD_RUNTIMETOEMPTY, report));
+    EXPECT_EQ(report, Report(HID_PD_RUNTIMETOEMPTY, 3600));
+
+    dev.Publish();
+    ASSERT_TRUE(m_host.GetFeature(intf, HID_PD_REMAININGCAPACITY, report));
+    EXPECT_EQ(report, Report(HID_PD_REMAININGCAPACITY, 50));
+    ASSERT_TRUE(m_host.GetFeature(intf, HID_PD_RUNTIMETOEMPTY, report));
+    EXPECT_EQ(report, Report(HID_PD_RUNTIMETOEMPTY, 1800));
+}
+
+TEST_F(HidTest, SetReportUpdatesStorageAndNotifies) {
+    uint16_t remnLimit = 100;
+    HIDPowerDevice_ dev;
+    dev.SetFeature<HID_PD_REMNCAPACITYLIMIT>(remnLimit);
+    ASSERT_TRUE(m_host.Enumerate());
+    uint8_t intf = m_host.Interfaces()[0].number;
+    dev.Publish();
+
+    ASSERT_TRUE(m_host.SetFeature(intf, HID_PD_REMNCAPACITYLIMIT, {0x34, 0x12}));
+    EXPECT_EQ(remnLimit, 0x1234);
+    std::vector<uint8_t> report;
+    ASSERT_TRUE(m_host.GetFeature(intf, HID_PD_REMNCAPACITYLIMIT, report));
+    EXPECT_EQ(report, Report(HID_PD_REMNCAPACITYLIMIT, 100)); // served once published
+    dev.Publish();
+    ASSERT_TRUE(m_host.GetFeature(intf, HID_PD_REMNCAPACITYLIMIT, report));
+    EXPECT_EQ(report, Report(HID_PD_REMNCAPACITYLIMIT, 0x1234));
+
+    EXPECT_EQ(dev.PopSetReport(), HID_PD_REMNCAPACITYLIMIT);
+    EXPECT_EQ(dev.PopSetReport(), 0);
+
+    // wrong length, read-only & unknown reports are rejected
+    EXPECT_FALSE(m_host.SetFeature(intf, HID_PD_REMNCAPACITYLIMIT, {0x01}));
+    EXPECT_FALSE(m_host.SetFeature(intf, HID_PD_IPRODUCT, {0x01}));
+    EXPECT_FALSE(m_host.SetFeature(intf, HID_PD_WARNCAPACITYLIMIT, {0x01, 0x02}));
+    EXPECT_EQ(remnLimit, 0x1234);
+    EXPECT_EQ(dev.Stats().setReport, 1);
+    EXPECT_EQ(dev.Stats().setReportMiss, 3);
+    EXPECT_EQ(dev.PopSetReport(), 0);
+}
+
+TEST_F(HidTest, SetReportDoesNotChangePublishedInput) {
+    uint16_t remnLimit = 100;
+    HIDPowerDevice_ dev;
+    dev.SetFeature<HID_PD_REMNCAPACITYLIMIT>(remnLimit);
+    dev.SetInput(HID_PD_REMNCAPACITYLIMIT);
+    ASSERT_TRUE(m_host.Enumerate());
+    uint8_t intf = m_host.Interfaces()[0].number;
+
+    dev.Publish();
+    ASSERT_TRUE(m_host.SetFeature(intf, HID_PD_REMNCAPACITYLIMIT, {0x34, 0x12}));
+    EXPECT_EQ(dev.SendInputReports(), 3);
+    EXPECT_EQ(m_host.Poll(intf), std::vector<std::vector<uint8_t>>({Report(HID_PD_REMNCAPACITYLIMIT, 100)})); // copy sent by loop() is unchanged
+
+    // the host write is sent after it has been published
+    EXPECT_EQ(dev.SendInputReports(), 0);
+    dev.Publish();
+    EXPECT_EQ(dev.SendInputReports(), 3);
+    EXPECT_EQ(m_host.Poll(intf), std::vector<std::vector<uint8_t>>({Report(HID_PD_REMNCAPACITYLIMIT, 0x1234)}));
+}
+
+TEST_F(HidTest, SetReportQueueOverflow) {
+    uint16_t remnLimit = 100;
+    HIDPowerDevice_ dev;
+    dev.SetFeature<HID_PD_REMNCAPACITYLIMIT>(remnLimit);
+    ASSERT_TRUE(m_host.Enumerate());
+    uint8_t intf = m_host.Interfaces()[0].number;
+
+    for (int i = 0; i < HID_SET_QUEUE_SIZE + 2; i++)
+        ASSERT_TRUE(m_host.SetFeature(intf, HID_PD_REMNCAPACITYLIMIT, {(uint8_t)i, 0}));
+    EXPECT_EQ(remnLimit, HID_SET_QUEUE_SIZE + 1); // all writes are applied
+
+    for (int i = 0; i < HID_SET_QUEUE_SIZE; i++)
+        EXPECT_EQ(dev.PopSetReport(), HID_PD_REMNCAPACITYLIMIT);
+    EXPECT_EQ(dev.PopSetReport(), HID_SET_OVERFLOW);
+    EXPECT_EQ(dev.PopSetReport(), 0);
+}
+
+TEST_F(HidTest, SetReportHammerDoesNotAllocate) {
+    uint16_t remnLimit = 100;
+    HIDPowerDevice_ dev;
+    dev.SetFeature<HID_PD_REMNCAPACITYLIMIT>(remnLimit);
+    ASSERT_TRUE(m_host.Enumerate());
+    uint8_t intf = m_host.Interfaces()[0].number;
+    dev.Publish();
+
+    USBSetup setReport = {REQUEST_HOSTTODEVICE_CLASS_INTERFACE, HID_SET_REPORT, HID_PD_REMNCAPACITYLIMIT, HID_REPORT_TYPE_FEATURE, intf, 3};
+    USBSetup getReport = {REQUEST_DEVICETOHOST_CLASS_INTERFACE, HID_GET_REPORT, HID_PD_REMNCAPACITYLIMIT, HID_REPORT_TYPE_FEATURE, intf, 3};
+    std::vector<uint8_t> out = Report(HID_PD_REMNCAPACITYLIMIT, 0);
+    std::vector<uint8_t> in(8);
+    UsbStub::Record(false);
+    ASSERT_TRUE(Control(setReport, out)); // size the stub buffers
+
+    const int iterations = 10000;
+    size_t allocations = s_allocations;
+    size_t heapInUse = mallinfo2().uordblks;
+    bool ok = true;
+    for (int i = 0; i < iterations; i++) {
+        out[1] = (uint8_t)i;
+        out[2] = (uint8_t)(i >> 8);
+        ok &= Control(setReport, out);
+        dev.PopSetReport();
+        dev.Publish();
+        ok &= Control(getReport, in);
+    }
+    size_t newAllocations = s_allocations - allocations;
+    size_t heapGrowth = mallinfo2().uordblks - heapInUse;
+
+    EXPECT_TRUE(ok);
+    EXPECT_EQ(newAllocations, 0u);
+    EXPECT_EQ(heapGrowth, 0u);
+    EXPECT_EQ(remnLimit, iterations - 1);
+    EXPECT_EQ(in, Report(HID_PD_REMNCAPACITYLIMIT, iterations - 1));
+    EXPECT_EQ(dev.Stats().setReport, (uint16_t)(iterations + 1));
+    EXPECT_EQ(dev.Stats().getReport, (uint16_t)iterations);
+}
+
+TEST_F(HidTest, StatsReport) {
+    HIDPowerDevice_ dev;
+    ASSERT_TRUE(m_host.Enumerate());
+    uint8_t intf = m_host.Interfaces()[0].number;
+
+    std::vector<uint8_t> report;
+    EXPECT_FALSE(m_host.GetFeature(intf, HID_PD_TEMPERATURE, report)); // not registered
+    EXPECT_TRUE(m_host.GetFeature(intf, HID_PD_IPRODUCT, report));
+
+    ASSERT_TRUE(m_host.GetFeature(intf, HID_PD_STATS, report));
+    ASSERT_EQ(report.size(), 1 + sizeof(HIDStats));
+    EXPECT_EQ(report[0], HID_PD_STATS);
+    EXPECT_EQ(report.size() - 1, HIDPowerDevice_::FeatureLength(HID_PD_STATS));
+
+    HIDStats stats;
+    memcpy(&stats, &report[1], sizeof(stats));
+    EXPECT_EQ(stats.getReportMiss, 1);
+    EXPECT_EQ(stats.getReport, 2); // IPRODUCT & this request
+}
+
+TEST(HidRam, FixedSizeTables) {
+    EXPECT_EQ(HIDPowerDevice_::RamUsage(3), 3*sizeof(HIDPowerDevice_) + HID_::SharedRam());
+    EXPECT_EQ(HID_::SharedRam(), sizeof(const char*)*HID_STRING_INDEX_COUNT + HID_REPORT_ID_COUNT + 1);
+}
@@ -0,0 +1,51 @@
+// HidConfig cache key of HidBattExt, against the report descriptors of batteries on a shared interface.
+#include <gtest/gtest.h>
+#include <ArduinoStub.h>
+#include <HIDPowerDevice.h>
+#include <HidConfigKey.hpp>
+#include <ReportPlan.hpp>
+#include "UsbHost.h"
+
+TEST(HashBytes, Fnv1a) {
+    EXPECT_EQ(HashBytes(nullptr, 0), 2166136261u);
+    EXPECT_EQ(HashBytes((const unsigned char*)"a", 1), 0xE40C292Cu);
+    EXPECT_EQ(HashBytes((const unsigned char*)"foobar", 6), 0xBF9CF968u);
+}
+
+TEST(HidConfigKey, SameDescriptorMatches) {
+    HidConfigKey a(0x2341, 0x8036, 0x0100, s_hidReportDescriptor, sizeof(s_hidReportDescriptor));
+    HidConfigKey b(0x2341, 0x8036, 0x0100, s_hidReportDescriptor, sizeof(s_hidReportDescriptor));
+    EXPECT_TRUE(a == b);
+
+    HidConfigKey version(0x2341, 0x8036, 0x0101, s_hidReportDescriptor, sizeof(s_hidReportDescriptor));
+    EXPECT_FALSE(a == version);
+}
+
+TEST(HidConfigKey, CollectionsWithOtherReportIdsDiffer) {
+    // batteries on a shared interface are collections with the same VID/PID/version/size, but report IDs offset by HID_REPORT_ID_COUNT
+    const int batteries = 2;
+    UsbStub::Reset();
+    ArduinoStub::Reset();
+    HIDPowerDeviceGroup<batteries> group;
+    UsbHost host;
+    ASSERT_TRUE(host.Enumerate());
+    ASSERT_EQ(host.Interfaces().size(), 1u);
+    const std::vector<uint8_t>& desc = host.Interfaces()[0].reportDesc;
+
+    const unsigned int size = sizeof(s_hidReportDescriptor);
+    ASSERT_EQ(desc.size(), batteries*size);
+    const unsigned char* first = desc.data();
+    const unsigned char* second = desc.data() + size;
+
+    // precondition: the collections poll different FEATURE reports
+    ReportField field0;
+    ReportField field1;
+    ASSERT_TRUE(FindField(first, size, HidItem_Feature, 0x85, 0x6B, field0)); // CycleCount
+    ASSERT_TRUE(FindField(second, size, HidItem_Feature, 0x85, 0x6B, field1));
+    EXPECT_EQ(field1.ReportID, field0.ReportID + HID_REPORT_ID_COUNT);
+
+    HidConfigKey key0(0x2341, 0x8036, 0x0100, first, size);
+    HidConfigKey key1(0x2341, 0x8036, 0x0100, second, size);
+    EXPECT_EQ(key0.DescriptorSize, key1.DescriptorSize);
+    EXPECT_FALSE(key0 == key1); // cache miss, so that the second collection parses its own report IDs
+}
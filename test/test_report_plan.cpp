@@ -0,0 +1,178 @@
+// Portable report parsing of HidBattExt, including the descriptor walk against the report descriptor of the Arduino library.
+#include <gtest/gtest.h>
+#include <ArduinoStub.h>
+#include <HIDPowerDevice.h>
+#include <ReportPlan.hpp>
+#include "UsbHost.h"
+
+static ReportField Field(unsigned char id, unsigned short bitOffset, unsigned char bitSize, bool isSigned = false, unsigned char target = 0) {
+    ReportField field;
+    field.ReportID = id;
+    field.BitOffset = bitOffset;
+    field.BitSize = bitSize;
+    field.Signed = isSigned;
+    field.Target = target;
+    return field;
+}
+
+TEST(ExtractValue, ByteAligned) {
+    const unsigned char report[] = {0x0A, 0x34, 0x12, 0xFF};
+    EXPECT_EQ(ExtractValue(report, sizeof(report), Field(0x0A, 8, 16)), 0x1234);
+    EXPECT_EQ(ExtractValue(report, sizeof(report), Field(0x0A, 8, 8)), 0x34);
+    EXPECT_EQ(ExtractValue(report, sizeof(report), Field(0x0A, 24, 8)), 0xFF);
+    EXPECT_EQ(ExtractValue(report, sizeof(report), Field(0x0A, 24, 8, true)), -1);
+}
+
+TEST(ExtractValue, Unaligned) {
+    // 3-bit field at bit 10, followed by an 11-bit field that spans two byte boundaries
+    const unsigned char report[] = {0x07, 0xB4, 0xFF, 0x00};
+    EXPECT_EQ(ExtractValue(report, sizeof(report), Field(0x07, 10, 3)), 0b101);
+    EXPECT_EQ(ExtractValue(report, sizeof(report), Field(0x07, 13, 11)), 0x7FD);
+    EXPECT_EQ(ExtractValue(report, sizeof(report), Field(0x07, 13, 11, true)), -3);
+    EXPECT_EQ(ExtractValue(report, sizeof(report), Field(0x07, 8, 1)), 0);
+}
+
+TEST(ExtractValue, Wide) {
+    // 32-bit field at bit 12 spans 5 bytes
+    const unsigned char report[] = {0x01, 0x80, 0x67, 0x45, 0x23, 0xF1};
+    EXPECT_EQ(ExtractValue(report, sizeof(report), Field(0x01, 12, 32)), 0x12345678);
+    EXPECT_EQ(ExtractValue(report, sizeof(report), Field(0x01, 8, 32, true)), (long long)(int)0x23456780);
+
+    const unsigned char negative[] = {0x01, 0xFF, 0xFF, 0xFF, 0xFF};
+    EXPECT_EQ(ExtractValue(negative, sizeof(negative), Field(0x01, 8, 32)), 0xFFFFFFFFll);
+    EXPECT_EQ(ExtractValue(negative, sizeof(negative), Field(0x01, 8, 32, true)), -1);
+}
+
+TEST(ExtractValue, OutOfBounds) {
+    const unsigned char report[] = {0x01, 0xFF, 0xFF};
+    EXPECT_EQ(ExtractValue(report, sizeof(report), Field(0x01, 16, 9)), 0); // one bit past the end
+    EXPECT_EQ(ExtractValue(report, sizeof(report), Field(0x01, 8, 0)), 0);
+    EXPECT_EQ(ExtractValue(report, sizeof(report), Field(0x01, 8, 33)), 0);
+    EXPECT_EQ(ExtractValue(report, 0, Field(0x01, 0, 8)), 0);
+}
+
+TEST(LocateField, FindsMaskedBits) {
+    const unsigned char mask[] = {0x00, 0x00, 0xE0, 0x7F, 0x00};
+    ReportField field = Field(0x0A, 0, 0);
+    ASSERT_TRUE(LocateField(mask, sizeof(mask), field));
+    EXPECT_EQ(field.BitOffset, 21);
+    EXPECT_EQ(field.BitSize, 10);
+
+    // round trip through ExtractValue
+    EXPECT_EQ(ExtractValue(mask, sizeof(mask), field), 0x3FF);
+
+    const unsigned char empty[] = {0x00, 0x00};
+    EXPECT_FALSE(LocateField(empty, sizeof(empty), field));
+    const unsigned char wide[] = {0x01, 0x00, 0x00, 0x00, 0x02};
+    EXPECT_FALSE(LocateField(wide, sizeof(wide), field)); // more than 32 bits
+}
+
+TEST(ReportPlan, SortedByReportId) {
+    ReportPlan<8> plan;
+    ASSERT_TRUE(plan.Add(Field(0x14, 8, 16, false, 1)));
+    ASSERT_TRUE(plan.Add(Field(0x0A, 8, 16, false, 2)));
+    ASSERT_TRUE(plan.Add(Field(0x14, 24, 8, false, 3)));
+    ASSERT_TRUE(plan.Add(Field(0x01, 8, 8, false, 4)));
+    EXPECT_EQ(plan.Count(), 4u);
+
+    std::vector<unsigned char> ids;
+    std::vector<unsigned char> targets;
+    for (const ReportField& field : plan) {
+        ids.push_back(field.ReportID);
+        targets.push_back(field.Target);
+    }
+    EXPECT_EQ(ids, std::vector<unsigned char>({0x01, 0x0A, 0x14, 0x14}));
+    EXPECT_EQ(targets, std::vector<unsigned char>({4, 2, 1, 3})); // stable for equal IDs
+}
+
+TEST(ReportPlan, IndexedDispatch) {
+    ReportPlan<8> plan;
+    plan.Add(Field(0x14, 8, 16, false, 1));
+    plan.Add(Field(0x0A, 8, 16, false, 2));
+    plan.Add(Field(0x14, 24, 8, false, 3));
+    plan.Add(Field(0x00, 8, 8, false, 4));
+    plan.Add(Field(0xFF, 8, 8, false, 5));
+
+    // every report ID maps to exactly the fields with that ID
+    unsigned int total = 0;
+    for (unsigned int id = 0; id <= 0xFF; id++) {
+        unsigned int count = 0;
+        for (const ReportField& field : plan.Fields((unsigned char)id)) {
+            EXPECT_EQ(field.ReportID, id);
+            count++;
+        }
+        unsigned int expected = 0;
+        for (const ReportField& field : plan)
+            expected += (field.ReportID == id);
+        EXPECT_EQ(count, expected) << "report " << id;
+        total += count;
+    }
+    EXPECT_EQ(total, plan.Count());
+
+    const unsigned char report[] = {0x14, 0x34, 0x12, 0x56};
+    std::vector<long long> values;
+    for (const ReportField& field : plan.Fields(report[0]))
+        values.push_back(ExtractValue(report, sizeof(report), field));
+    EXPECT_EQ(values, std::vector<long long>({0x1234, 0x56}));
+}
+
+TEST(ReportPlan, Capacity) {
+    ReportPlan<2> plan;
+    EXPECT_TRUE(plan.Add(Field(0x01, 8, 8)));
+    EXPECT_TRUE(plan.Add(Field(0x02, 8, 8)));
+    EXPECT_FALSE(plan.Add(Field(0x03, 8, 8)));
+    EXPECT_EQ(plan.Count(), 2u);
+    EXPECT_EQ(plan.Fields(0x03).begin(), plan.Fields(0x03).end());
+}
+
+// usages read by HidBattExt (device.hpp)
+static const unsigned short BatteryUsages[][2] = {
+    {0x85, 0x6B}, // CycleCount
+    {0x84, 0x36}, // Temperature
+};
+
+TEST(FindField, LocatesBatteryUsages) {
+    ReportField field = Field(0, 0, 0, false, 7);
+    ASSERT_TRUE(FindField(s_hidReportDescriptor, sizeof(s_hidReportDescriptor), HidItem_Feature, 0x85, 0x6B, field));
+    EXPECT_EQ(field.ReportID, HID_PD_CYCLE_COUNT);
+    EXPECT_EQ(field.BitOffset, 8);
+    EXPECT_EQ(field.BitSize, 16);
+    EXPECT_EQ(field.Target, 7); // unchanged
+
+    ASSERT_TRUE(FindField(s_hidReportDescriptor, sizeof(s_hidReportDescriptor), HidItem_Input, 0x84, 0x36, field));
+    EXPECT_EQ(field.ReportID, HID_PD_TEMPERATURE);
+    EXPECT_EQ(field.BitSize, 16);
+
+    EXPECT_FALSE(FindField(s_hidReportDescriptor, sizeof(s_hidReportDescriptor), HidItem_Output, 0x84, 0x36, field));
+    EXPECT_FALSE(FindField(s_hidReportDescriptor, sizeof(s_hidReportDescriptor), HidItem_Feature, 0x84, 0x01, field)); // not in descriptor
+}
+
+TEST(FindField, ValueCapsOfUsagesInSeveralReports) {
+    // batteries on a shared interface repeat every usage with shifted report IDs, like a device with several collections
+    const int batteries = 3;
+    UsbStub::Reset();
+    ArduinoStub::Reset();
+    HIDPowerDeviceGroup<batteries> group;
+    UsbHost host;
+    ASSERT_TRUE(host.Enumerate());
+    ASSERT_EQ(host.Interfaces().size(), 1u);
+    const std::vector<uint8_t>& desc = host.Interfaces()[0].reportDesc;
+
+    // the value caps query in CompileField is sized with all value caps of the report type, like HIDP_CAPS::NumberFeatureValueCaps
+    unsigned int valueCaps = 0;
+    ForEachField(desc.data(), (unsigned int)desc.size(), HidItem_Feature, [&](unsigned long, const ReportField& f) { valueCaps += (f.BitSize > 1); return false; });
+
+    for (const auto& usage : BatteryUsages) {
+        unsigned int count = CountFields(desc.data(), (unsigned int)desc.size(), HidItem_Feature, usage[0], usage[1]);
+        EXPECT_EQ(count, (unsigned int)batteries) << "usage " << usage[1]; // too many for a single-entry query
+        EXPECT_LE(count, valueCaps);
+
+        // the first occurrence is compiled, which belongs to the first collection
+        ReportField first;
+        ASSERT_TRUE(FindField(desc.data(), (unsigned int)desc.size(), HidItem_Feature, usage[0], usage[1], first));
+        ReportField single;
+        ASSERT_TRUE(FindField(s_hidReportDescriptor, sizeof(s_hidReportDescriptor), HidItem_Feature, usage[0], usage[1], single));
+        EXPECT_EQ(first.ReportID, single.ReportID);
+        EXPECT_EQ(first.BitOffset, single.BitOffset);
+    }
+}
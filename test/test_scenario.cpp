@@ -0,0 +1,182 @@
+// BatteryScenario interpreter and the host-side scenario compiler, with the sketch replaying its scenario.
+#include <gtest/gtest.h>
+#include <fstream>
+#include <sstream>
+#define ENABLE_SCENARIO
+#include "Sketch.h"
+#include "ScenarioCompiler.h"
+
+class ScenarioTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        ArduinoStub::Reset();
+    }
+
+    /** Advance millis() by "ms" and update the scenario. */
+    bool Run(unsigned long ms) {
+        ArduinoStub::Advance(ms);
+        return m_scenario.Update();
+    }
+
+    BatteryScenario m_scenario;
+};
+
+TEST_F(ScenarioTest, RampsRunDuringWaits) {
+    const uint8_t program[] = {SCN_CHARGE(50, 10), SCN_TEMP(310, 20), SCN_WAIT(10), SCN_AC(1), SCN_CHARGE(100, 10), SCN_WAIT(10), SCN_END};
+    m_scenario.Start(program, 30, 300);
+
+    EXPECT_TRUE(Run(0));
+    EXPECT_EQ(m_scenario.Charge(0), 30);
+    EXPECT_EQ(m_scenario.Temperature(), 300);
+    EXPECT_FALSE(m_scenario.ACPresent());
+
+    EXPECT_TRUE(Run(5000));
+    EXPECT_EQ(m_scenario.Charge(0), 40);
+    EXPECT_EQ(m_scenario.Temperature(), 302);
+
+    EXPECT_TRUE(Run(5000));
+    EXPECT_EQ(m_scenario.Charge(0), 50);
+    EXPECT_EQ(m_scenario.Temperature(), 305);
+    EXPECT_TRUE(m_scenario.ACPresent());
+
+    EXPECT_TRUE(Run(5000));
+    EXPECT_EQ(m_scenario.Charge(0), 75);
+    EXPECT_EQ(m_scenario.Temperature(), 307);
+
+    EXPECT_FALSE(Run(5000)); // ended
+    EXPECT_EQ(m_scenario.Charge(0), 100);
+    EXPECT_FALSE(Run(5000));
+}
+
+TEST_F(ScenarioTest, UpdateSpanningInstructions) {
+    const uint8_t program[] = {SCN_CHARGE(50, 10), SCN_WAIT(10), SCN_CHARGE(100, 10), SCN_WAIT(10), SCN_END};
+    m_scenario.Start(program, 30, 300);
+
+    // the ramp started at 10 sec includes the rest of the update
+    EXPECT_TRUE(Run(15000));
+    EXPECT_EQ(m_scenario.Charge(0), 75);
+}
+
+TEST_F(ScenarioTest, SpeedAndOffsets) {
+    const uint8_t program[] = {SCN_SPEED(10), SCN_OFFSET(1, -10), SCN_OFFSET(2, 90), SCN_OFFSET(3, -30), SCN_OFFSET(SCENARIO_MAX_BATTERIES, 5),
+                               SCN_CHARGE(20, 100), SCN_WAIT(100), SCN_END};
+    m_scenario.Start(program, 30, 300);
+
+    EXPECT_TRUE(Run(0));
+    EXPECT_TRUE(Run(5000)); // 50 sec scenario time
+    EXPECT_EQ(m_scenario.Charge(0), 25);
+    EXPECT_EQ(m_scenario.Charge(1), 15);
+    EXPECT_EQ(m_scenario.Charge(2), 100); // clamped
+    EXPECT_EQ(m_scenario.Charge(3), 0);   // clamped
+    EXPECT_EQ(m_scenario.Charge(SCENARIO_MAX_BATTERIES), 25); // no offset
+    EXPECT_FALSE(Run(5000));
+}
+
+TEST_F(ScenarioTest, ZeroSpeedRunsInRealTime) {
+    const uint8_t program[] = {SCN_SPEED(0), SCN_CHARGE(40, 10), SCN_WAIT(10), SCN_END};
+    m_scenario.Start(program, 30, 300);
+    EXPECT_TRUE(Run(0));
+    EXPECT_TRUE(Run(5000));
+    EXPECT_EQ(m_scenario.Charge(0), 35);
+}
+
+TEST_F(ScenarioTest, Loops) {
+    const uint8_t program[] = {SCN_AC(1), SCN_WAIT(1), SCN_AC(0), SCN_WAIT(1), SCN_LOOP};
+    m_scenario.Start(program, 30, 300);
+    for (int i = 0; i < 10; i++) {
+        EXPECT_TRUE(Run(i ? 1000 : 0));
+        EXPECT_EQ(m_scenario.ACPresent(), i % 2 == 0) << i;
+    }
+
+    // a loop without wait would never advance
+    const uint8_t busy[] = {SCN_AC(1), SCN_WAIT(0), SCN_LOOP};
+    m_scenario.Start(busy, 30, 300);
+    EXPECT_FALSE(Run(0));
+}
+
+TEST_F(ScenarioTest, KeepsRunningBeyond32BitScenarioTime) {
+    // triangle wave with a 2 h period, replayed at max speed
+    const uint8_t program[] = {SCN_SPEED(255), SCN_CHARGE(0, 0), SCN_CHARGE(100, 3600), SCN_WAIT(3600), SCN_CHARGE(0, 3600), SCN_WAIT(3600), SCN_LOOP};
+    const uint64_t period = 7200000; // [ms]
+    m_scenario.Start(program, 0, 300);
+    ASSERT_TRUE(Run(0));
+
+    // update every second, until the scenario time has passed 2^32 ms by several periods
+    uint64_t time = 0;
+    while (time < (1ull << 32) + 3*period) {
+        ASSERT_TRUE(Run(1000));
+        time += 255*1000;
+
+        uint64_t phase = time % period;
+        double expected = (phase < period/2) ? 100.0*phase/(period/2) : 100.0 - 100.0*(phase - period/2)/(period/2);
+        ASSERT_NEAR(m_scenario.Charge(0), expected, 1) << "at " << time << " ms";
+    }
+}
+
+TEST_F(ScenarioTest, KeepsRunningAcrossMillisWrapAround) {
+    const uint8_t program[] = {SCN_CHARGE(100, 20), SCN_WAIT(20), SCN_END};
+    ArduinoStub::Advance(UINT32_MAX - 5000);
+    m_scenario.Start(program, 0, 300);
+    EXPECT_TRUE(Run(0));
+
+    EXPECT_TRUE(Run(10000));
+    EXPECT_LT(millis(), 5000u); // wrapped around
+    EXPECT_EQ(m_scenario.Charge(0), 50);
+}
+
+TEST(ScenarioCompiler, CompilesSketchScenario) {
+    std::ifstream text(SKETCH_DIR "/scenario.txt");
+    ASSERT_TRUE(text.good());
+    std::vector<uint8_t> bytecode;
+    std::string error;
+    ASSERT_TRUE(CompileScenario(text, bytecode, error)) << error;
+    EXPECT_EQ(bytecode, std::vector<uint8_t>(SCENARIO, SCENARIO + sizeof(SCENARIO)));
+}
+
+TEST(ScenarioCompiler, EncodesArguments) {
+    std::istringstream text("temp 315 1800\n  # comment\n\noffset 2 -20 # lower charge\nend\n");
+    std::vector<uint8_t> bytecode;
+    std::string error;
+    ASSERT_TRUE(CompileScenario(text, bytecode, error)) << error;
+    EXPECT_EQ(bytecode, std::vector<uint8_t>({SCN_TEMP(315, 1800), SCN_OFFSET(2, -20), SCN_END}));
+
+    EXPECT_EQ(FormatScenario({SCN_WAIT(10)}, "WAIT_ONLY"), "const uint8_t WAIT_ONLY[] PROGMEM = {\n  0x04, 0x0A, 0x00\n};\n");
+}
+
+TEST(ScenarioCompiler, ReportsErrorLine) {
+    const struct {
+        const char* text;
+        const char* error;
+    } cases[] = {
+        {"ac 1\ncharge 101 10\n", "line 2: 101 is outside [0, 100]"},
+        {"# start\n\nramp 10\n", "line 3: unknown instruction \"ramp\""},
+        {"wait\n", "line 1: wait expects 1 arguments"},
+        {"wait 1x\n", "line 1: \"1x\" is not a number"},
+        {"speed 0\n", "line 1: 0 is outside [1, 255]"},
+        {"loop 2\n", "line 1: unexpected \"2\""},
+    };
+    for (const auto& c : cases) {
+        std::istringstream text(c.text);
+        std::vector<uint8_t> bytecode;
+        std::string error;
+        EXPECT_FALSE(CompileScenario(text, bytecode, error)) << c.text;
+        EXPECT_EQ(error, c.error);
+    }
+}
+
+TEST(ScenarioSketch, FollowsScenario) {
+    ResetSketch();
+    setup();
+    UsbStub::Record(false);
+
+    // 90 sec replay 30 min of discharge while heating up
+    for (int i = 0; i < 900; i++) {
+        loop();
+        ArduinoStub::Advance(100);
+    }
+    loop();
+    EXPECT_FALSE(Bank.Status[0].Charging);
+    EXPECT_NEAR(Bank.Temperature[0], 315, 1);
+    EXPECT_EQ(Bank.Remaining[1], Ratio::FromPercent(20).Scale(Bank.FullChargeCapacity[1])); // offset
+    EXPECT_EQ(Bank.Temperature[NUM_BATTERIES - 1], Bank.Temperature[0]);
+}
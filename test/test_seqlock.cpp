@@ -0,0 +1,140 @@
+#include <gtest/gtest.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <SeqLock.hpp>
+
+/** Value with redundant words, so that torn reads are detected. */
+struct Sample {
+    unsigned int count;
+    unsigned int inverse;  // ~count
+    unsigned int doubled;  // 2*count
+    unsigned int writer;   // last writer index
+};
+
+static bool Consistent(const Sample& s) {
+    return (s.inverse == ~s.count) && (s.doubled == 2*s.count);
+}
+
+TEST(SeqLock, VersionAdvancesOnChange) {
+    SeqLock<Sample> lock;
+    Sample s = {};
+    EXPECT_EQ(lock.Read(s), 0u);
+    EXPECT_EQ(lock.Version(), 0u);
+
+    lock.Update([](Sample& v) {
+        v.count = 1;
+        v.inverse = ~1u;
+        v.doubled = 2;
+        return true;
+    });
+    EXPECT_EQ(lock.Version(), 2u);
+    EXPECT_EQ(lock.Read(s), 2u);
+    EXPECT_EQ(s.count, 1u);
+
+    // unchanged values keep the version
+    lock.Update([](Sample&) {
+        return false;
+    });
+    EXPECT_EQ(lock.Version(), 2u);
+}
+
+TEST(SeqLock, ReadIfChangedSkipsUnchangedVersion) {
+    SeqLock<Sample> lock;
+    Sample s = {7, 7, 7, 7}; // sentinel, overwritten only by a copy
+    unsigned int version = 0;
+    EXPECT_FALSE(lock.ReadIfChanged(s, version));
+    EXPECT_EQ(s.count, 7u);
+
+    lock.Update([](Sample& v) {
+        v.count = 1;
+        v.inverse = ~1u;
+        v.doubled = 2;
+        return true;
+    });
+    EXPECT_TRUE(lock.ReadIfChanged(s, version));
+    EXPECT_EQ(version, 2u);
+    EXPECT_EQ(s.count, 1u);
+
+    // same version after an update without changes, so the copy is skipped
+    s.count = 7;
+    lock.Update([](Sample&) {
+        return false;
+    });
+    EXPECT_FALSE(lock.ReadIfChanged(s, version));
+    EXPECT_EQ(version, 2u);
+    EXPECT_EQ(s.count, 7u);
+}
+
+TEST(SeqLock, StressReadersAndWriters) {
+    const int writers = 2;
+    const int readers = 4;
+    const unsigned int updatesPerWriter = 200000;
+
+    SeqLock<Sample> lock;
+    lock.Update([](Sample& v) {
+        v = Sample{0, ~0u, 0, 0};
+        return true;
+    });
+
+    std::atomic<bool> done(false);
+    std::atomic<unsigned long> torn(0);
+    std::atomic<unsigned long> regressions(0);
+    std::atomic<unsigned long> reads(0);
+
+    std::vector<std::thread> threads;
+    for (int r = 0; r < readers; r++) {
+        threads.emplace_back([&, r]() {
+            unsigned int lastVersion = 0;
+            unsigned int lastCount = 0;
+            unsigned long n = 0;
+            Sample s = {0, ~0u, 0, 0};
+            unsigned int version = 0;
+            do {
+                // half of the readers keep their copy between reads
+                if (r % 2)
+                    lock.ReadIfChanged(s, version);
+                else
+                    version = lock.Read(s);
+                if (!Consistent(s))
+                    torn++;
+                if ((version < lastVersion) || (s.count < lastCount) || (version & 1))
+                    regressions++;
+                lastVersion = version;
+                lastCount = s.count;
+                n++;
+            } while (!done);
+            reads += n;
+        });
+    }
+
+    std::vector<std::thread> writerThreads;
+    for (int w = 0; w < writers; w++) {
+        writerThreads.emplace_back([&, w]() {
+            for (unsigned int i = 0; i < updatesPerWriter; i++) {
+                lock.Update([w](Sample& v) {
+                    v.count++;
+                    v.inverse = ~v.count;
+                    v.doubled = 2*v.count;
+                    v.writer = w;
+                    return true;
+                });
+            }
+        });
+    }
+    for (std::thread& t : writerThreads)
+        t.join();
+    done = true;
+    for (std::thread& t : threads)
+        t.join();
+
+    // writers are serialized, so no increments are lost
+    Sample s;
+    EXPECT_EQ(lock.Read(s), 2u*(1 + writers*updatesPerWriter));
+    EXPECT_EQ(s.count, writers*updatesPerWriter);
+    EXPECT_TRUE(Consistent(s));
+
+    EXPECT_EQ(torn, 0u);
+    EXPECT_EQ(regressions, 0u);
+    EXPECT_GT(reads, 0u);
+}
@@ -0,0 +1,158 @@
+#include <gtest/gtest.h>
+#include <memory>
+#include <ArduinoStub.h>
+#include <HIDPowerDevice.h>
+#include "UsbHost.h"
+
+static std::vector<uint8_t> Report(uint8_t id, uint16_t value) {
+    return {id, lowByte(value), highByte(value)};
+}
+
+/** Report descriptor of a single battery. */
+static std::vector<uint8_t> Descriptor() {
+    return std::vector<uint8_t>(s_hidReportDescriptor, s_hidReportDescriptor + sizeof(s_hidReportDescriptor));
+}
+
+/** REPORT_ID values of a report descriptor, in order of appearance. */
+static std::vector<uint8_t> ReportIds(const std::vector<uint8_t>& desc) {
+    std::vector<uint8_t> ids;
+    for (size_t pos = 0; pos < desc.size(); pos += 1 + HIDItemSize(desc[pos])) {
+        if ((desc[pos] & HID_ITEM_PREFIX_MASK) == HID_ITEM_REPORT_ID)
+            ids.push_back(desc[pos + 1]);
+    }
+    return ids;
+}
+
+class SharedInterfaceTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        UsbStub::Reset();
+        ArduinoStub::Reset();
+    }
+
+    UsbHost m_host;
+};
+
+TEST_F(SharedInterfaceTest, OneInterfaceWithShiftedCollections) {
+    HIDPowerDeviceGroup<3> group;
+    ASSERT_EQ(PluggableUSB().count(), 1u);
+    ASSERT_TRUE(m_host.Enumerate());
+    ASSERT_EQ(m_host.Interfaces().size(), 1u);
+
+    // report descriptors are concatenated, with the report IDs of collection "i" offset by i*HID_REPORT_ID_COUNT
+    const std::vector<uint8_t>& desc = m_host.Interfaces()[0].reportDesc;
+    ASSERT_EQ(desc.size(), 3*sizeof(s_hidReportDescriptor));
+    std::vector<uint8_t> single = ReportIds(Descriptor());
+    std::vector<uint8_t> expected;
+    for (uint8_t i = 0; i < 3; i++) {
+        for (uint8_t id : single)
+            expected.push_back(id + i*HID_REPORT_ID_COUNT);
+    }
+    EXPECT_EQ(ReportIds(desc), expected);
+
+    // only the report ID items differ from the original descriptor
+    for (size_t pos = 0; pos < sizeof(s_hidReportDescriptor); pos++) {
+        bool isId = (pos > 0) && ((s_hidReportDescriptor[pos - 1] & HID_ITEM_PREFIX_MASK) == HID_ITEM_REPORT_ID);
+        if (!isId) {
+            EXPECT_EQ(desc[2*sizeof(s_hidReportDescriptor) + pos], s_hidReportDescriptor[pos]);
+        }
+    }
+}
+
+TEST_F(SharedInterfaceTest, RoutesRequestsToCollection) {
+    uint16_t remaining[3] = {100, 200, 300};
+    uint16_t remnLimit[3] = {10, 20, 30};
+    HIDPowerDeviceGroup<3> group;
+    HIDPowerDevice_* devices = group;
+    for (int i = 0; i < 3; i++) {
+        devices[i].SetFeature<HID_PD_REMAININGCAPACITY>(remaining[i]);
+        devices[i].SetFeature<HID_PD_REMNCAPACITYLIMIT>(remnLimit[i]);
+    }
+    ASSERT_TRUE(m_host.Enumerate());
+    uint8_t intf = m_host.Interfaces()[0].number;
+
+    std::vector<uint8_t> report;
+    for (uint8_t i = 0; i < 3; i++) {
+        uint8_t id = HID_PD_REMAININGCAPACITY + i*HID_REPORT_ID_COUNT;
+        ASSERT_TRUE(m_host.GetFeature(intf, id, report));
+        EXPECT_EQ(report, Report(id, remaining[i]));
+    }
+
+    ASSERT_TRUE(m_host.SetFeature(intf, HID_PD_REMNCAPACITYLIMIT + 2*HID_REPORT_ID_COUNT, {0x34, 0x12}));
+    EXPECT_EQ(remnLimit[0], 10);
+    EXPECT_EQ(remnLimit[1], 20);
+    EXPECT_EQ(remnLimit[2], 0x1234);
+    EXPECT_EQ(devices[0].PopSetReport(), 0);
+    EXPECT_EQ(devices[2].PopSetReport(), HID_PD_REMNCAPACITYLIMIT); // unshifted ID
+
+    // unknown IDs beyond the last collection
+    EXPECT_FALSE(m_host.GetFeature(intf, HID_PD_REMAININGCAPACITY + 3*HID_REPORT_ID_COUNT, report));
+    EXPECT_EQ(devices[0].Stats().getReportMiss, 1);
+    EXPECT_EQ(devices[1].Stats().getReport, 1);
+}
+
+TEST_F(SharedInterfaceTest, InputReportsShareEndpoint) {
+    uint16_t remaining[2] = {100, 200};
+    HIDPowerDeviceGroup<2> group;
+    HIDPowerDevice_* devices = group;
+    for (int i = 0; i < 2; i++) {
+        devices[i].SetFeature<HID_PD_REMAININGCAPACITY>(remaining[i]);
+        devices[i].SetInput(HID_PD_REMAININGCAPACITY);
+        devices[i].Publish();
+    }
+    ASSERT_TRUE(m_host.Enumerate());
+    uint8_t intf = m_host.Interfaces()[0].number;
+
+    // the second collection waits for the host to poll the single-bank endpoint
+    EXPECT_EQ(devices[0].SendInputReports(), 3);
+    EXPECT_EQ(devices[1].SendInputReports(), 0);
+    EXPECT_EQ(m_host.Poll(intf), std::vector<std::vector<uint8_t>>({Report(HID_PD_REMAININGCAPACITY, 100)}));
+    EXPECT_EQ(devices[1].SendInputReports(), 3);
+    EXPECT_EQ(m_host.Poll(intf), std::vector<std::vector<uint8_t>>({Report(HID_PD_REMAININGCAPACITY + HID_REPORT_ID_COUNT, 200)}));
+
+    for (const UsbStub::Transfer& t : UsbStub::Log()) {
+        if (t.type == UsbStub::Send) {
+            EXPECT_EQ(t.ep, m_host.Interfaces()[0].endpoint);
+        }
+    }
+}
+
+TEST_F(SharedInterfaceTest, SetIdleAppliesToAllCollections) {
+    uint16_t remaining[2] = {};
+    HIDPowerDeviceGroup<2> group;
+    HIDPowerDevice_* devices = group;
+    for (int i = 0; i < 2; i++) {
+        devices[i].SetFeature<HID_PD_REMAININGCAPACITY>(remaining[i]);
+        devices[i].SetInput(HID_PD_REMAININGCAPACITY);
+    }
+    ASSERT_TRUE(m_host.Enumerate());
+    uint8_t intf = m_host.Interfaces()[0].number;
+
+    uint8_t duration = 0;
+    ASSERT_TRUE(m_host.SetIdle(intf, 0, 25));
+    ASSERT_TRUE(m_host.GetIdle(intf, HID_PD_REMAININGCAPACITY + HID_REPORT_ID_COUNT, duration));
+    EXPECT_EQ(duration, 25);
+
+    // per-report SET_IDLE only changes the addressed collection
+    ASSERT_TRUE(m_host.SetIdle(intf, HID_PD_REMAININGCAPACITY + HID_REPORT_ID_COUNT, 50));
+    ASSERT_TRUE(m_host.GetIdle(intf, HID_PD_REMAININGCAPACITY, duration));
+    EXPECT_EQ(duration, 25);
+    ASSERT_TRUE(m_host.GetIdle(intf, HID_PD_REMAININGCAPACITY + HID_REPORT_ID_COUNT, duration));
+    EXPECT_EQ(duration, 50);
+}
+
+TEST_F(SharedInterfaceTest, FallsBackToSeparateInterfaceWhenOutOfIds) {
+    HIDPowerDevice_ primary;
+    std::unique_ptr<HIDPowerDevice_> collections[MAX_SHARED_BATTERIES];
+    for (std::unique_ptr<HIDPowerDevice_>& c : collections)
+        c.reset(new HIDPowerDevice_(&primary));
+
+    // all but the last fit in the 8-bit report ID range
+    EXPECT_EQ(PluggableUSB().count(), 2u);
+    ASSERT_TRUE(m_host.Enumerate());
+    ASSERT_EQ(m_host.Interfaces().size(), 2u);
+    EXPECT_EQ(m_host.Interfaces()[0].reportDesc.size(), MAX_SHARED_BATTERIES*sizeof(s_hidReportDescriptor));
+    uint8_t lastId = ReportIds(Descriptor()).back();
+    EXPECT_EQ(ReportIds(m_host.Interfaces()[0].reportDesc).back(), lastId + (MAX_SHARED_BATTERIES - 1)*HID_REPORT_ID_COUNT); // no wrap-around
+    EXPECT_EQ(ReportIds(m_host.Interfaces()[1].reportDesc).front(), ReportIds(m_host.Interfaces()[0].reportDesc).front());
+}
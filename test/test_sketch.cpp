@@ -0,0 +1,226 @@
+// Runs the battery sketch against a scripted USB host. Built with & without SHARED_INTERFACE.
+#include <gtest/gtest.h>
+#include <algorithm>
+#include "UsbHost.h"
+#include "Sketch.h"
+
+static const uint16_t FULL_CHARGE = AmpSecFromMilliWattHours(40690, 1499);
+
+/** INPUT report received by the host. */
+struct Received {
+    unsigned long time; // millis()
+    std::vector<uint8_t> data;
+};
+
+class SketchTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        ResetSketch();
+        setup();
+        ASSERT_TRUE(m_host.Enumerate());
+#ifdef SHARED_INTERFACE
+        ASSERT_EQ(m_host.Interfaces().size(), 1u);
+#else
+        ASSERT_EQ(m_host.Interfaces().size(), (size_t)NUM_BATTERIES);
+#endif
+        m_received.assign(m_host.Interfaces().size(), std::vector<Received>());
+    }
+
+    /** Interface & report ID offset of "battery". */
+    uint8_t Interface(int battery) const {
+#ifdef SHARED_INTERFACE
+        (void)battery;
+        return m_host.Interfaces()[0].number;
+#else
+        return m_host.Interfaces()[battery].number;
+#endif
+    }
+    static uint8_t ReportId(int battery, uint8_t id) {
+#ifdef SHARED_INTERFACE
+        return id + battery*HID_REPORT_ID_COUNT;
+#else
+        (void)battery;
+        return id;
+#endif
+    }
+
+    /** Run loop() once per millisecond, while the host polls each interrupt endpoint at its interval. */
+    void Run(unsigned long ms) {
+        for (unsigned long i = 0; i < ms; i++) {
+            loop();
+            for (size_t n = 0; n < m_host.Interfaces().size(); n++) {
+                const UsbHost::Interface& intf = m_host.Interfaces()[n];
+                if (millis() % intf.interval)
+                    continue;
+                for (std::vector<uint8_t>& report : m_host.Poll(intf.number))
+                    m_received[n].push_back(Received{millis(), report});
+            }
+            ArduinoStub::Advance(1);
+        }
+    }
+
+    /** INPUT reports received for a report of "battery". */
+    std::vector<Received> Reports(int battery, uint8_t id) const {
+#ifdef SHARED_INTERFACE
+        const std::vector<Received>& all = m_received[0];
+#else
+        const std::vector<Received>& all = m_received[battery];
+#endif
+        std::vector<Received> reports;
+        for (const Received& r : all) {
+            if (r.data[0] == ReportId(battery, id))
+                reports.push_back(r);
+        }
+        return reports;
+    }
+
+    /** 16-bit feature value of "battery" read with GET_REPORT, or -1 on failure. */
+    int GetFeature(int battery, uint8_t id) {
+        std::vector<uint8_t> report;
+        if (!m_host.GetFeature(Interface(battery), ReportId(battery, id), report) || (report.size() < 2))
+            return -1;
+        return (report.size() == 2) ? report[1] : report[1] | (report[2] << 8);
+    }
+
+    /** Serial output as text, with binary frames included. */
+    static std::string SerialText() {
+        return std::string(Serial.Output().begin(), Serial.Output().end());
+    }
+
+    UsbHost m_host;
+    std::vector<std::vector<Received>> m_received; // per interface
+};
+
+/** Send a control frame with "payload" to the serial port of the sketch. */
+static void SerialInput(const std::vector<uint8_t>& payload) {
+    uint8_t len = payload.size();
+    std::vector<uint8_t> frame = {CTRL_SYNC, len};
+    frame.insert(frame.end(), payload.begin(), payload.end());
+    frame.push_back(ControlCrc8(ControlCrc8(0, &len, 1), payload.data(), len));
+    Serial.Input(frame.data(), frame.size());
+}
+
+static uint16_t Value(const Received& r) {
+    return r.data[1] | (r.data[2] << 8);
+}
+
+TEST_F(SketchTest, EnumeratesBatteries) {
+    size_t descLength = 0;
+    for (const UsbHost::Interface& intf : m_host.Interfaces())
+        descLength += intf.reportDesc.size();
+    EXPECT_EQ(descLength, NUM_BATTERIES*sizeof(s_hidReportDescriptor));
+
+    for (int i = 0; i < NUM_BATTERIES; i++) {
+        EXPECT_EQ(GetFeature(i, HID_PD_MANUFACTURER), STRING_INDEX[3*i]);
+        EXPECT_EQ(m_host.GetString(STRING_INDEX[3*i]), HIDStringPool(STRING_OEMVENDOR)[i % 2]);
+        EXPECT_EQ(m_host.GetString(STRING_INDEX[3*i + 1]), HIDStringPool(STRING_SERIAL)[i % 3]);
+        EXPECT_EQ(m_host.GetString(STRING_INDEX[3*i + 2]), HIDStringPool(STRING_DEVICECHEMISTRY)[i % 3]);
+    }
+}
+
+TEST_F(SketchTest, PrintsRamUsage) {
+    std::string expected = "HID RAM total: " + std::to_string(HIDPowerDevice_::RamUsage(NUM_BATTERIES) + sizeof(Bank));
+    EXPECT_NE(SerialText().find(expected), std::string::npos);
+}
+
+TEST_F(SketchTest, ServesInitialState) {
+    Run(1);
+    for (int i = 0; i < NUM_BATTERIES; i++) {
+        EXPECT_EQ(GetFeature(i, HID_PD_REMAININGCAPACITY), Ratio::FromPercent(30).Scale(FULL_CHARGE));
+        EXPECT_EQ(GetFeature(i, HID_PD_FULLCHRGECAPACITY), FULL_CHARGE);
+        EXPECT_EQ(GetFeature(i, HID_PD_DESIGNCAPACITY), DesignCapacity);
+        EXPECT_EQ(GetFeature(i, HID_PD_REMNCAPACITYLIMIT), DesignCapacity/20);
+        EXPECT_EQ(GetFeature(i, HID_PD_WARNCAPACITYLIMIT), DesignCapacity/10);
+        EXPECT_EQ(GetFeature(i, HID_PD_VOLTAGE), 1499);
+        EXPECT_EQ(GetFeature(i, HID_PD_TEMPERATURE), 300);
+        EXPECT_EQ(GetFeature(i, HID_PD_MANUFACTUREDATE), ManufacturerDate);
+        EXPECT_EQ(GetFeature(i, HID_PD_CAPACITYMODE), CapacityMode);
+        EXPECT_EQ(GetFeature(i, HID_PD_PRESENTSTATUS), 0x02); // discharging
+    }
+}
+
+TEST_F(SketchTest, SendsInputReportsToPollingHost) {
+    Run(1000); // the initial reports of all batteries share a single endpoint with SHARED_INTERFACE
+    const uint8_t inputs[] = {HID_PD_REMAININGCAPACITY, HID_PD_RUNTIMETOEMPTY, HID_PD_TEMPERATURE, HID_PD_PRESENTSTATUS, HID_PD_CYCLE_COUNT};
+    for (int i = 0; i < NUM_BATTERIES; i++) {
+        for (uint8_t id : inputs)
+            EXPECT_EQ(Reports(i, id).size(), 1u) << "battery " << i << " report " << (int)id;
+    }
+
+    // the first battery discharges by 2% every 2 sec
+    const uint16_t initial = Ratio::FromPercent(30).Scale(FULL_CHARGE);
+    Run(3500);
+    std::vector<Received> remaining = Reports(0, HID_PD_REMAININGCAPACITY);
+    ASSERT_EQ(remaining.size(), 3u);
+    EXPECT_EQ(Value(remaining[1]), initial - CHARGE_STEP.Scale(FULL_CHARGE));
+    EXPECT_EQ(Value(remaining[2]), initial - 2*CHARGE_STEP.Scale(FULL_CHARGE));
+    EXPECT_GE(remaining[1].time, 2000u);
+    EXPECT_LT(remaining[1].time, 2000u + m_host.Interfaces()[0].interval*NUM_BATTERIES);
+}
+
+TEST_F(SketchTest, ResendsUnchangedReports) {
+    Run(KEEP_ALIVE_INTERVAL + 1000);
+    std::vector<Received> temperature = Reports(NUM_BATTERIES - 1, HID_PD_TEMPERATURE);
+    ASSERT_EQ(temperature.size(), 2u);
+    EXPECT_EQ(Value(temperature[1]), 300);
+    EXPECT_GE(temperature[1].time - temperature[0].time, KEEP_ALIVE_INTERVAL);
+}
+
+TEST_F(SketchTest, HostWritesFeature) {
+    Run(10);
+    std::vector<uint8_t> limit = {0x34, 0x12};
+    ASSERT_TRUE(m_host.SetFeature(Interface(1), ReportId(1, HID_PD_REMNCAPACITYLIMIT), limit));
+    Run(1);
+
+    EXPECT_EQ(Bank.RemnCapacityLimit[1], 0x1234);
+    EXPECT_EQ(Bank.RemnCapacityLimit[0], DesignCapacity/20);
+    EXPECT_EQ(GetFeature(1, HID_PD_REMNCAPACITYLIMIT), 0x1234);
+    EXPECT_NE(SerialText().find("Host changed report 16 of battery 1"), std::string::npos);
+
+    // read-only & unknown features are rejected
+    EXPECT_FALSE(m_host.SetFeature(Interface(1), ReportId(1, HID_PD_DESIGNCAPACITY), limit));
+    EXPECT_FALSE(m_host.SetFeature(Interface(1), ReportId(1, HID_PD_STATS), limit));
+}
+
+TEST_F(SketchTest, SerialControlInjectsValues) {
+    Run(10);
+    Serial.Clear();
+
+    // set the charge of the first battery & the temperature of all batteries
+    SerialInput({CTRL_CMD_SET, 0, HID_PD_REMAININGCAPACITY, 2, 0xE8, 0x03, CTRL_ALL_BATTERIES, HID_PD_TEMPERATURE, 2, 0x3B, 0x01});
+    Run(1);
+
+    const uint8_t response[] = {CTRL_SYNC, 2, CTRL_CMD_SET | CTRL_RESPONSE, CTRL_OK};
+    ASSERT_GE(Serial.Output().size(), sizeof(response));
+    EXPECT_TRUE(std::equal(response, response + sizeof(response), Serial.Output().begin()));
+
+    EXPECT_EQ(GetFeature(0, HID_PD_REMAININGCAPACITY), 1000);
+    EXPECT_EQ(GetFeature(NUM_BATTERIES - 1, HID_PD_TEMPERATURE), 315);
+
+    // injected values are no longer simulated, but derived values follow them
+    Run(5000);
+    EXPECT_EQ(GetFeature(0, HID_PD_REMAININGCAPACITY), 1000);
+    EXPECT_EQ(GetFeature(0, HID_PD_RUNTIMETOEMPTY), RunTime(1000, FULL_CHARGE, Bank.AvgTimeToEmpty));
+    EXPECT_EQ(Reports(0, HID_PD_REMAININGCAPACITY).back().data, std::vector<uint8_t>({ReportId(0, HID_PD_REMAININGCAPACITY), 0xE8, 0x03}));
+    EXPECT_EQ(Reports(0, HID_PD_TEMPERATURE).back().data, std::vector<uint8_t>({ReportId(0, HID_PD_TEMPERATURE), 0x3B, 0x01}));
+}
+
+TEST_F(SketchTest, BatteriesFollowPreviousBattery) {
+    // each battery takes over the charge of the previous battery one step later
+    const uint16_t initial = Ratio::FromPercent(30).Scale(FULL_CHARGE);
+    Run(2*UPDATE_INTERVAL + 500);
+    std::vector<Received> remaining = Reports(1, HID_PD_REMAININGCAPACITY);
+    ASSERT_EQ(remaining.size(), 2u);
+    EXPECT_EQ(Value(remaining[1]), initial - CHARGE_STEP.Scale(FULL_CHARGE));
+    EXPECT_GE(remaining[1].time, 2*UPDATE_INTERVAL);
+    EXPECT_EQ(Bank.Remaining[2], initial);
+
+    // an injected battery stops following, whereas the next battery follows the injected value
+    SerialInput({CTRL_CMD_SET, 1, HID_PD_REMAININGCAPACITY, 2, 0xE8, 0x03});
+    Run(4*UPDATE_INTERVAL);
+    EXPECT_EQ(Bank.Remaining[1], 1000);
+    EXPECT_NE(Bank.Remaining[0], 1000); // still simulated
+    if (NUM_BATTERIES > 2) {
+        EXPECT_EQ(Bank.Remaining[2], 1000);
+    }
+}